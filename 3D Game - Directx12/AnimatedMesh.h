@@ -12,14 +12,22 @@
 #include "ConstantBuffer.h" 
 #include "ShaderReflection.h" 
 #include "TextureManager.h"
+#include "AssetLoader.h"
 
 class AnimatedMesh
 {
 public:
     std::vector<Mesh*> meshes;
     Animation animation;
-    std::vector<std::string> textureFilenames;
+    std::vector<TextureHandle> textureHandles; // One per sub-mesh, resolved at load
     ConstantBuffer* cBuffer = nullptr;
+    float radius = 0.0f; // Of a sphere around the origin holding every vertex of the bind pose
+    bool ready = false; // Set once uploaded, draw does nothing before
+
+    // From loadFile, held until upload
+    std::vector<std::vector<ANIMATED_VERTEX>> loadedVertices;
+    std::vector<std::vector<unsigned int>> loadedIndices;
+    std::vector<std::string> textureFilenames;
 
     ~AnimatedMesh() {
         if (cBuffer) delete cBuffer;
@@ -27,6 +35,21 @@ public:
     }
 
     void load(Core* core, std::string filename, PSOManager* psos, ShaderManager* shaderMgr, TextureManager* textureMgr)
+    {
+        loadFile(filename);
+        upload(core, psos, shaderMgr, textureMgr);
+    }
+
+    // Returns at once with the asset id. The file is read on one of assets' threads, the mesh is uploaded when
+    // assets is pumped and its textures are then loaded the same way, drawn with the placeholder until they are in.
+    int loadAsync(Core* core, AssetLoader* assets, const std::string& filename, PSOManager* psos, ShaderManager* shaderMgr, TextureManager* textureMgr)
+    {
+        return assets->submit(filename, [this, filename]() { return loadFile(filename); },
+            [this, core, assets, psos, shaderMgr, textureMgr]() { upload(core, psos, shaderMgr, textureMgr, assets); });
+    }
+
+    // Reads and parses the model, including the animation, and nothing else so it can run on a loading thread
+    bool loadFile(const std::string& filename)
     {
         GEMLoader::GEMModelLoader loader;
         std::vector<GEMLoader::GEMMesh> gemmeshes;
@@ -35,28 +58,51 @@ public:
 
         for (int i = 0; i < gemmeshes.size(); i++)
         {
-            Mesh* mesh = new Mesh();
             std::vector<ANIMATED_VERTEX> vertices;
             for (int j = 0; j < gemmeshes[i].verticesAnimated.size(); j++)
             {
                 ANIMATED_VERTEX v;
                 memcpy(&v, &gemmeshes[i].verticesAnimated[j], sizeof(ANIMATED_VERTEX));
                 vertices.push_back(v);
+                radius = std::max(radius, sqrtf(v.pos.x * v.pos.x + v.pos.y * v.pos.y + v.pos.z * v.pos.z));
             }
 
             string texName = gemmeshes[i].material.find("albedo").getValue();
             textureFilenames.push_back(texName);
+            loadedVertices.push_back(std::move(vertices));
+            loadedIndices.push_back(std::move(gemmeshes[i].indices));
+        }
 
-            textureMgr->load(core, texName);
+        animation.load(gemanimation);
+        return !loadedVertices.empty();
+    }
 
-            mesh->init(core, vertices, gemmeshes[i].indices);
+    // Creates the GPU side from what loadFile read. With assets the textures load in the background.
+    void upload(Core* core, PSOManager* psos, ShaderManager* shaderMgr, TextureManager* textureMgr, AssetLoader* assets = nullptr)
+    {
+        for (int i = 0; i < loadedVertices.size(); i++)
+        {
+            Mesh* mesh = new Mesh();
+            mesh->init(core, loadedVertices[i], loadedIndices[i]);
             meshes.push_back(mesh);
         }
+        loadedVertices.clear();
+        loadedIndices.clear();
 
-        ID3DBlob* vsBlob = shaderMgr->loadVS("AnimatedModelVS", "animVertexShader.hlsl");
-        ID3DBlob* psBlob = shaderMgr->loadPS("AnimatedModelPS", "animPixelShader.hlsl");
+        if (assets)
+            textureHandles = textureMgr->loadAsync(core, assets, textureFilenames);
+        else
+            textureHandles = textureMgr->load(core, textureFilenames);
 
-        psos->createPSO(core, "AnimatedModelPSO", vsBlob, psBlob, VertexLayoutCache::getAnimatedLayout());
+        ID3DBlob* vsBlob = shaderMgr->loadVS("AnimatedModelVS", "animVertexShader.hlsl");
+        if (core->bindless) {
+            ID3DBlob* psBlob = shaderMgr->loadPS("AnimatedModelBindlessPS", "animPixelShaderBindless.hlsl", "ps_5_1");
+            psos->createPSO(core, "AnimatedModelBindlessPSO", vsBlob, psBlob, VertexLayoutCache::getAnimatedLayout());
+        }
+        else {
+            ID3DBlob* psBlob = shaderMgr->loadPS("AnimatedModelPS", "animPixelShader.hlsl");
+            psos->createPSO(core, "AnimatedModelPSO", vsBlob, psBlob, VertexLayoutCache::getAnimatedLayout());
+        }
 
         ConstantBufferLayout reflectLayout = ShaderReflection::reflect(vsBlob, "staticMeshBuffer");
 
@@ -73,57 +119,67 @@ public:
 
         cBuffer = new ConstantBuffer();
         cBuffer->init(core, cbDesc);
+        ready = true;
+    }
 
-        memcpy(&animation.skeleton.globalInverse, &gemanimation.globalInverse, 16 * sizeof(float));
-        for (int i = 0; i < gemanimation.bones.size(); i++)
+    // Pixels high the mesh covers when drawn with world w, seen from eye
+    float screenSize(const Matrix& w, const Vec3& eye, float projectionScaleY, float viewportHeight) const
+    {
+        float scale = sqrtf(w.m[0] * w.m[0] + w.m[4] * w.m[4] + w.m[8] * w.m[8]);
+        Vec3 offset(w.m[3] - eye.x, w.m[7] - eye.y, w.m[11] - eye.z);
+        float distance = sqrtf(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z);
+        return TextureResidency::screenSize(radius * scale, distance, projectionScaleY, viewportHeight);
+    }
+
+    // Streams this mesh's textures in for drawing at screenPixels high
+    void requestTextures(TextureManager* textures, float screenPixels)
+    {
+        for (TextureHandle handle : textureHandles)
         {
-            Bone bone;
-            bone.name = gemanimation.bones[i].name;
-            memcpy(&bone.offset, &gemanimation.bones[i].offset, 16 * sizeof(float));
-            bone.parentIndex = gemanimation.bones[i].parentIndex;
-            animation.skeleton.bones.push_back(bone);
+            textures->request(handle, screenPixels);
         }
-        for (int i = 0; i < gemanimation.animations.size(); i++)
+    }
+
+    // Gives back the mesh's references to its textures
+    void releaseTextures(Core* core, TextureManager* textures)
+    {
+        for (TextureHandle handle : textureHandles)
         {
-            std::string name = gemanimation.animations[i].name;
-            AnimationSequence aseq;
-            aseq.ticksPerSecond = gemanimation.animations[i].ticksPerSecond;
-            for (int j = 0; j < gemanimation.animations[i].frames.size(); j++)
-            {
-                AnimationFrame frame;
-                for (int index = 0; index < gemanimation.animations[i].frames[j].positions.size(); index++)
-                {
-                    Vec3 p; Quaternion q; Vec3 s;
-                    memcpy(&p, &gemanimation.animations[i].frames[j].positions[index], sizeof(Vec3));
-                    frame.positions.push_back(p);
-                    memcpy(&q, &gemanimation.animations[i].frames[j].rotations[index], sizeof(Quaternion));
-                    frame.rotations.push_back(q);
-                    memcpy(&s, &gemanimation.animations[i].frames[j].scales[index], sizeof(Vec3));
-                    frame.scales.push_back(s);
-                }
-                aseq.frames.push_back(frame);
-            }
-            animation.animations.insert({ name, aseq });
+            textures->release(core, handle);
         }
+        textureHandles.clear();
     }
 
     void draw(Core* core, PSOManager* psos, ShaderManager* shaderMgr, TextureManager* textures, AnimationInstance* instance, Matrix& vp, Matrix& w)
     {
-        psos->bind(core, "AnimatedModelPSO");
+        draw(core, psos, shaderMgr, textures, instance->matrices, 256, vp, w);
+    }
+
+    // Draws with bone matrices that are not owned by an AnimationInstance, e.g. from a simulation snapshot
+    void draw(Core* core, PSOManager* psos, ShaderManager* shaderMgr, TextureManager* textures, const Matrix* bones, int boneCount, const Matrix& vp, const Matrix& w)
+    {
+        if (!ready)
+            return;
+        psos->bind(core, core->bindless ? "AnimatedModelBindlessPSO" : "AnimatedModelPSO");
+        core->drawStream.setObjectPosition(w.m[3], w.m[7], w.m[11]);
 
         cBuffer->update("W", &w, sizeof(Matrix));
         cBuffer->update("VP", &vp, sizeof(Matrix));
 
-        size_t boneDataSize = sizeof(instance->matrices);
-        cBuffer->update("bones", instance->matrices, boneDataSize);
+        size_t boneDataSize = boneCount * sizeof(Matrix);
+        cBuffer->update("bones", bones, boneDataSize);
 
-        core->getCommandList()->SetGraphicsRootConstantBufferView(0, cBuffer->getGPUAddress());
+        core->drawStream.setRootCBV(0, cBuffer->getGPUAddress());
 
         for (int i = 0; i < meshes.size(); i++)
         {
-            int textureIndex = textures->find(textureFilenames[i]);
+            int textureIndex = textures->find(textureHandles[i]);
             if (textureIndex != -1) {
-                shaderMgr->updateTexturePS(core, "AnimatedModelPS", "tex", textureIndex);
+                // Bindless sub-meshes only change a root constant, not the descriptor table
+                if (core->bindless)
+                    core->drawStream.setTextureIndex(textureIndex);
+                else
+                    shaderMgr->updateTexturePS(core, "AnimatedModelPS", "tex", textureIndex);
             }
             meshes[i]->draw(core);
         }
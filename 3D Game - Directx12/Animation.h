@@ -3,8 +3,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <cstring>
 
-#include "Maths.h"
+#include "maths.h"
+#include "GEMLoader.h"
 
 struct Bone
 {
@@ -19,7 +21,7 @@ struct Skeleton
 	Matrix globalInverse;
 	int findBone(std::string name)
 	{
-		for (int i = 0; i < bones.size(); i++)
+		for (int i = 0; i < (int)bones.size(); i++)
 		{
 			if (bones[i].name == name)
 			{
@@ -37,6 +39,17 @@ struct AnimationFrame
 	std::vector<Vec3> scales;
 };
 
+struct BonePose // Local TRS of a single bone, blended before the hierarchy is applied
+{
+	Vec3 position;
+	Quaternion rotation;
+	Vec3 scale;
+	Matrix toMatrix()
+	{
+		return Matrix::scaling3D(scale) * rotation.toMatrix() * Matrix::translation3D(position);
+	}
+};
+
 struct AnimationSequence // This holds rescaled times
 {
 	std::vector<AnimationFrame> frames;
@@ -62,7 +75,7 @@ struct AnimationSequence // This holds rescaled times
 	}
 	bool running(float t)
 	{
-		if ((int)floorf(t * ticksPerSecond) < frames.size())
+		if ((int)floorf(t * ticksPerSecond) < (int)frames.size())
 		{
 			return true;
 		}
@@ -72,6 +85,13 @@ struct AnimationSequence // This holds rescaled times
 	{
 		return std::min(frame + 1, (int)(frames.size() - 1));
 	}
+	void sampleLocal(int baseFrame, float interpolationFact, int boneIndex, BonePose& pose)
+	{
+		int next = nextFrame(baseFrame);
+		pose.position = interpolate(frames[baseFrame].positions[boneIndex], frames[next].positions[boneIndex], interpolationFact);
+		pose.rotation = interpolate(frames[baseFrame].rotations[boneIndex], frames[next].rotations[boneIndex], interpolationFact);
+		pose.scale = interpolate(frames[baseFrame].scales[boneIndex], frames[next].scales[boneIndex], interpolationFact);
+	}
 	Matrix interpolateBoneToGlobal(Matrix* matrices, int baseFrame, float interpolationFact, Skeleton* skeleton, int boneIndex)
 	{
 		Matrix scale = Matrix::scaling3D(interpolate(frames[baseFrame].scales[boneIndex], frames[nextFrame(baseFrame)].scales[boneIndex], interpolationFact));
@@ -96,6 +116,41 @@ public:
 	{
 		return skeleton.bones.size();
 	}
+	// Copies the skeleton and sequences out of a loaded GEM file, no GPU resources involved
+	void load(GEMLoader::GEMAnimation& gemanimation)
+	{
+		memcpy((void*)&skeleton.globalInverse, &gemanimation.globalInverse, 16 * sizeof(float));
+		for (int i = 0; i < (int)gemanimation.bones.size(); i++)
+		{
+			Bone bone;
+			bone.name = gemanimation.bones[i].name;
+			memcpy((void*)&bone.offset, &gemanimation.bones[i].offset, 16 * sizeof(float));
+			bone.parentIndex = gemanimation.bones[i].parentIndex;
+			skeleton.bones.push_back(bone);
+		}
+		for (int i = 0; i < (int)gemanimation.animations.size(); i++)
+		{
+			std::string name = gemanimation.animations[i].name;
+			AnimationSequence aseq;
+			aseq.ticksPerSecond = gemanimation.animations[i].ticksPerSecond;
+			for (int j = 0; j < (int)gemanimation.animations[i].frames.size(); j++)
+			{
+				AnimationFrame frame;
+				for (int index = 0; index < (int)gemanimation.animations[i].frames[j].positions.size(); index++)
+				{
+					Vec3 p; Quaternion q; Vec3 s;
+					memcpy((void*)&p, &gemanimation.animations[i].frames[j].positions[index], sizeof(Vec3));
+					frame.positions.push_back(p);
+					memcpy((void*)&q, &gemanimation.animations[i].frames[j].rotations[index], sizeof(Quaternion));
+					frame.rotations.push_back(q);
+					memcpy((void*)&s, &gemanimation.animations[i].frames[j].scales[index], sizeof(Vec3));
+					frame.scales.push_back(s);
+				}
+				aseq.frames.push_back(frame);
+			}
+			animations.insert({ name, aseq });
+		}
+	}
 	void calcFrame(std::string name, float t, int& frame, float& interpolationFact)
 	{
 		animations[name].calcFrame(t, frame, interpolationFact);
@@ -104,6 +159,21 @@ public:
 	{
 		return animations[name].interpolateBoneToGlobal(matrices, baseFrame, interpolationFact, &skeleton, boneIndex);
 	}
+	void localToGlobal(BonePose* poses, Matrix* matrices)
+	{
+		for (int i = 0; i < bonesSize(); i++)
+		{
+			Matrix local = poses[i].toMatrix();
+			if (skeleton.bones[i].parentIndex > -1)
+			{
+				matrices[i] = local * matrices[skeleton.bones[i].parentIndex];
+			}
+			else
+			{
+				matrices[i] = local;
+			}
+		}
+	}
 	void calcTransforms(Matrix* matrices, Matrix coordTransform)
 	{
 		for (int i = 0; i < bonesSize(); i++)
@@ -121,6 +191,14 @@ public:
 	}
 };
 
+struct AnimationLayer
+{
+	std::string name;
+	float t = 0;
+	float weight = 0;
+	bool additive = false; // Additive layers add their offset from the clip's first frame on top of the blended pose
+};
+
 class AnimationInstance
 {
 public:
@@ -128,8 +206,19 @@ public:
 	std::string usingAnimation;
 	float t;
 	Matrix matrices[256]; // This is defined as 256 to match the maximum number in the shader
-	Matrix matricesPose[256]; // This is to store transforms needed for finding bone positions
+	Matrix matricesPose[256]; // Global bone poses (before offsets) for the current frame, used for finding bone positions
 	Matrix coordTransform;
+	bool poseDirty = true; // Cleared by update, set whenever matricesPose no longer matches usingAnimation and t
+	std::string poseAnimation;
+	float poseT = -1.0f;
+	std::string fadeAnimation; // Clip being faded out by crossFade
+	bool fadeFromPose = false; // Fading out fadePose instead, the blend a crossFade interrupted
+	std::vector<BonePose> fadePose;
+	float fadeT = 0;
+	float fadeTime = 0;
+	float fadeDuration = 0;
+	std::vector<AnimationLayer> layers;
+	std::vector<BonePose> blendPose;
 	void init(Animation* _animation, int fromYZX)
 	{
 		animation = _animation;
@@ -141,6 +230,17 @@ public:
 		{
 			coordTransform = Matrix();
 		}
+		poseDirty = true;
+	}
+	float advanceTime(const std::string& name, float time, float dt)
+	{
+		time += dt;
+		float duration = animation->animations[name].duration();
+		if (duration > 0 && time > duration)
+		{
+			time = fmod(time, duration);
+		}
+		return time;
 	}
 	void update(std::string name, float dt)
 	{
@@ -148,29 +248,231 @@ public:
 		{
 			usingAnimation = name;
 			t = 0;
+			fadeDuration = 0;
 		}
 
-		t += dt; 
+		t = advanceTime(usingAnimation, t, dt);
 
-		float duration = animation->animations[usingAnimation].duration();
+		if (fadeDuration > 0)
+		{
+			fadeTime += dt;
+			if (!fadeFromPose)
+			{
+				fadeT = advanceTime(fadeAnimation, fadeT, dt);
+			}
+			if (fadeTime >= fadeDuration)
+			{
+				fadeDuration = 0;
+			}
+		}
+		for (auto& layer : layers)
+		{
+			layer.t = advanceTime(layer.name, layer.t, dt);
+		}
 
-		if (duration > 0 && t > duration)
+		evaluateGlobal(matrices);
+		// Keep the global pose so socket queries this frame don't have to re-walk the bone chains
+		memcpy(matricesPose, matrices, animation->bonesSize() * sizeof(Matrix));
+		markPoseClean();
+		animation->calcTransforms(matrices, coordTransform);
+	}
+	void crossFade(std::string name, float duration)
+	{
+		if (name == usingAnimation)
+		{
+			return;
+		}
+		if (duration <= 0 || usingAnimation.empty() || !animation->hasAnimation(usingAnimation))
+		{
+			usingAnimation = name;
+			t = 0;
+			fadeDuration = 0;
+			return;
+		}
+		// Interrupting a fade starts the new one from where the blend is now rather than jumping to the clip it was fading to
+		if (fadeDuration > 0)
+		{
+			captureFadePose();
+			fadeFromPose = true;
+		}
+		else
+		{
+			fadeAnimation = usingAnimation;
+			fadeT = t;
+			fadeFromPose = false;
+		}
+		fadeTime = 0;
+		fadeDuration = duration;
+		usingAnimation = name;
+		t = 0;
+	}
+	int addLayer(std::string name, float weight, bool additive)
+	{
+		AnimationLayer layer;
+		layer.name = name;
+		layer.weight = weight;
+		layer.additive = additive;
+		layers.push_back(layer);
+		poseDirty = true;
+		return (int)layers.size() - 1;
+	}
+	void setLayerWeight(int index, float weight)
+	{
+		layers[index].weight = weight;
+		poseDirty = true;
+	}
+	void clearLayers()
+	{
+		layers.clear();
+		poseDirty = true;
+	}
+	bool isBlending()
+	{
+		return fadeDuration > 0 || !layers.empty();
+	}
+	void evaluateGlobal(Matrix* globals)
+	{
+		if (!isBlending())
 		{
-			t = fmod(t, duration);
+			int frame = 0;
+			float interpolationFact = 0;
+			animation->calcFrame(usingAnimation, t, frame, interpolationFact);
+			for (int i = 0; i < animation->bonesSize(); i++)
+			{
+				globals[i] = animation->interpolateBoneToGlobal(usingAnimation, globals, frame, interpolationFact, i);
+			}
+			return;
 		}
 
+		// Blend every contributing clip in local TRS, then do a single hierarchy pass
+		if ((int)blendPose.size() < animation->bonesSize())
+		{
+			blendPose.resize(animation->bonesSize());
+		}
+		float fadeWeight = fadeDuration > 0 ? 1.0f - (fadeTime / fadeDuration) : 0.0f;
+		float totalWeight = 1.0f - fadeWeight;
+		blendFade(fadeWeight);
+		totalWeight += fadeWeight;
+		for (auto& layer : layers)
+		{
+			if (!layer.additive && layer.weight > 0)
+			{
+				blendClip(layer.name, layer.t, layer.weight, false);
+				totalWeight += layer.weight;
+			}
+		}
+		float invWeight = totalWeight > 0 ? 1.0f / totalWeight : 1.0f;
+		for (int i = 0; i < animation->bonesSize(); i++)
+		{
+			blendPose[i].position = blendPose[i].position * invWeight;
+			blendPose[i].scale = blendPose[i].scale * invWeight;
+			blendPose[i].rotation.Normalize();
+		}
+		for (auto& layer : layers)
+		{
+			if (layer.additive && layer.weight > 0)
+			{
+				addClip(layer.name, layer.t, layer.weight);
+			}
+		}
+		animation->localToGlobal(blendPose.data(), globals);
+	}
+	void blendClip(const std::string& name, float time, float weight, bool first)
+	{
+		AnimationSequence& seq = animation->animations[name];
 		int frame = 0;
 		float interpolationFact = 0;
-		animation->calcFrame(name, t, frame, interpolationFact);
+		seq.calcFrame(time, frame, interpolationFact);
 		for (int i = 0; i < animation->bonesSize(); i++)
 		{
-			matrices[i] = animation->interpolateBoneToGlobal(name, matrices, frame, interpolationFact, i);
+			BonePose pose;
+			seq.sampleLocal(frame, interpolationFact, i, pose);
+			blendInto(blendPose[i], pose, weight, first);
+		}
+	}
+	// The clip being faded to at its share, then whatever is being faded out at the rest
+	void blendFade(float fadeWeight)
+	{
+		blendClip(usingAnimation, t, 1.0f - fadeWeight, true);
+		if (fadeWeight <= 0)
+		{
+			return;
+		}
+		if (!fadeFromPose)
+		{
+			blendClip(fadeAnimation, fadeT, fadeWeight, false);
+			return;
+		}
+		for (int i = 0; i < animation->bonesSize(); i++)
+		{
+			blendInto(blendPose[i], fadePose[i], fadeWeight, false);
+		}
+	}
+	// Keeps the base pose of the fade in progress, without layers, for the next fade to start from
+	void captureFadePose()
+	{
+		if ((int)blendPose.size() < animation->bonesSize())
+		{
+			blendPose.resize(animation->bonesSize());
+		}
+		blendFade(1.0f - (fadeTime / fadeDuration));
+		for (int i = 0; i < animation->bonesSize(); i++)
+		{
+			blendPose[i].rotation.Normalize();
+		}
+		fadePose.assign(blendPose.begin(), blendPose.begin() + animation->bonesSize());
+	}
+	static void blendInto(BonePose& dst, const BonePose& pose, float weight, bool first)
+	{
+		if (first)
+		{
+			dst.position = pose.position * weight;
+			dst.scale = pose.scale * weight;
+			dst.rotation = Quaternion(pose.rotation.a * weight, pose.rotation.b * weight, pose.rotation.c * weight, pose.rotation.d * weight);
+			return;
+		}
+		dst.position += pose.position * weight;
+		dst.scale += pose.scale * weight;
+		float dp = dst.rotation.a * pose.rotation.a + dst.rotation.b * pose.rotation.b + dst.rotation.c * pose.rotation.c + dst.rotation.d * pose.rotation.d;
+		float w = dp < 0 ? -weight : weight; // Keep the quaternions in the same hemisphere
+		dst.rotation.a += pose.rotation.a * w;
+		dst.rotation.b += pose.rotation.b * w;
+		dst.rotation.c += pose.rotation.c * w;
+		dst.rotation.d += pose.rotation.d * w;
+	}
+	// How much pose scales relative to reference, left at 1 on any axis where the reference scale is zero
+	static Vec3 relativeScale(const Vec3& pose, const Vec3& reference)
+	{
+		return Vec3(
+			fabsf(reference.x) > 1e-6f ? pose.x / reference.x : 1.0f,
+			fabsf(reference.y) > 1e-6f ? pose.y / reference.y : 1.0f,
+			fabsf(reference.z) > 1e-6f ? pose.z / reference.z : 1.0f);
+	}
+	void addClip(const std::string& name, float time, float weight)
+	{
+		AnimationSequence& seq = animation->animations[name];
+		int frame = 0;
+		float interpolationFact = 0;
+		seq.calcFrame(time, frame, interpolationFact);
+		for (int i = 0; i < animation->bonesSize(); i++)
+		{
+			BonePose pose;
+			BonePose reference;
+			seq.sampleLocal(frame, interpolationFact, i, pose);
+			seq.sampleLocal(0, 0, i, reference);
+			BonePose& dst = blendPose[i];
+			dst.position += (pose.position - reference.position) * weight;
+			dst.scale *= lerp(Vec3(1.0f, 1.0f, 1.0f), relativeScale(pose.scale, reference.scale), weight);
+			Quaternion delta = reference.rotation;
+			delta.invert();
+			delta = delta * pose.rotation;
+			dst.rotation = dst.rotation * Quaternion::slerp(Quaternion(0, 0, 0, 1), delta, weight);
 		}
-		animation->calcTransforms(matrices, coordTransform);
 	}
 	void resetAnimationTime()
 	{
 		t = 0;
+		poseDirty = true;
 	}
 	bool animationFinished()
 	{
@@ -180,23 +482,52 @@ public:
 		}
 		return false;
 	}
+	void markPoseClean()
+	{
+		poseDirty = false;
+		poseAnimation = usingAnimation;
+		poseT = t;
+	}
+	bool isPoseValid()
+	{
+		// usingAnimation and t are public and are written directly by the animation managers, so check them too
+		return !poseDirty && poseT == t && poseAnimation == usingAnimation;
+	}
+	void updatePose()
+	{
+		if (isPoseValid())
+		{
+			return;
+		}
+		evaluateGlobal(matricesPose);
+		markPoseClean();
+	}
+	Matrix findWorldMatrix(int boneID)
+	{
+		updatePose();
+		return (matricesPose[boneID] * coordTransform);
+	}
 	Matrix findWorldMatrix(std::string boneName)
 	{
-		int boneID = animation->skeleton.findBone(boneName);
-		std::vector<int> boneChain;
-		int ID = boneID;
-		while (ID != -1)
+		return findWorldMatrix(animation->skeleton.findBone(boneName));
+	}
+	// Batched socket query, the pose is brought up to date once and every bone is a single lookup
+	void findWorldMatrices(const int* boneIDs, int count, Matrix* worldMatrices)
+	{
+		updatePose();
+		for (int i = 0; i < count; i++)
 		{
-			boneChain.push_back(ID);
-			ID = animation->skeleton.bones[ID].parentIndex;
+			worldMatrices[i] = matricesPose[boneIDs[i]] * coordTransform;
 		}
-		int frame = 0;
-		float interpolationFact = 0;
-		animation->calcFrame(usingAnimation, t, frame, interpolationFact);
-		for (int i = boneChain.size() - 1; i > -1; i = i - 1)
+	}
+	void findWorldMatrices(const std::vector<std::string>& boneNames, std::vector<Matrix>& worldMatrices)
+	{
+		std::vector<int> boneIDs(boneNames.size());
+		for (int i = 0; i < (int)boneNames.size(); i++)
 		{
-			matricesPose[boneChain[i]] = animation->interpolateBoneToGlobal(usingAnimation, matricesPose, frame, interpolationFact, boneChain[i]);
+			boneIDs[i] = animation->skeleton.findBone(boneNames[i]);
 		}
-		return (matricesPose[boneID] * coordTransform);
+		worldMatrices.resize(boneNames.size());
+		findWorldMatrices(boneIDs.data(), (int)boneIDs.size(), worldMatrices.data());
 	}
 };
\ No newline at end of file
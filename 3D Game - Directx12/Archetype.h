@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <tuple>
+#include <utility>
+
+// Stores each component type of one kind of entity in its own dense array (one row per entity),
+// so a system only pulls the arrays it actually reads through the cache
+template<typename... Components>
+class Archetype
+{
+public:
+	std::tuple<std::vector<Components>...> columns;
+
+	template<typename T>
+	std::vector<T>& get()
+	{
+		return std::get<std::vector<T>>(columns);
+	}
+
+	template<typename T>
+	T& get(int row)
+	{
+		return std::get<std::vector<T>>(columns)[row];
+	}
+
+	int size() const
+	{
+		return (int)std::get<0>(columns).size();
+	}
+
+	int add(const Components&... values)
+	{
+		(get<Components>().push_back(values), ...);
+		return size() - 1;
+	}
+
+	// Swap and pop, the last row is moved into the removed one so the arrays stay dense
+	void remove(int row)
+	{
+		int last = size() - 1;
+		if (row != last)
+		{
+			((get<Components>()[row] = std::move(get<Components>()[last])), ...);
+		}
+		(get<Components>().pop_back(), ...);
+	}
+
+	void reserve(int count)
+	{
+		(get<Components>().reserve(count), ...);
+	}
+
+	void clear()
+	{
+		(get<Components>().clear(), ...);
+	}
+};
@@ -0,0 +1,267 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <ostream>
+#include <cstdio>
+#include <climits>
+
+enum AssetState
+{
+    AssetQueued,
+    AssetLoading, // load is running on a loading thread
+    AssetLoaded, // Waiting for pump to run finish
+    AssetReady,
+    AssetFailed
+};
+
+// Times in ms since the loader was initialised
+struct AssetRecord
+{
+    int id = -1;
+    std::string name;
+    AssetState state = AssetQueued;
+    double queuedMs = 0.0;
+    double loadStartMs = 0.0;
+    double loadedMs = 0.0;
+    double readyMs = 0.0;
+};
+
+// Background loading. submit returns an id straight away, the load function then runs on one of the loading
+// threads (file reads, parsing, decoding: nothing that touches the GPU) and finish runs on whichever thread calls
+// pump, normally the main thread once per frame, for the GPU side. Unlike JobSystem nothing waits for the work
+// unless asked to with waitLoaded or finishAll.
+//
+// Assets submitted with keepRecord false, e.g. anything streamed in and out for as long as the game runs, are
+// forgotten once they have finished: they are left out of records and report, and state says AssetReady for them.
+class AssetLoader {
+public:
+    ~AssetLoader() {
+        shutdown();
+    }
+
+    // threadCount 0 runs every load inside submit
+    void init(int threadCount) {
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < threadCount; i++) {
+            threads.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        threads.clear();
+    }
+
+    // load returns false when the asset could not be loaded, finish is then never called
+    int submit(const std::string& name, std::function<bool()> load, std::function<void()> finish = nullptr, bool keepRecord = true) {
+        int id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            id = firstId + (int)assets.size();
+            assets.emplace_back();
+            Asset& asset = assets.back();
+            asset.keepRecord = keepRecord;
+            asset.record.id = id;
+            asset.record.name = name;
+            asset.record.queuedMs = now();
+            asset.load = std::move(load);
+            asset.finish = std::move(finish);
+            if (!threads.empty()) queue.push_back(id);
+        }
+        if (threads.empty()) {
+            runLoad(id);
+        }
+        else {
+            wake.notify_one();
+        }
+        return id;
+    }
+
+    // Runs finish for up to maxAssets loaded assets, in the order they were submitted. Returns how many became ready.
+    int pump(int maxAssets = INT_MAX) {
+        int finished = 0;
+        while (finished < maxAssets) {
+            int id = -1;
+            std::function<void()> finish;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                while (!assets.empty() && (assets.front().record.state == AssetReady || assets.front().record.state == AssetFailed)) {
+                    if (assets.front().keepRecord) history.push_back(std::move(assets.front().record));
+                    assets.pop_front();
+                    firstId++;
+                }
+                for (int i = 0; i < (int)assets.size(); i++) {
+                    if (assets[i].record.state == AssetLoaded) {
+                        id = firstId + i;
+                        finish = std::move(assets[i].finish);
+                        break;
+                    }
+                }
+            }
+            if (id == -1) break;
+            // finish may submit more assets, so it runs without the lock. Only this thread moves assets out of Loaded.
+            if (finish) finish();
+            std::lock_guard<std::mutex> lock(mutex);
+            // Only pump takes assets off the front, so id is still where it was
+            Asset& asset = assets[id - firstId];
+            asset.record.state = AssetReady;
+            asset.record.readyMs = now();
+            finished++;
+        }
+        return finished;
+    }
+
+    // Blocks until id's load has run, e.g. for data the game cannot start without
+    void waitLoaded(int id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        loadedSignal.wait(lock, [this, id]() { return id < firstId || assets[id - firstId].record.state >= AssetLoaded; });
+    }
+
+    // Loads and finishes everything, including assets submitted by finish functions along the way
+    void finishAll() {
+        while (true) {
+            pump();
+            std::unique_lock<std::mutex> lock(mutex);
+            if (pendingLocked() == 0) return;
+            loadedSignal.wait(lock, [this]() { return anyLoadedLocked() || pendingLocked() == 0; });
+        }
+    }
+
+    AssetState state(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id >= firstId) return assets[id - firstId].record.state;
+        for (const AssetRecord& r : history) {
+            if (r.id == id) return r.state;
+        }
+        return AssetReady;
+    }
+
+    bool ready(int id) {
+        return state(id) == AssetReady;
+    }
+
+    // Assets not ready or failed yet
+    int pending() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pendingLocked();
+    }
+
+    // Fraction of submitted assets that are ready or failed
+    float progress() {
+        std::lock_guard<std::mutex> lock(mutex);
+        int submitted = firstId + (int)assets.size();
+        if (submitted == 0) return 1.0f;
+        return 1.0f - (float)pendingLocked() / (float)submitted;
+    }
+
+    std::vector<AssetRecord> records() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<AssetRecord> out = history;
+        for (const Asset& asset : assets) {
+            if (asset.keepRecord) out.push_back(asset.record);
+        }
+        return out;
+    }
+
+    // One line per asset: how long it queued, loaded and waited for pump, and when it was ready
+    void report(std::ostream& out) {
+        static const char* stateNames[] = { "queued", "loading", "loaded", "ready", "failed" };
+        char line[512];
+        snprintf(line, sizeof(line), "%-48s %8s %9s %9s %9s %9s\n", "asset", "state", "queue ms", "load ms", "finish ms", "ready at");
+        out << line;
+        for (const AssetRecord& r : records()) {
+            double queue = r.state >= AssetLoading ? r.loadStartMs - r.queuedMs : 0.0;
+            double load = r.state >= AssetLoaded ? r.loadedMs - r.loadStartMs : 0.0;
+            double finish = r.state == AssetReady ? r.readyMs - r.loadedMs : 0.0;
+            snprintf(line, sizeof(line), "%-48s %8s %9.2f %9.2f %9.2f %9.2f\n", r.name.c_str(), stateNames[r.state], queue, load, finish,
+                r.state == AssetReady ? r.readyMs : 0.0);
+            out << line;
+        }
+    }
+
+    double now() {
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+private:
+    struct Asset
+    {
+        AssetRecord record;
+        std::function<bool()> load;
+        std::function<void()> finish;
+        bool keepRecord = true;
+    };
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable loadedSignal;
+    std::deque<Asset> assets; // Never moves once added, so a load can run on it without the lock. Finished ones are taken off the front.
+    int firstId = 0; // Of assets.front()
+    std::vector<AssetRecord> history; // Finished assets taken off the front that keep their record
+    std::deque<int> queue;
+    bool quit = false;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int pendingLocked() {
+        int count = 0;
+        for (const Asset& asset : assets) {
+            if (asset.record.state != AssetReady && asset.record.state != AssetFailed) count++;
+        }
+        return count;
+    }
+
+    bool anyLoadedLocked() {
+        for (const Asset& asset : assets) {
+            if (asset.record.state == AssetLoaded) return true;
+        }
+        return false;
+    }
+
+    void runLoad(int id) {
+        Asset* asset;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            asset = &assets[id - firstId];
+            asset->record.state = AssetLoading;
+            asset->record.loadStartMs = now();
+        }
+        bool ok = asset->load ? asset->load() : true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            asset->load = nullptr;
+            asset->record.state = ok ? AssetLoaded : AssetFailed;
+            asset->record.loadedMs = now();
+            if (!ok) asset->record.readyMs = asset->record.loadedMs;
+        }
+        loadedSignal.notify_all();
+    }
+
+    void workerLoop() {
+        while (true) {
+            int id;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return quit || !queue.empty(); });
+                if (quit) return;
+                id = queue.front();
+                queue.pop_front();
+            }
+            runLoad(id);
+        }
+    }
+};
@@ -1,101 +1,134 @@
 #pragma once
-#include "Sphere.h" 
-#include "Maths.h"
+#ifndef GAME_HEADLESS
+#include "Sphere.h"
+#endif
+#include "maths.h"
 #include "Collision.h"
 #include "EnemyManager.h"
+#include "TransformBatch.h"
+#include "Archetype.h"
 #include <vector>
 
-struct Bullet {
+struct BulletComponent {
     Vec3 position;
     Vec3 direction;
     float speed = 50.0f;
     float lifeTime = 3.0f;
-    bool isActive = true;
-    AABB collider;
 };
 
 class BulletManager {
 private:
+#ifndef GAME_HEADLESS
     Sphere* bulletMesh = nullptr;
-    std::vector<Bullet> bullets;
+#endif
+    // Only live bullets are stored, spent ones are swapped out of the arrays straight away
+    Archetype<BulletComponent, AABB> bullets;
+    std::vector<Vec3> drawPositions;
+    std::vector<Vec3> drawScales;
+    std::vector<Matrix> drawWorlds;
 
 public:
+#ifndef GAME_HEADLESS
     void init(Sphere* mesh) {
         bulletMesh = mesh;
     }
+#endif
 
     void spawnBullet(Vec3 startPos, Vec3 dir) {
-        Bullet b;
+        BulletComponent b;
         b.position = startPos;
         b.direction = dir;
-        b.isActive = true;
         b.speed = 100.0f;
 
-        b.collider.min = b.position - Vec3(0.05f, 0.05f, 0.05f);
-        b.collider.max = b.position + Vec3(0.05f, 0.05f, 0.05f);
+        AABB collider;
+        collider.min = b.position - Vec3(0.05f, 0.05f, 0.05f);
+        collider.max = b.position + Vec3(0.05f, 0.05f, 0.05f);
 
-        bullets.push_back(b);
+        bullets.add(b, collider);
     }
 
     void update(float dt, EnemyManager& enemyMgr, const std::vector<AABB>& walls) {
-        for (int i = 0; i < bullets.size(); i++) {
-            if (!bullets[i].isActive) continue;
-
-            bullets[i].lifeTime -= dt;
-            if (bullets[i].lifeTime <= 0.0f) {
-                bullets[i].isActive = false;
+        std::vector<BulletComponent>& motion = bullets.get<BulletComponent>();
+        std::vector<AABB>& colliders = bullets.get<AABB>();
+        std::vector<AABB>& enemyColliders = enemyMgr.getColliders();
+        std::vector<HealthComponent>& enemyHealth = enemyMgr.getHealth();
+
+        int i = 0;
+        while (i < bullets.size()) {
+            motion[i].lifeTime -= dt;
+            if (motion[i].lifeTime <= 0.0f) {
+                bullets.remove(i);
                 continue;
             }
 
-            bullets[i].position += bullets[i].direction * bullets[i].speed * dt;
+            motion[i].position += motion[i].direction * motion[i].speed * dt;
 
             Vec3 size(0.1f, 0.1f, 0.1f);
-            bullets[i].collider.min = bullets[i].position - (size * 0.5f);
-            bullets[i].collider.max = bullets[i].position + (size * 0.5f);
+            colliders[i].min = motion[i].position - (size * 0.5f);
+            colliders[i].max = motion[i].position + (size * 0.5f);
 
-            bool hitWall = false;
+            bool hit = false;
             for (const auto& wall : walls) {
-                if (AABB::check(bullets[i].collider, wall)) {
-                    hitWall = true;
+                if (AABB::check(colliders[i], wall)) {
+                    hit = true;
                     break;
                 }
             }
-            if (hitWall) {
-                bullets[i].isActive = false;
-                continue;
-            }
 
-            std::vector<Enemy>& enemies = enemyMgr.getEnemies();
-            for (auto& enemy : enemies) {
-                if (enemy.isDead) continue;
+            if (!hit) {
+                for (int e = 0; e < (int)enemyColliders.size(); e++) {
+                    if (enemyHealth[e].isDead) continue;
 
-                if (AABB::check(bullets[i].collider, enemy.collider)) {
-                    enemy.isDead = true;
-                    bullets[i].isActive = false;
-                    break;
+                    if (AABB::check(colliders[i], enemyColliders[e])) {
+                        enemyHealth[e].isDead = true;
+                        hit = true;
+                        break;
+                    }
                 }
             }
+
+            if (hit) {
+                bullets.remove(i);
+                continue;
+            }
+            i++;
         }
+    }
 
-        std::vector<Bullet> activeBullets;
-        for (const auto& b : bullets) {
-            if (b.isActive) activeBullets.push_back(b);
+    void writeSnapshot(std::vector<Vec3>& positions, std::vector<Vec3>& velocities) {
+        std::vector<BulletComponent>& motion = bullets.get<BulletComponent>();
+        positions.resize(motion.size());
+        velocities.resize(motion.size());
+        for (int i = 0; i < (int)motion.size(); i++) {
+            positions[i] = motion[i].position;
+            velocities[i] = motion[i].direction * motion[i].speed;
         }
-        bullets = activeBullets;
     }
 
+#ifndef GAME_HEADLESS
     void draw(Core* core, Matrix vp) {
+        std::vector<BulletComponent>& motion = bullets.get<BulletComponent>();
+        drawPositions.resize(motion.size());
+        for (int i = 0; i < motion.size(); i++) {
+            drawPositions[i] = motion[i].position;
+        }
+        draw(core, vp, drawPositions);
+    }
+
+    void draw(Core* core, Matrix vp, const std::vector<Vec3>& positions) {
         if (!bulletMesh) return;
 
-        for (const auto& b : bullets) {
-            if (!b.isActive) continue;
+        if (&positions != &drawPositions) {
+            drawPositions = positions;
+        }
 
-            Matrix S, T;
-            S.scaling(Vec3(0.02f, 0.02f, 0.02f));
-            T.translation(b.position);
-            Matrix world = S * T;
+        drawScales.resize(drawPositions.size(), Vec3(0.02f, 0.02f, 0.02f));
+        drawWorlds.resize(drawPositions.size());
+        TransformBatch::compose(drawPositions.data(), nullptr, nullptr, drawScales.data(), drawWorlds.data(), (int)drawPositions.size());
 
-            bulletMesh->draw(core, world, vp);
+        for (int i = 0; i < drawWorlds.size(); i++) {
+            bulletMesh->draw(core, drawWorlds[i], vp);
         }
     }
+#endif
 };
\ No newline at end of file
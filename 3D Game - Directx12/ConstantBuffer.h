@@ -1,5 +1,6 @@
 #pragma once
 #include "Core.h"
+#include "ConstantRing.h"
 #include <d3d12.h>
 #include <map>
 #include <string>
@@ -33,21 +34,87 @@ public:
     unsigned char* buffer = nullptr;
 
     unsigned int cbSizeInBytes = 0;
-    unsigned int maxInstances = 0;
-    unsigned int offsetIndex = 0;
+    ConstantRing ring;
 
     ConstantBufferDescription layout;
 
+    // Slots a frame starts with. Each frame in flight has its own range of this many, which doubles for every frame
+    // when one frame draws more than that, e.g. a streamed level with thousands of props of one mesh.
+    static const unsigned int instancesPerFrame = 512;
+
     ConstantBuffer() {}
 
-    void init(Core* core, const ConstantBufferDescription& desc, unsigned int _maxInstances = 1024) {
+    // _slotsPerFrame of 0 starts from instancesPerFrame
+    void init(Core* _core, const ConstantBufferDescription& desc, unsigned int _slotsPerFrame = 0) {
+        core = _core;
         layout = desc;
 
         cbSizeInBytes = (layout.totalSize + 255) & ~255;
-        maxInstances = _maxInstances;
-        offsetIndex = 0;
+        ring.init(_slotsPerFrame ? _slotsPerFrame : instancesPerFrame, core->framesInFlight);
+        frameBegun = core->framesBegun;
+        ring.beginFrame(core->frameIndex());
+        createResource();
+    }
+
+    void update(const string& varName, const void* data, size_t dataSize = 0)
+    {
+        syncFrame();
+        if (!buffer) return;
+
+        auto it = layout.constantBufferData.find(varName);
+        if (it == layout.constantBufferData.end())
+        {
+            return;
+        }
+
+        const ConstantBufferVariable& var = it->second;
+        const size_t bytes = dataSize == 0 ? var.size : dataSize;
+
+        unsigned char* dst = buffer + ((size_t)ring.current() * cbSizeInBytes) + var.offset;
+        memcpy(dst, data, bytes);
+    }
+
+    void nextInstance()
+    {
+        next();
+    }
+
+    D3D12_GPU_VIRTUAL_ADDRESS getGPUAddress()
+    {
+        syncFrame();
+        if (!resource) return 0;
+        return resource->GetGPUVirtualAddress() + static_cast<D3D12_GPU_VIRTUAL_ADDRESS>(ring.current()) * cbSizeInBytes;
+    }
+
+    void next()
+    {
+        syncFrame();
+        if (ring.next()) return;
+        // Every slot of this frame's range may still be read by draws already recorded, so carry on in a new buffer
+        // twice the size and keep the old one alive until this frame's fence has passed
+        if (resource) core->releaseAfterFrame(resource);
+        resource = nullptr;
+        buffer = nullptr;
+        ring.grow();
+        createResource();
+    }
 
-        unsigned int totalBytes = cbSizeInBytes * maxInstances;
+private:
+    Core* core = nullptr;
+    unsigned long long frameBegun = 0; // Core::framesBegun when the ring last began a frame
+
+    // The ring starts the frame's range over on the first use after Core::beginFrame, whose fence wait means the GPU
+    // has finished with it
+    void syncFrame()
+    {
+        if (frameBegun == core->framesBegun) return;
+        frameBegun = core->framesBegun;
+        ring.beginFrame(core->frameIndex());
+    }
+
+    void createResource()
+    {
+        unsigned int totalBytes = cbSizeInBytes * ring.totalSlots();
 
         D3D12_HEAP_PROPERTIES heapprops = {};
         heapprops.Type = D3D12_HEAP_TYPE_UPLOAD;
@@ -76,6 +143,7 @@ public:
         if (FAILED(hr))
         {
             OutputDebugStringA("ConstantBuffer::init - CreateCommittedResource FAILED\n");
+            resource = nullptr;
             return;
         }
 
@@ -86,39 +154,4 @@ public:
             buffer = nullptr;
         }
     }
-
-    void update(const string& varName, const void* data, size_t dataSize = 0)
-    {
-        if (!buffer) return;
-
-        auto it = layout.constantBufferData.find(varName);
-        if (it == layout.constantBufferData.end())
-        {
-            return;
-        }
-
-        const ConstantBufferVariable& var = it->second;
-        const size_t bytes = dataSize == 0 ? var.size : dataSize;
-
-        unsigned char* dst = buffer + (offsetIndex * cbSizeInBytes) + var.offset;
-        memcpy(dst, data, bytes);
-    }
-
-    void nextInstance()
-    {
-        offsetIndex = (offsetIndex + 1) % maxInstances;
-    }
-
-    D3D12_GPU_VIRTUAL_ADDRESS getGPUAddress() const
-    {
-        if (!resource) return 0;
-        return resource->GetGPUVirtualAddress() + static_cast<D3D12_GPU_VIRTUAL_ADDRESS>(offsetIndex) * cbSizeInBytes;
-    }
-
-    void next()
-    {
-        offsetIndex++;
-        if (offsetIndex >= maxInstances)
-            offsetIndex = 0;
-    }
 };
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+
+// Slot bookkeeping for a ConstantBuffer, kept apart from D3D so it can run headless.
+// The buffer is laid out as [frame 0 slots | frame 1 slots | ...]. A frame only writes its own range, which starts
+// over when that frame slot begins again, by which point the slot's fence has passed and the GPU is done reading it.
+class ConstantRing {
+public:
+    void init(int _slotsPerFrame, int _framesInFlight)
+    {
+        slotsPerFrame = std::max(_slotsPerFrame, 1);
+        framesInFlight = std::max(_framesInFlight, 1);
+        currentFrame = 0;
+        used = 0;
+        frameUsed = 0;
+        peakUsed = 0;
+    }
+
+    int totalSlots() const
+    {
+        return slotsPerFrame * framesInFlight;
+    }
+
+    // Call once the fence for this frame slot has been waited on
+    void beginFrame(int frame)
+    {
+        currentFrame = frame % framesInFlight;
+        used = 0;
+        frameUsed = 0;
+    }
+
+    // The slot being written
+    int current() const
+    {
+        return currentFrame * slotsPerFrame + used;
+    }
+
+    // Moves past the current slot. Returns false when the frame's range is used up, in which case the caller has to
+    // grow before writing again, since every other slot in the range may still be read this frame.
+    bool next()
+    {
+        used++;
+        frameUsed++;
+        peakUsed = std::max(peakUsed, frameUsed);
+        return used < slotsPerFrame;
+    }
+
+    // Doubles the range of every frame, for a buffer that has been recreated with totalSlots() after this.
+    // The current frame carries on from the start of its new range.
+    void grow()
+    {
+        slotsPerFrame *= 2;
+        used = 0;
+    }
+
+    int perFrame() const { return slotsPerFrame; }
+    int peak() const { return peakUsed; }
+
+private:
+    int slotsPerFrame = 1;
+    int framesInFlight = 1;
+    int currentFrame = 0;
+    int used = 0; // In the current range
+    int frameUsed = 0; // By the current frame, across growth
+    int peakUsed = 0;
+};
@@ -0,0 +1,277 @@
+// Cooks textures into the block compressed cache Texture::load reads (<source>.texc), so the game starts
+// without decoding any PNGs. Prints the chosen format, the size saving and the PSNR of the top level. Each block
+// format is first round tripped on synthetic images and nothing is cooked when one falls below its PSNR floor.
+// With -bench it instead times decode + mips + encode of all the files (no cache) on 1 to -threads threads, and
+// checks and times RGB to RGBA expansion and row pitched staging copies, and checks that damaged cache files are
+// rejected, none of which needs a GPU.
+//
+// Built on its own, outside the Visual Studio project, e.g.
+//   g++ -std=c++20 -O2 -pthread Cook.cpp -o cook
+//   ./cook -threads 8 Models/Textures/*.png
+//   ./cook -bench -threads 8 Models/Textures/*.png
+#define GAME_HEADLESS
+#include "Image.h"
+#include "TextureCook.h"
+#include "JobSystem.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const char* formatName(CookedFormat format) {
+    switch (format) {
+    case CookedBC1: return "BC1";
+    case CookedBC3: return "BC3";
+    case CookedBC5: return "BC5";
+    default: return "RGBA8";
+    }
+}
+
+static double timePrepare(const vector<string>& files, int threads) {
+    JobSystem jobs;
+    jobs.init(threads - 1);
+    vector<CookedTexture> cooked(files.size());
+    auto start = chrono::steady_clock::now();
+    jobs.parallelFor((int)files.size(), [&](int i, int) {
+        TextureCook::prepare(files[i], cooked[i], false);
+    });
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// SIMD expansion against the scalar loop, over pixel counts that leave every possible tail
+static bool checkExpand() {
+    vector<unsigned char> rgb(3 * 1027);
+    for (size_t i = 0; i < rgb.size(); i++) rgb[i] = (unsigned char)(i * 131 + 7);
+    for (int count = 0; count <= 1027; count++) {
+        vector<unsigned char> fast(count * 4 + 1, 0xAB), slow(count * 4 + 1, 0xAB);
+        ImageProcessing::expandRGB(rgb.data(), fast.data(), count);
+        ImageProcessing::expandRGBScalar(rgb.data(), slow.data(), count);
+        if (fast != slow) {
+            printf("expandRGB differs from scalar at %d pixels\n", count);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rows land at the D3D12 pitch alignment, bytes between rows are left alone, for widths that do and do not fill it
+static bool checkPitch() {
+    const size_t pitchAlignment = 256; // D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+    int widths[] = { 1, 3, 63, 64, 65, 100, 255, 256, 300 };
+    for (int width : widths) {
+        int height = 5;
+        size_t rowBytes = (size_t)width * 4;
+        size_t pitch = (rowBytes + pitchAlignment - 1) / pitchAlignment * pitchAlignment;
+        vector<unsigned char> packed(rowBytes * height);
+        for (size_t i = 0; i < packed.size(); i++) packed[i] = (unsigned char)(i * 7 + 1);
+        vector<unsigned char> staging(pitch * height, 0xCD);
+        ImageProcessing::copyRows(packed.data(), rowBytes, staging.data(), pitch, rowBytes, height);
+        for (int y = 0; y < height; y++) {
+            bool rowOk = memcmp(&staging[y * pitch], &packed[y * rowBytes], rowBytes) == 0;
+            for (size_t x = rowBytes; x < pitch && rowOk; x++) rowOk = staging[y * pitch + x] == 0xCD;
+            if (!rowOk) {
+                printf("copyRows wrong for width %d, row %d, pitch %zu\n", width, y, pitch);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Encodes then decodes synthetic images in each block format and fails below a PSNR floor, so a broken encoder
+// cannot pass unnoticed: smooth colour and alpha gradients for BC1 and BC3, a bumpy normal map for BC5
+static bool checkCompression() {
+    struct Case { CookedFormat format; double floor; };
+    const Case cases[] = { { CookedBC1, 35.0 }, { CookedBC3, 35.0 }, { CookedBC5, 40.0 } };
+    vector<ImageLevel> levels(1);
+    ImageLevel& image = levels[0];
+    image.width = 64;
+    image.height = 64;
+    image.pixels.resize((size_t)image.width * image.height * 4);
+    bool ok = true;
+    for (const Case& c : cases) {
+        for (int y = 0; y < image.height; y++) {
+            for (int x = 0; x < image.width; x++) {
+                unsigned char* p = &image.pixels[((size_t)y * image.width + x) * 4];
+                if (c.format == CookedBC5) {
+                    // Tangent space x and y of a normal tilting with a sine bump
+                    p[0] = (unsigned char)(128.0f + 100.0f * sinf(x * 0.2f));
+                    p[1] = (unsigned char)(128.0f + 100.0f * cosf(y * 0.15f));
+                    p[2] = 255;
+                    p[3] = 255;
+                }
+                else {
+                    p[0] = (unsigned char)(x * 4);
+                    p[1] = (unsigned char)(y * 4);
+                    p[2] = (unsigned char)((x + y) * 2);
+                    p[3] = c.format == CookedBC3 ? (unsigned char)(255 - y * 4) : 255;
+                }
+            }
+        }
+        CookedTexture cooked;
+        TextureCook::cook(levels, c.format, cooked);
+        double psnr = TextureCook::psnr(image, cooked.levels[0], c.format);
+        printf("%s round trip: %.2f dB, floor %.0f dB\n", formatName(c.format), psnr, c.floor);
+        ok = ok && psnr >= c.floor;
+    }
+    return ok;
+}
+
+// The cache is only used when it describes a texture cook could have made, anything else is cooked again
+static bool checkCacheValidation() {
+    const string path = "cook_check.texc";
+    const unsigned long long hash = 42;
+    CookedTexture good;
+    good.format = CookedBC1;
+    good.width = 8;
+    good.height = 4;
+    for (int i = 0; i < ImageProcessing::mipCount(8, 4); i++) {
+        good.levels.push_back(vector<unsigned char>(TextureCook::levelBytes(CookedBC1, max(8 >> i, 1), max(4 >> i, 1)), (unsigned char)i));
+    }
+    CookedTexture loaded;
+    bool ok = TextureCook::save(path, hash, good) && TextureCook::load(path, hash, loaded) && loaded.levels == good.levels;
+    if (!ok) printf("cache: valid texture not loaded back\n");
+
+    auto rejected = [&](const char* what, const CookedTexture& bad, int headerLevels) {
+        CookedTextureHeader header;
+        header.sourceHash = hash;
+        header.format = bad.format;
+        header.width = bad.width;
+        header.height = bad.height;
+        header.levels = headerLevels;
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(&header, sizeof(header), 1, file);
+        for (const vector<unsigned char>& level : bad.levels) {
+            unsigned int size = (unsigned int)level.size();
+            fwrite(&size, sizeof(size), 1, file);
+            fwrite(level.data(), 1, size, file);
+        }
+        fclose(file);
+        CookedTexture out;
+        bool accepted = TextureCook::load(path, hash, out);
+        if (accepted) printf("cache: %s accepted\n", what);
+        ok = ok && !accepted;
+    };
+    rejected("negative level count", good, -1);
+    rejected("more levels than the size allows", good, 5);
+    CookedTexture bad = good;
+    bad.levels[1].pop_back();
+    rejected("short level", bad, (int)bad.levels.size());
+    bad = good;
+    bad.width = 6;
+    rejected("BC width not a multiple of 4", bad, (int)bad.levels.size());
+    bad = good;
+    bad.format = (CookedFormat)7;
+    rejected("unknown format", bad, (int)bad.levels.size());
+    bad = good;
+    bad.levels.back().resize(0);
+    rejected("empty last level", bad, (int)bad.levels.size());
+    remove(path.c_str());
+    return ok;
+}
+
+static void benchExpand() {
+    const int width = 4096, height = 4096, reps = 10;
+    vector<unsigned char> rgb((size_t)width * height * 3);
+    for (size_t i = 0; i < rgb.size(); i++) rgb[i] = (unsigned char)i;
+    size_t rowBytes = (size_t)width * 4;
+    size_t pitch = (rowBytes + 255) / 256 * 256 + 256; // Padded so it cannot be done as one copy
+    vector<unsigned char> staging(pitch * height);
+    double scalarMs = 1e30, simdMs = 1e30;
+    for (int r = 0; r < reps; r++) {
+        auto start = chrono::steady_clock::now();
+        for (int y = 0; y < height; y++) ImageProcessing::expandRGBScalar(&rgb[(size_t)y * width * 3], &staging[y * pitch], width);
+        chrono::duration<double, milli> scalar = chrono::steady_clock::now() - start;
+        start = chrono::steady_clock::now();
+        for (int y = 0; y < height; y++) ImageProcessing::expandRGB(&rgb[(size_t)y * width * 3], &staging[y * pitch], width);
+        chrono::duration<double, milli> simd = chrono::steady_clock::now() - start;
+        scalarMs = min(scalarMs, scalar.count());
+        simdMs = min(simdMs, simd.count());
+    }
+    double megapixels = (double)width * height / 1e6;
+    const char* paths[] = { "scalar", "SSSE3", "AVX2" };
+    printf("RGB to RGBA %dx%d into pitched staging: scalar %.2f ms (%.0f MP/s), %s %.2f ms (%.0f MP/s), %.2fx\n", width, height,
+        scalarMs, megapixels * 1000.0 / scalarMs, paths[ImageProcessing::expandRGBLevel()], simdMs, megapixels * 1000.0 / simdMs, scalarMs / simdMs);
+}
+
+int main(int argc, char** argv)
+{
+    vector<string> files;
+    int threads = (int)thread::hardware_concurrency();
+    bool bench = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-threads" && i + 1 < argc) threads = max(1, atoi(argv[++i]));
+        else if (arg == "-bench") bench = true;
+        else files.push_back(arg);
+    }
+
+    // The encoder is checked before anything is cooked with it
+    bool encoded = checkCompression();
+    printf("compression checks: %s\n", encoded ? "ok" : "FAILED");
+    if (!encoded) return 1;
+
+    if (bench) {
+        bool checked = checkExpand() && checkPitch() && checkCacheValidation();
+        printf("expansion, pitch and cache checks: %s\n", checked ? "ok" : "FAILED");
+        if (!checked) return 1;
+        benchExpand();
+        double single = 0.0;
+        for (int t = 1; t <= threads; t *= 2) {
+            double ms = timePrepare(files, t);
+            if (t == 1) single = ms;
+            printf("%2d threads: %8.1f ms, %.2fx\n", t, ms, single / ms);
+        }
+        return 0;
+    }
+
+    vector<string> report(files.size());
+    vector<char> ok(files.size(), 0);
+    JobSystem jobs;
+    jobs.init(threads - 1);
+    jobs.parallelFor((int)files.size(), [&](int i, int) {
+        const string& filename = files[i];
+        char line[512];
+        vector<unsigned char> source;
+        vector<ImageLevel> levels(1);
+        if (!TextureCook::readFile(filename, source) || !TextureCook::decode(source, levels[0])) {
+            report[i] = filename + ": could not read or decode";
+            return;
+        }
+
+        ImageProcessing::generateMips(levels);
+        CookedTexture cooked;
+        CookedFormat format = TextureCook::chooseFormat(filename, levels[0]);
+        size_t rawBytes = 0, cookedBytes = 0;
+        for (const ImageLevel& level : levels) {
+            rawBytes += level.pixels.size();
+        }
+        double psnr = 99.0;
+        TextureCook::cook(levels, format, cooked);
+        if (format != CookedRGBA8) psnr = TextureCook::psnr(levels[0], cooked.levels[0], format);
+        if (!TextureCook::save(TextureCook::cachePath(filename), TextureCook::hashBytes(source), cooked)) {
+            report[i] = filename + ": could not write " + TextureCook::cachePath(filename);
+            return;
+        }
+
+        for (const vector<unsigned char>& level : cooked.levels) {
+            cookedBytes += level.size();
+        }
+        snprintf(line, sizeof(line), "%s: %dx%d %d mips %s, %zu -> %zu bytes (%.1fx), %.2f dB", filename.c_str(), cooked.width, cooked.height,
+            (int)levels.size(), formatName(format), rawBytes, cookedBytes, (double)rawBytes / cookedBytes, psnr);
+        report[i] = line;
+        ok[i] = 1;
+    });
+
+    int failed = 0;
+    for (int i = 0; i < (int)files.size(); i++) {
+        printf("%s\n", report[i].c_str());
+        if (!ok[i]) failed++;
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,402 @@
+#pragma once
+#include "Level.h"
+#include "TransformBatch.h"
+#include "MappedFile.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+enum LevelEntryType
+{
+    LevelTree,
+    LevelPlane,
+    LevelEnemy,
+    LevelWall,
+    LevelOther
+};
+
+// Byte offsets are from the start of the file and multiples of 64
+struct CookedLevelHeader
+{
+    char magic[4] = { 'L', 'V', 'L', 'C' };
+    unsigned int version = 2;
+    unsigned long long sourceHash = 0;
+    unsigned long long sourceBytes = 0;
+    unsigned int entryCount = 0;
+    unsigned int globalEntryCount = 0;
+    unsigned int colliderCount = 0;
+    unsigned int meshCount = 0;
+    unsigned int stringBytes = 0;
+    float cellSize = 0.0f;
+    int cellsX = 0;
+    int cellsZ = 0;
+    float originX = 0.0f; // Corner of cell 0
+    float originZ = 0.0f;
+    Vec3 boundsMin; // Of the ground, see CookedLevel::bounds
+    Vec3 boundsMax;
+    unsigned long long cellsOffset = 0;
+    unsigned long long worldsOffset = 0;
+    unsigned long long entriesOffset = 0;
+    unsigned long long collidersOffset = 0;
+    unsigned long long meshesOffset = 0;
+    unsigned long long stringsOffset = 0;
+};
+
+// One line of the source, at the same index as its world matrix
+struct CookedLevelEntry
+{
+    unsigned int type = LevelOther;
+    int mesh = -1; // Into the mesh table, -1 for PROCEDURAL
+    int collider = -1;
+    Vec3 position;
+    Vec3 rotation;
+    Vec3 scale;
+};
+
+// A model path in the string table
+struct CookedLevelMesh
+{
+    unsigned int offset;
+    unsigned int length;
+};
+
+// A square of the level grid: its entries and their colliders are contiguous
+struct CookedLevelCell
+{
+    unsigned int firstEntry;
+    unsigned int entryCount;
+    unsigned int firstCollider;
+    unsigned int colliderCount;
+};
+
+static_assert(sizeof(Vec3) == 12 && sizeof(Matrix) == 64 && sizeof(AABB) == 24, "the cooked level layout depends on these sizes");
+
+// LevelData.txt cooked to one flat file that is mapped and used in place, nothing is parsed or copied at load:
+// world matrices ready for drawing, colliders, and per entry its type, transform and index into a table of the
+// unique model paths. The cooked copy sits next to the source as <source>.lvlc and, as with textures (see
+// TextureCook), is only used while it was cooked from the same source bytes.
+//
+// Entries are ordered for streaming (see LevelStreamer): first the global ones that belong to no cell (the ground
+// plane and unknown types), then those of each cell of a cellSize grid in turn, each group in source order.
+class CookedLevel {
+public:
+    static constexpr float defaultCellSize = 64.0f;
+
+    const Matrix* worlds = nullptr;
+    const CookedLevelEntry* entries = nullptr;
+    const AABB* colliders = nullptr; // Boundary walls are not included, see Level::addBoundary
+    const CookedLevelCell* cells = nullptr; // cellsX * cellsZ, row by row along x
+    int entryCount = 0;
+    int globalEntryCount = 0;
+    int colliderCount = 0;
+    int meshCount = 0;
+    float cellSize = 0.0f;
+    int cellsX = 0;
+    int cellsZ = 0;
+    float originX = 0.0f;
+    float originZ = 0.0f;
+    Vec3 boundsMin;
+    Vec3 boundsMax;
+
+    // Maps source's cooked copy, cooking it first when it is missing, out of date or on another grid. If it cannot
+    // be written the cooked bytes are used from memory instead.
+    bool load(const std::string& source, float gridCellSize = defaultCellSize) {
+        unsigned long long sourceHash;
+        unsigned long long sourceBytes;
+        if (!hashFile(source, sourceHash, sourceBytes)) return false;
+        std::string cooked = cachePath(source);
+        if (open(cooked) && header->sourceHash == sourceHash && header->sourceBytes == sourceBytes && header->cellSize == gridCellSize) return true;
+
+        std::vector<LevelEntry> parsed;
+        if (!Level::load(source, parsed)) return false;
+        std::vector<unsigned char> bytes;
+        cook(parsed, sourceHash, sourceBytes, gridCellSize, bytes);
+        file.close();
+        if (save(cooked, bytes) && open(cooked)) return true;
+        memory = std::move(bytes);
+        return view(memory.data(), memory.size());
+    }
+
+    // Maps a cooked file as it is, without looking at its source
+    bool open(const std::string& filename) {
+        return file.open(filename) && view(file.data(), file.size());
+    }
+
+    std::string_view meshPath(int mesh) const {
+        return std::string_view(strings + meshes[mesh].offset, meshes[mesh].length);
+    }
+
+    int cellCount() const {
+        return cellsX * cellsZ;
+    }
+
+    // Cell holding (x, z), -1 off the grid
+    int cellAt(float x, float z) const {
+        int cx = (int)std::floor((x - originX) / cellSize);
+        int cz = (int)std::floor((z - originZ) / cellSize);
+        if (cx < 0 || cz < 0 || cx >= cellsX || cz >= cellsZ) return -1;
+        return cz * cellsX + cx;
+    }
+
+    // Area the player is kept in: the extent of the ground planes, or of the entries when there are none
+    static void bounds(const std::vector<LevelEntry>& parsed, Vec3& outMin, Vec3& outMax) {
+        bool planes = false;
+        for (const LevelEntry& e : parsed) {
+            planes = planes || typeOf(e.type) == LevelPlane;
+        }
+        outMin = Vec3(1e30f, 0.0f, 1e30f);
+        outMax = Vec3(-1e30f, 0.0f, -1e30f);
+        for (const LevelEntry& e : parsed) {
+            if (planes && typeOf(e.type) != LevelPlane) continue;
+            // The plane mesh spans -1 to 1 before scaling, other entries get a margin to walk around them
+            Vec3 half = planes ? Vec3(std::abs(e.scale.x), 0.0f, std::abs(e.scale.z)) : Vec3(10.0f, 0.0f, 10.0f);
+            outMin = Vec3(std::min(outMin.x, e.position.x - half.x), 0.0f, std::min(outMin.z, e.position.z - half.z));
+            outMax = Vec3(std::max(outMax.x, e.position.x + half.x), 0.0f, std::max(outMax.z, e.position.z + half.z));
+        }
+        if (outMin.x > outMax.x) {
+            outMin = Vec3(0.0f, 0.0f, 0.0f);
+            outMax = Vec3(0.0f, 0.0f, 0.0f);
+        }
+    }
+
+    static std::string cachePath(const std::string& source) {
+        return source + ".lvlc";
+    }
+
+    static LevelEntryType typeOf(const std::string& type) {
+        if (type == "TREE") return LevelTree;
+        if (type == "PLANE") return LevelPlane;
+        if (type == "ENEMY") return LevelEnemy;
+        if (type == "WALL") return LevelWall;
+        return LevelOther;
+    }
+
+    // Lays parsed out in the cooked format: entries grouped by cell, world matrices composed four at a time,
+    // colliders from the same functions the text path uses, model paths deduplicated
+    static void cook(const std::vector<LevelEntry>& parsed, unsigned long long sourceHash, unsigned long long sourceBytes, float gridCellSize,
+        std::vector<unsigned char>& out) {
+        int count = (int)parsed.size();
+
+        // The grid covers every entry that goes in a cell
+        float minX = 0.0f, minZ = 0.0f, maxX = 0.0f, maxZ = 0.0f;
+        bool any = false;
+        for (const LevelEntry& e : parsed) {
+            if (isGlobal(typeOf(e.type))) continue;
+            minX = any ? std::min(minX, e.position.x) : e.position.x;
+            minZ = any ? std::min(minZ, e.position.z) : e.position.z;
+            maxX = any ? std::max(maxX, e.position.x) : e.position.x;
+            maxZ = any ? std::max(maxZ, e.position.z) : e.position.z;
+            any = true;
+        }
+        float originX = std::floor(minX / gridCellSize) * gridCellSize;
+        float originZ = std::floor(minZ / gridCellSize) * gridCellSize;
+        int cellsX = any ? (int)std::floor((maxX - originX) / gridCellSize) + 1 : 0;
+        int cellsZ = any ? (int)std::floor((maxZ - originZ) / gridCellSize) + 1 : 0;
+
+        // Globals get cell -1 so a stable sort puts them first
+        std::vector<int> cellOf(count);
+        std::vector<int> order(count);
+        for (int i = 0; i < count; i++) {
+            const LevelEntry& e = parsed[i];
+            order[i] = i;
+            if (isGlobal(typeOf(e.type))) {
+                cellOf[i] = -1;
+                continue;
+            }
+            int cx = std::clamp((int)std::floor((e.position.x - originX) / gridCellSize), 0, cellsX - 1);
+            int cz = std::clamp((int)std::floor((e.position.z - originZ) / gridCellSize), 0, cellsZ - 1);
+            cellOf[i] = cz * cellsX + cx;
+        }
+        std::stable_sort(order.begin(), order.end(), [&cellOf](int a, int b) { return cellOf[a] < cellOf[b]; });
+
+        std::vector<Vec3> positions(count), scales(count);
+        std::vector<float> rotationsX(count), rotationsY(count);
+        std::vector<CookedLevelEntry> cookedEntries(count);
+        std::vector<AABB> cookedColliders;
+        std::vector<CookedLevelMesh> cookedMeshes;
+        std::vector<CookedLevelCell> cookedCells((size_t)cellsX * cellsZ, CookedLevelCell{ 0, 0, 0, 0 });
+        std::string cookedStrings;
+        std::unordered_map<std::string, int> meshIndices;
+        int globals = 0;
+        for (int i = 0; i < count; i++) {
+            const LevelEntry& e = parsed[order[i]];
+            int cell = cellOf[order[i]];
+            if (cell == -1) {
+                globals++;
+            }
+            else {
+                CookedLevelCell& c = cookedCells[cell];
+                if (c.entryCount == 0) {
+                    c.firstEntry = (unsigned int)i;
+                    c.firstCollider = (unsigned int)cookedColliders.size();
+                }
+                c.entryCount++;
+            }
+            positions[i] = e.position;
+            scales[i] = e.scale;
+            rotationsX[i] = e.rotation.x;
+            rotationsY[i] = e.rotation.y;
+
+            CookedLevelEntry& c = cookedEntries[i];
+            c.type = typeOf(e.type);
+            c.position = e.position;
+            c.rotation = e.rotation;
+            c.scale = e.scale;
+            if (e.path != "PROCEDURAL") {
+                auto it = meshIndices.find(e.path);
+                if (it == meshIndices.end()) {
+                    it = meshIndices.emplace(e.path, (int)cookedMeshes.size()).first;
+                    cookedMeshes.push_back({ (unsigned int)cookedStrings.size(), (unsigned int)e.path.size() });
+                    cookedStrings += e.path;
+                }
+                c.mesh = it->second;
+            }
+            if (c.type == LevelTree || c.type == LevelWall) {
+                c.collider = (int)cookedColliders.size();
+                cookedColliders.push_back(c.type == LevelTree ? Level::treeCollider(e.position) : Level::wallCollider(e.position, e.rotation, e.scale));
+                if (cell != -1) cookedCells[cell].colliderCount++;
+            }
+        }
+        // Empty cells point at where they would start, so every range is in bounds
+        unsigned int nextEntry = (unsigned int)globals, nextCollider = 0;
+        for (CookedLevelCell& c : cookedCells) {
+            if (c.entryCount == 0) {
+                c.firstEntry = nextEntry;
+                c.firstCollider = nextCollider;
+            }
+            nextEntry = c.firstEntry + c.entryCount;
+            nextCollider = c.firstCollider + c.colliderCount;
+        }
+        std::vector<Matrix> cookedWorlds(count);
+        TransformBatch::compose(positions.data(), rotationsX.data(), rotationsY.data(), scales.data(), cookedWorlds.data(), count);
+
+        CookedLevelHeader h;
+        h.sourceHash = sourceHash;
+        h.sourceBytes = sourceBytes;
+        h.entryCount = (unsigned int)count;
+        h.globalEntryCount = (unsigned int)globals;
+        h.colliderCount = (unsigned int)cookedColliders.size();
+        h.meshCount = (unsigned int)cookedMeshes.size();
+        h.stringBytes = (unsigned int)cookedStrings.size();
+        h.cellSize = gridCellSize;
+        h.cellsX = cellsX;
+        h.cellsZ = cellsZ;
+        h.originX = originX;
+        h.originZ = originZ;
+        bounds(parsed, h.boundsMin, h.boundsMax);
+        h.worldsOffset = align(sizeof(CookedLevelHeader));
+        h.entriesOffset = align(h.worldsOffset + sizeof(Matrix) * count);
+        h.collidersOffset = align(h.entriesOffset + sizeof(CookedLevelEntry) * count);
+        h.meshesOffset = align(h.collidersOffset + sizeof(AABB) * cookedColliders.size());
+        h.cellsOffset = align(h.meshesOffset + sizeof(CookedLevelMesh) * cookedMeshes.size());
+        h.stringsOffset = align(h.cellsOffset + sizeof(CookedLevelCell) * cookedCells.size());
+
+        out.assign(h.stringsOffset + cookedStrings.size(), 0);
+        memcpy(out.data(), &h, sizeof(h));
+        memcpy(out.data() + h.worldsOffset, cookedWorlds.data(), sizeof(Matrix) * count);
+        memcpy(out.data() + h.entriesOffset, cookedEntries.data(), sizeof(CookedLevelEntry) * count);
+        memcpy(out.data() + h.collidersOffset, cookedColliders.data(), sizeof(AABB) * cookedColliders.size());
+        memcpy(out.data() + h.meshesOffset, cookedMeshes.data(), sizeof(CookedLevelMesh) * cookedMeshes.size());
+        memcpy(out.data() + h.cellsOffset, cookedCells.data(), sizeof(CookedLevelCell) * cookedCells.size());
+        memcpy(out.data() + h.stringsOffset, cookedStrings.data(), cookedStrings.size());
+    }
+
+    static bool save(const std::string& filename, const std::vector<unsigned char>& bytes) {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out.is_open()) return false;
+        out.write((const char*)bytes.data(), bytes.size());
+        return out.good();
+    }
+
+    // FNV-1a a word at a time, with the size kept next to it so a change of length is caught either way
+    static bool hashFile(const std::string& filename, unsigned long long& hash, unsigned long long& bytes) {
+        MappedFile source;
+        if (!source.open(filename)) return false;
+        const unsigned char* data = source.data();
+        size_t size = source.size();
+        unsigned long long h = 14695981039346656037ull;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            unsigned long long word;
+            memcpy(&word, data + i, 8);
+            h = (h ^ word) * 1099511628211ull;
+        }
+        for (; i < size; i++) {
+            h = (h ^ data[i]) * 1099511628211ull;
+        }
+        hash = h;
+        bytes = size;
+        return true;
+    }
+
+private:
+    MappedFile file;
+    std::vector<unsigned char> memory;
+    const CookedLevelHeader* header = nullptr;
+    const CookedLevelMesh* meshes = nullptr;
+    const char* strings = nullptr;
+
+    static unsigned long long align(unsigned long long offset) {
+        return (offset + 63) & ~63ull;
+    }
+
+    static bool isGlobal(LevelEntryType type) {
+        return type == LevelPlane || type == LevelOther;
+    }
+
+    // Points the arrays into bytes once every count, offset and index in it has been checked against its size
+    bool view(const unsigned char* bytes, size_t size) {
+        CookedLevelHeader expected;
+        const CookedLevelHeader* h = (const CookedLevelHeader*)bytes;
+        if (size < sizeof(CookedLevelHeader) || memcmp(h->magic, expected.magic, 4) != 0 || h->version != expected.version) return false;
+        auto fits = [size](unsigned long long offset, unsigned long long bytes) { return offset % 64 == 0 && offset <= size && bytes <= size - offset; };
+        if (!fits(h->worldsOffset, sizeof(Matrix) * (unsigned long long)h->entryCount) ||
+            !fits(h->entriesOffset, sizeof(CookedLevelEntry) * (unsigned long long)h->entryCount) ||
+            !fits(h->collidersOffset, sizeof(AABB) * (unsigned long long)h->colliderCount) ||
+            !fits(h->meshesOffset, sizeof(CookedLevelMesh) * (unsigned long long)h->meshCount) ||
+            !fits(h->stringsOffset, h->stringBytes) ||
+            h->cellsX < 0 || h->cellsZ < 0 || h->cellSize <= 0.0f || h->globalEntryCount > h->entryCount ||
+            !fits(h->cellsOffset, sizeof(CookedLevelCell) * (unsigned long long)h->cellsX * (unsigned long long)h->cellsZ))
+            return false;
+
+        const CookedLevelEntry* e = (const CookedLevelEntry*)(bytes + h->entriesOffset);
+        const CookedLevelMesh* m = (const CookedLevelMesh*)(bytes + h->meshesOffset);
+        for (unsigned int i = 0; i < h->meshCount; i++) {
+            if (m[i].offset > h->stringBytes || m[i].length > h->stringBytes - m[i].offset) return false;
+        }
+        for (unsigned int i = 0; i < h->entryCount; i++) {
+            if (e[i].mesh < -1 || e[i].mesh >= (int)h->meshCount || e[i].collider < -1 || e[i].collider >= (int)h->colliderCount) return false;
+        }
+        const CookedLevelCell* c = (const CookedLevelCell*)(bytes + h->cellsOffset);
+        for (unsigned long long i = 0; i < (unsigned long long)h->cellsX * h->cellsZ; i++) {
+            if (c[i].firstEntry < h->globalEntryCount || c[i].firstEntry > h->entryCount || c[i].entryCount > h->entryCount - c[i].firstEntry ||
+                c[i].firstCollider > h->colliderCount || c[i].colliderCount > h->colliderCount - c[i].firstCollider)
+                return false;
+        }
+
+        header = h;
+        worlds = (const Matrix*)(bytes + h->worldsOffset);
+        entries = e;
+        colliders = (const AABB*)(bytes + h->collidersOffset);
+        cells = c;
+        meshes = m;
+        strings = (const char*)(bytes + h->stringsOffset);
+        entryCount = (int)h->entryCount;
+        globalEntryCount = (int)h->globalEntryCount;
+        colliderCount = (int)h->colliderCount;
+        meshCount = (int)h->meshCount;
+        cellSize = h->cellSize;
+        cellsX = h->cellsX;
+        cellsZ = h->cellsZ;
+        originX = h->originX;
+        originZ = h->originZ;
+        boundsMin = h->boundsMin;
+        boundsMax = h->boundsMax;
+        return true;
+    }
+};
@@ -4,6 +4,9 @@
 #include <d3dcompiler.h>
 #include <vector>
 #include "DescriptorHeap.h"
+#include "Profiler.h"
+#include "DrawPacket.h"
+#include "JobSystem.h"
 
 #pragma comment(lib, "d3d12")
 #pragma comment(lib, "dxgi")
@@ -25,8 +28,8 @@ public:
 
 class GPUFence {
 public:
-	ID3D12Fence* fence;
-	HANDLE eventHandle;
+	ID3D12Fence* fence = nullptr;
+	HANDLE eventHandle = NULL;
 	UINT64 value = 0;
 	void create(ID3D12Device5* device) {
 		device->CreateFence(value, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
@@ -42,11 +45,54 @@ public:
 		}
 	}
 	~GPUFence() {
+		if (!fence) return;
 		CloseHandle(eventHandle);
 		fence->Release();
 	}
 };
 
+// How many frames the CPU may run ahead and how they are presented. Defaults match a plain double buffered, vsynced swapchain.
+struct CoreSettings
+{
+	int framesInFlight = 2; // 2 to Core::maxFramesInFlight, independent of the number of swapchain images
+	int backbufferCount = 2;
+	bool waitableSwapchain = false; // Block in beginFrame on the swapchain's latency object instead of only the frame fence
+	int maxFrameLatency = 1; // Frames DXGI may queue up for presentation when waitableSwapchain is set
+	bool vsync = true; // Off presents uncapped, with tearing when the display supports it
+	bool bindless = true; // Ignored on resource binding tier 1 hardware, which cannot bind an unbounded table
+};
+
+// Command lists beyond the main one for a frame in flight: one per chunk of draws recorded on a worker thread
+// and one to carry on recording after them. Reused every time that frame comes round.
+struct FrameCommandLists
+{
+	std::vector<ID3D12CommandAllocator*> allocators;
+	std::vector<ID3D12GraphicsCommandList4*> lists;
+	int used = 0;
+};
+
+// Mapped upload memory for a texture's subresources, from Core::beginTextureUpload. Rows of subresource i start
+// at level(i) + row * rowPitch(i), which is usually wider than the packed row, so write them one row at a time.
+struct TextureStaging
+{
+	ID3D12Resource* dstResource = nullptr;
+	ID3D12Resource* uploadBuffer = nullptr;
+	unsigned char* mapped = nullptr;
+	std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints;
+	std::vector<UINT> numRows;
+	std::vector<UINT64> rowSizes; // Packed bytes per row
+
+	unsigned char* level(int i)
+	{
+		return mapped + footprints[i].Offset;
+	}
+
+	size_t rowPitch(int i)
+	{
+		return footprints[i].Footprint.RowPitch;
+	}
+};
+
 class Core {
 public:
 	IDXGIAdapter1* adapter;
@@ -55,25 +101,55 @@ public:
 	ID3D12CommandQueue* copyQueue;
 	ID3D12CommandQueue* computeQueue;
 	IDXGISwapChain3* swapchain;
-	ID3D12CommandAllocator* graphicsCommandAllocator[2];
-	ID3D12GraphicsCommandList4* graphicsCommandList[2];
+	static const int maxFramesInFlight = 4;
+	CoreSettings settings;
+	int framesInFlight = 2;
+	int currentFrame = 0; // Slot of the frame being recorded, selects the allocator, fence and per frame buffers
+	unsigned long long framesBegun = 0; // Counts beginFrame calls, so per frame state can tell a slot coming round again
+	bool tearingSupported = false;
+	bool bindless = false; // Root parameter 3 sees the whole SRV heap and materials pick a texture with root constant 4
+	HANDLE frameLatencyWaitable = NULL;
+	ID3D12CommandAllocator* graphicsCommandAllocator[maxFramesInFlight];
+	ID3D12GraphicsCommandList4* graphicsCommandList[maxFramesInFlight];
 	ID3D12DescriptorHeap* backbufferHeap;
 	ID3D12Resource** backbuffers;
-	GPUFence graphicsQueueFence[2];
+	GPUFence graphicsQueueFence[maxFramesInFlight];
 	ID3D12DescriptorHeap* dsvHeap;
 	ID3D12Resource* dsv;
 	D3D12_CPU_DESCRIPTOR_HANDLE dsvHandle;
 	D3D12_VIEWPORT viewport;
 	D3D12_RECT scissorRect;
 	ID3D12RootSignature* rootSignature;
+	DrawStream drawStream;
+	D3D12DrawBackend drawBackend;
 	DescriptorHeap srvHeap;
+	D3D12_CPU_DESCRIPTOR_HANDLE renderTargetHandle;
+
+	// Worker threads shared by draw recording and asset loading. Draw packets are translated on them once a flush
+	// has at least recordMinPackets per chunk.
+	JobSystem jobs;
+	int recordMinPackets = 64;
+	FrameCommandLists frameLists[maxFramesInFlight];
+	ID3D12GraphicsCommandList4* openList = nullptr; // Where the next commands go, NULL outside a frame
+	std::vector<ID3D12CommandList*> closedLists; // Closed this frame, executed in order by finishFrame
+	bool batchingUploads = false;
+	std::vector<ID3D12Resource*> pendingUploads; // Staging buffers of the current upload batch
+	std::vector<ID3D12Resource*> frameReleases[maxFramesInFlight]; // Released once their frame slot's fence has passed
 
 	~Core() {
+		jobs.shutdown();
+		for (FrameCommandLists& frame : frameLists) {
+			for (int i = 0; i < frame.lists.size(); i++) {
+				frame.lists[i]->Release();
+				frame.allocators[i]->Release();
+			}
+		}
 		rootSignature->Release();
-		graphicsCommandList[0]->Release();
-		graphicsCommandAllocator[0]->Release();
-		graphicsCommandList[1]->Release();
-		graphicsCommandAllocator[1]->Release();
+		for (int i = 0; i < framesInFlight; i++) {
+			graphicsCommandList[i]->Release();
+			graphicsCommandAllocator[i]->Release();
+		}
+		if (frameLatencyWaitable) CloseHandle(frameLatencyWaitable);
 		swapchain->Release();
 		computeQueue->Release();
 		copyQueue->Release();
@@ -81,8 +157,12 @@ public:
 		device->Release();
 	}
 
-	void initialize(HWND hwnd, int _width, int _height)
+	void initialize(HWND hwnd, int _width, int _height, const CoreSettings& _settings = CoreSettings())
 	{
+		settings = _settings;
+		framesInFlight = std::max(2, std::min(settings.framesInFlight, maxFramesInFlight));
+		settings.backbufferCount = std::max(2, std::min(settings.backbufferCount, DXGI_MAX_SWAP_CHAIN_BUFFERS));
+
 		IDXGIFactory6* factory = NULL;
 		ID3D12Debug1* debug;
 		D3D12GetDebugInterface(IID_PPV_ARGS(&debug));
@@ -114,7 +194,11 @@ public:
 
 		D3D12CreateDevice(adapter, D3D_FEATURE_LEVEL_12_1, IID_PPV_ARGS(&device));
 
-		srvHeap.init(device, 16384);
+		srvHeap.init(device, 16384, 1024, framesInFlight);
+
+		D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+		device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options));
+		bindless = settings.bindless && options.ResourceBindingTier >= D3D12_RESOURCE_BINDING_TIER_2;
 
 		D3D12_COMMAND_QUEUE_DESC graphicsQueueDesc = {};
 		graphicsQueueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
@@ -128,18 +212,20 @@ public:
 		computeQueueDesc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
 		device->CreateCommandQueue(&computeQueueDesc, IID_PPV_ARGS(&computeQueue));
 
-		device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
-			IID_PPV_ARGS(&graphicsCommandAllocator[0]));
-		device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE,
-			IID_PPV_ARGS(&graphicsCommandList[0]));
-
-		device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
-			IID_PPV_ARGS(&graphicsCommandAllocator[1]));
-		device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE,
-			IID_PPV_ARGS(&graphicsCommandList[1]));
+		for (int i = 0; i < framesInFlight; i++)
+		{
+			device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+				IID_PPV_ARGS(&graphicsCommandAllocator[i]));
+			device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE,
+				IID_PPV_ARGS(&graphicsCommandList[i]));
+			graphicsCommandList[i]->Close();
+		}
 
-		graphicsCommandList[0]->Close();
-		graphicsCommandList[1]->Close();
+		BOOL allowTearing = FALSE;
+		if (SUCCEEDED(factory->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING, &allowTearing, sizeof(allowTearing))))
+		{
+			tearingSupported = allowTearing == TRUE;
+		}
 
 		DXGI_SWAP_CHAIN_DESC1 scDesc = {};
 		scDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -147,8 +233,12 @@ public:
 		scDesc.Height = _height;
 		scDesc.SampleDesc.Count = 1;
 		scDesc.SampleDesc.Quality = 0;
-		scDesc.BufferCount = 2;
+		scDesc.BufferCount = settings.backbufferCount;
 		scDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+		if (settings.waitableSwapchain)
+			scDesc.Flags |= DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+		if (tearingSupported)
+			scDesc.Flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
 
 		IDXGISwapChain1* swapChain1;
 		factory->CreateSwapChainForHwnd(graphicsQueue, hwnd, &scDesc, NULL, NULL, &swapChain1);
@@ -156,6 +246,12 @@ public:
 		swapChain1->Release();
 		factory->Release();
 
+		if (settings.waitableSwapchain)
+		{
+			swapchain->SetMaximumFrameLatency(settings.maxFrameLatency);
+			frameLatencyWaitable = swapchain->GetFrameLatencyWaitableObject();
+		}
+
 		D3D12_DESCRIPTOR_HEAP_DESC renderTargetViewHeapDesc = {};
 		renderTargetViewHeapDesc.NumDescriptors = scDesc.BufferCount;
 		renderTargetViewHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
@@ -164,15 +260,17 @@ public:
 		backbuffers = new ID3D12Resource * [scDesc.BufferCount];
 		D3D12_CPU_DESCRIPTOR_HANDLE renderTargetViewHandle = backbufferHeap->GetCPUDescriptorHandleForHeapStart();
 		unsigned int renderTargetViewDescriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-		for (unsigned int i = 0; i < 2; i++)
+		for (unsigned int i = 0; i < scDesc.BufferCount; i++)
 		{
 			swapchain->GetBuffer(i, IID_PPV_ARGS(&backbuffers[i]));
 			device->CreateRenderTargetView(backbuffers[i], nullptr, renderTargetViewHandle);
 			renderTargetViewHandle.ptr += renderTargetViewDescriptorSize;
 		}
 
-		graphicsQueueFence[0].create(device);
-		graphicsQueueFence[1].create(device);
+		for (int i = 0; i < framesInFlight; i++)
+		{
+			graphicsQueueFence[i].create(device);
+		}
 
 		D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDesc;
 		memset(&dsvHeapDesc, 0, sizeof(D3D12_DESCRIPTOR_HEAP_DESC));
@@ -230,7 +328,14 @@ public:
 		srvRange.RegisterSpace = 0;
 		srvRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 
-		D3D12_ROOT_PARAMETER params[3];
+		D3D12_DESCRIPTOR_RANGE bindlessRange = {};
+		bindlessRange.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+		bindlessRange.NumDescriptors = UINT_MAX;
+		bindlessRange.BaseShaderRegister = 0;
+		bindlessRange.RegisterSpace = 1;
+		bindlessRange.OffsetInDescriptorsFromTableStart = 0;
+
+		D3D12_ROOT_PARAMETER params[5];
 		params[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
 		params[0].Descriptor.ShaderRegister = 0;
 		params[0].Descriptor.RegisterSpace = 0;
@@ -246,6 +351,17 @@ public:
 		params[2].DescriptorTable.pDescriptorRanges = &srvRange;
 		params[2].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 
+		params[3].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+		params[3].DescriptorTable.NumDescriptorRanges = 1;
+		params[3].DescriptorTable.pDescriptorRanges = &bindlessRange;
+		params[3].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+		params[4].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+		params[4].Constants.ShaderRegister = 2;
+		params[4].Constants.RegisterSpace = 0;
+		params[4].Constants.Num32BitValues = 1;
+		params[4].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
 		D3D12_STATIC_SAMPLER_DESC staticSampler = {};
 		staticSampler.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
 		staticSampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
@@ -262,7 +378,7 @@ public:
 		staticSampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
 
 		D3D12_ROOT_SIGNATURE_DESC rsDesc = {};
-		rsDesc.NumParameters = 3;
+		rsDesc.NumParameters = bindless ? 5 : 3;
 		rsDesc.pParameters = params;
 		rsDesc.NumStaticSamplers = 1;
 		rsDesc.pStaticSamplers = &staticSampler;
@@ -298,15 +414,14 @@ public:
 
 	void resetCommandList()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-		graphicsCommandAllocator[frameIndex]->Reset();
-		graphicsCommandList[frameIndex]->Reset(graphicsCommandAllocator[frameIndex], NULL);
+		graphicsCommandAllocator[currentFrame]->Reset();
+		graphicsCommandList[currentFrame]->Reset(graphicsCommandAllocator[currentFrame], NULL);
 	}
 
 	ID3D12GraphicsCommandList4* getCommandList()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-		return graphicsCommandList[frameIndex];
+		if (openList) return openList;
+		return graphicsCommandList[currentFrame];
 	}
 
 	void runCommandList()
@@ -318,13 +433,27 @@ public:
 
 	void beginFrame()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-		graphicsQueueFence[frameIndex].wait();
+		{
+			PROFILE_SCOPE("Frame wait");
+			if (frameLatencyWaitable)
+				WaitForSingleObjectEx(frameLatencyWaitable, 1000, TRUE);
+			graphicsQueueFence[currentFrame].wait();
+		}
+		for (ID3D12Resource* resource : frameReleases[currentFrame])
+			resource->Release();
+		frameReleases[currentFrame].clear();
+		framesBegun++;
+		unsigned int backbufferIndex = swapchain->GetCurrentBackBufferIndex();
 		D3D12_CPU_DESCRIPTOR_HANDLE renderTargetViewHandle = backbufferHeap->GetCPUDescriptorHandleForHeapStart();
 		unsigned int renderTargetViewDescriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-		renderTargetViewHandle.ptr += frameIndex * renderTargetViewDescriptorSize;
+		renderTargetViewHandle.ptr += backbufferIndex * renderTargetViewDescriptorSize;
+		renderTargetHandle = renderTargetViewHandle;
 		resetCommandList();
-		Barrier::add(backbuffers[frameIndex], D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET, getCommandList());
+		openList = graphicsCommandList[currentFrame];
+		frameLists[currentFrame].used = 0;
+		srvHeap.beginFrame(currentFrame);
+		drawStream.beginFrame();
+		Barrier::add(backbuffers[backbufferIndex], D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET, getCommandList());
 		getCommandList()->OMSetRenderTargets(1, &renderTargetViewHandle, FALSE, &dsvHandle);
 		float color[4];
 		color[0] = 0;
@@ -335,17 +464,50 @@ public:
 		getCommandList()->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, NULL);
 	}
 
+	// Extra worker threads, 0 keeps everything on the calling thread
+	void initJobs(int workers)
+	{
+		jobs.init(workers);
+	}
+
+	// Translates the draw packets recorded so far into the command list
+	void flushDraws()
+	{
+		drawStream.sort();
+		std::vector<std::pair<int, int>> chunks;
+		if (openList && jobs.threadCount() > 1) {
+			chunks = drawStream.split(jobs.threadCount(), recordMinPackets);
+		}
+		if (chunks.size() <= 1) {
+			drawBackend.commandList = getCommandList();
+			drawStream.submit(&drawBackend);
+			drawStream.packets.clear();
+			return;
+		}
+		recordParallel(chunks);
+	}
+
 	void finishFrame()
 	{
-		unsigned int frameIndex = swapchain->GetCurrentBackBufferIndex();
-		Barrier::add(backbuffers[frameIndex], D3D12_RESOURCE_STATE_RENDER_TARGET,
+		flushDraws();
+		unsigned int backbufferIndex = swapchain->GetCurrentBackBufferIndex();
+		Barrier::add(backbuffers[backbufferIndex], D3D12_RESOURCE_STATE_RENDER_TARGET,
 			D3D12_RESOURCE_STATE_PRESENT, getCommandList());
-		runCommandList();
-		graphicsQueueFence[frameIndex].signal(graphicsQueue);
-		swapchain->Present(1, 0);
+		getCommandList()->Close();
+		closedLists.push_back(getCommandList());
+		graphicsQueue->ExecuteCommandLists((UINT)closedLists.size(), closedLists.data());
+		closedLists.clear();
+		openList = nullptr;
+		graphicsQueueFence[currentFrame].signal(graphicsQueue);
+		currentFrame = (currentFrame + 1) % framesInFlight;
+		PROFILE_SCOPE("Present");
+		if (settings.vsync)
+			swapchain->Present(1, 0);
+		else
+			swapchain->Present(0, tearingSupported ? DXGI_PRESENT_ALLOW_TEARING : 0);
 	}
 
-	void uploadResource(ID3D12Resource* dstResource, const void* data, unsigned int size, D3D12_RESOURCE_STATES targetState, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* texFootprint = NULL) {
+	ID3D12Resource* createUploadBuffer(UINT64 size) {
 		ID3D12Resource* uploadBuffer;
 		D3D12_HEAP_PROPERTIES heapProps = {};
 		heapProps.Type = D3D12_HEAP_TYPE_UPLOAD;
@@ -358,11 +520,32 @@ public:
 		bufferDesc.SampleDesc.Count = 1;
 		bufferDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
 		device->CreateCommittedResource(&heapProps, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&uploadBuffer));
-		void* mappeddata = NULL;
-		uploadBuffer->Map(0, NULL, &mappeddata);
-		memcpy(mappeddata, data, size);
+		return uploadBuffer;
+	}
+
+	// With texFootprint, data is tightly packed rows of Footprint.Height and each is placed at the footprint's RowPitch
+	void uploadResource(ID3D12Resource* dstResource, const void* data, unsigned int size, D3D12_RESOURCE_STATES targetState, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* texFootprint = NULL) {
+		UINT64 stagingSize = size;
+		if (texFootprint != NULL)
+			stagingSize = texFootprint->Offset + (UINT64)texFootprint->Footprint.RowPitch * texFootprint->Footprint.Height;
+		ID3D12Resource* uploadBuffer = createUploadBuffer(stagingSize);
+		unsigned char* mappeddata = NULL;
+		uploadBuffer->Map(0, NULL, (void**)&mappeddata);
+		if (texFootprint != NULL)
+		{
+			UINT rows = texFootprint->Footprint.Height;
+			size_t rowBytes = size / rows;
+			for (UINT row = 0; row < rows; row++)
+			{
+				memcpy(mappeddata + texFootprint->Offset + (UINT64)row * texFootprint->Footprint.RowPitch, (const unsigned char*)data + row * rowBytes, rowBytes);
+			}
+		}
+		else
+		{
+			memcpy(mappeddata, data, size);
+		}
 		uploadBuffer->Unmap(0, NULL);
-		resetCommandList();
+		startUpload();
 		if (texFootprint != NULL)
 		{
 			D3D12_TEXTURE_COPY_LOCATION src = {};
@@ -380,11 +563,128 @@ public:
 			getCommandList()->CopyBufferRegion(dstResource, 0, uploadBuffer, 0, size);
 		}
 		Barrier::add(dstResource, D3D12_RESOURCE_STATE_COPY_DEST, targetState, getCommandList());
+		finishUpload(uploadBuffer);
+	}
+
+	// Uploads issued between beginUploads and endUploads share one command list and one wait for the GPU.
+	// Inside a frame every upload already goes into the frame's command list without a wait, see finishUpload.
+	void beginUploads()
+	{
+		if (!openList)
+			resetCommandList();
+		batchingUploads = true;
+	}
+
+	void endUploads()
+	{
+		batchingUploads = false;
+		if (!openList)
+		{
+			runCommandList();
+			flushGraphicsQueue();
+		}
+		for (ID3D12Resource* uploadBuffer : pendingUploads)
+		{
+			if (openList)
+				releaseAfterFrame(uploadBuffer);
+			else
+				uploadBuffer->Release();
+		}
+		pendingUploads.clear();
+	}
+
+	void startUpload()
+	{
+		if (!batchingUploads && !openList)
+			resetCommandList();
+	}
+
+	// Submits and waits for an upload, or keeps its staging buffer alive until the batch ends. Between beginFrame
+	// and finishFrame the copy is left in the frame's command list, ahead of the draws, and nothing waits.
+	void finishUpload(ID3D12Resource* uploadBuffer)
+	{
+		if (batchingUploads)
+		{
+			pendingUploads.push_back(uploadBuffer);
+			return;
+		}
+		if (openList)
+		{
+			releaseAfterFrame(uploadBuffer);
+			return;
+		}
 		runCommandList();
 		flushGraphicsQueue();
 		uploadBuffer->Release();
 	}
 
+	// Maps a staging buffer laid out for the first levelCount subresources of dstResource. The caller writes the
+	// texels straight into it, so nothing is copied on the way, then hands it to endTextureUpload.
+	TextureStaging beginTextureUpload(ID3D12Resource* dstResource, int levelCount)
+	{
+		TextureStaging staging;
+		staging.dstResource = dstResource;
+		staging.footprints.resize(levelCount);
+		staging.numRows.resize(levelCount);
+		staging.rowSizes.resize(levelCount);
+		D3D12_RESOURCE_DESC desc = dstResource->GetDesc();
+		UINT64 totalSize = 0;
+		device->GetCopyableFootprints(&desc, 0, levelCount, 0, staging.footprints.data(), staging.numRows.data(), staging.rowSizes.data(), &totalSize);
+		staging.uploadBuffer = createUploadBuffer(totalSize);
+		staging.uploadBuffer->Map(0, NULL, (void**)&staging.mapped);
+		return staging;
+	}
+
+	// Copies every staged subresource in one go and moves the texture to targetState
+	void endTextureUpload(TextureStaging& staging, D3D12_RESOURCE_STATES targetState)
+	{
+		startUpload();
+		recordTextureCopies(staging, targetState);
+		finishUpload(staging.uploadBuffer);
+		staging.uploadBuffer = nullptr;
+	}
+
+	// For resources the frames in flight may still use, e.g. a texture that has been replaced
+	void releaseAfterFrame(ID3D12Resource* resource)
+	{
+		frameReleases[currentFrame].push_back(resource);
+	}
+
+	void recordTextureCopies(TextureStaging& staging, D3D12_RESOURCE_STATES targetState)
+	{
+		staging.uploadBuffer->Unmap(0, NULL);
+		staging.mapped = nullptr;
+		ID3D12Resource* dstResource = staging.dstResource;
+		for (int i = 0; i < (int)staging.footprints.size(); i++)
+		{
+			D3D12_TEXTURE_COPY_LOCATION src = {};
+			src.pResource = staging.uploadBuffer;
+			src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+			src.PlacedFootprint = staging.footprints[i];
+			D3D12_TEXTURE_COPY_LOCATION dst = {};
+			dst.pResource = dstResource;
+			dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			dst.SubresourceIndex = i;
+			getCommandList()->CopyTextureRegion(&dst, 0, 0, 0, &src, NULL);
+		}
+		Barrier::add(dstResource, D3D12_RESOURCE_STATE_COPY_DEST, targetState, getCommandList());
+	}
+
+	// Uploads the first levelCount subresources of a texture in one copy. Each level's rows are tightly packed in
+	// levelData[i] and are placed at the footprint's RowPitch in the staging buffer.
+	void uploadTexture(ID3D12Resource* dstResource, const unsigned char* const* levelData, int levelCount, D3D12_RESOURCE_STATES targetState)
+	{
+		TextureStaging staging = beginTextureUpload(dstResource, levelCount);
+		for (int i = 0; i < levelCount; i++)
+		{
+			for (UINT row = 0; row < staging.numRows[i]; row++)
+			{
+				memcpy(staging.level(i) + row * staging.rowPitch(i), levelData[i] + row * staging.rowSizes[i], (size_t)staging.rowSizes[i]);
+			}
+		}
+		endTextureUpload(staging, targetState);
+	}
+
 	void beginRenderPass()
 	{
 		getCommandList()->RSSetViewports(1, &viewport);
@@ -392,10 +692,85 @@ public:
 		getCommandList()->SetGraphicsRootSignature(rootSignature);
 		ID3D12DescriptorHeap* heaps[] = { srvHeap.heap };
 		getCommandList()->SetDescriptorHeaps(1, heaps);
+		if (bindless)
+			getCommandList()->SetGraphicsRootDescriptorTable(3, srvHeap.gpuHandle);
+	}
+
+	// Command lists start with no state, give a new one the same targets and bindings as the main list
+	void prepareCommandList(ID3D12GraphicsCommandList4* list)
+	{
+		list->OMSetRenderTargets(1, &renderTargetHandle, FALSE, &dsvHandle);
+		list->RSSetViewports(1, &viewport);
+		list->RSSetScissorRects(1, &scissorRect);
+		list->SetGraphicsRootSignature(rootSignature);
+		ID3D12DescriptorHeap* heaps[] = { srvHeap.heap };
+		list->SetDescriptorHeaps(1, heaps);
+		if (bindless)
+			list->SetGraphicsRootDescriptorTable(3, srvHeap.gpuHandle);
 	}
 
+	// Slot of the frame being recorded, in [0, framesInFlight). Anything written per frame should be indexed by this.
 	int frameIndex()
 	{
-		return swapchain->GetCurrentBackBufferIndex();
+		return currentFrame;
+	}
+
+private:
+	// Hands out the next unused list of this frame, creating it the first time round. Not reset yet.
+	int acquireFrameList()
+	{
+		FrameCommandLists& frame = frameLists[frameIndex()];
+		if (frame.used == frame.lists.size()) {
+			ID3D12CommandAllocator* allocator;
+			ID3D12GraphicsCommandList4* list;
+			device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&allocator));
+			device->CreateCommandList1(0, D3D12_COMMAND_LIST_TYPE_DIRECT, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&list));
+			frame.allocators.push_back(allocator);
+			frame.lists.push_back(list);
+		}
+		return frame.used++;
+	}
+
+	void resetFrameList(FrameCommandLists& frame, int index)
+	{
+		frame.allocators[index]->Reset();
+		frame.lists[index]->Reset(frame.allocators[index], NULL);
+		prepareCommandList(frame.lists[index]);
+	}
+
+	// Each chunk of the sorted packets is translated into its own list on a worker. The open list is closed ahead of
+	// them and recording carries on in a fresh one after them, so submission order matches the serial path.
+	void recordParallel(const std::vector<std::pair<int, int>>& chunks)
+	{
+		PROFILE_SCOPE("Record draws");
+		FrameCommandLists& frame = frameLists[frameIndex()];
+		int first = frame.used;
+		for (int i = 0; i <= chunks.size(); i++) {
+			acquireFrameList();
+		}
+
+		std::vector<DrawStats> chunkStats(chunks.size());
+		jobs.parallelFor((int)chunks.size(), [&](int i, int) {
+			PROFILE_SCOPE("Record chunk");
+			resetFrameList(frame, first + i);
+			D3D12DrawBackend backend;
+			backend.commandList = frame.lists[first + i];
+			BoundDrawState state;
+			drawStream.submitRange(&backend, chunks[i].first, chunks[i].second, state, chunkStats[i]);
+			backend.commandList->Close();
+		});
+
+		openList->Close();
+		closedLists.push_back(openList);
+		for (int i = 0; i < chunks.size(); i++) {
+			closedLists.push_back(frame.lists[first + i]);
+			drawStream.stats.add(chunkStats[i]);
+		}
+
+		int next = first + (int)chunks.size();
+		resetFrameList(frame, next);
+		openList = frame.lists[next];
+		drawStream.packets.clear();
+		drawStream.resetBound();
 	}
 };
\ No newline at end of file
@@ -108,6 +108,7 @@ public:
 
     void draw(Core* core, Matrix world, Matrix vp) {
         psoMgr.bind(core, "CubePSO");
+        core->drawStream.setObjectPosition(world.m[3], world.m[7], world.m[11]);
 
         CubeConstantBuffer cbData;
         cbData.W = world;
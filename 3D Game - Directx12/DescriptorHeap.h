@@ -1,32 +1,206 @@
 #pragma once
+#include <map>
+#include <vector>
+#include <algorithm>
+#ifndef GAME_HEADLESS
 #include <d3d12.h>
+#endif
 
+struct DescriptorHeapStats
+{
+	int capacity = 0; // Persistent part of the heap
+	int allocated = 0;
+	int peakAllocated = 0;
+	int pendingFree = 0; // Freed but still waiting for their frame to come round
+	int freeRanges = 0;
+	int largestFreeRange = 0;
+	int transientCapacity = 0; // Per frame
+	int transientUsed = 0; // By the current frame
+	int failedAllocations = 0;
+};
+
+// Index bookkeeping for a descriptor heap, kept apart from D3D so it can run headless.
+// The heap is laid out as [persistent | frame 0 transient | frame 1 transient | ...].
+// Persistent ranges are first fit from a free list that merges neighbours. A freed range is held back until the
+// frame slot it was freed in begins again, by which point that slot's fence has passed and the GPU is done with it.
+// Transient ranges are bumped out of the current frame's region and all dropped when that slot begins again.
+class DescriptorAllocator {
+public:
+	static const int invalid = -1;
+
+	void init(int _persistentCount, int _transientPerFrame = 0, int _framesInFlight = 1)
+	{
+		persistentCount = _persistentCount;
+		transientPerFrame = _transientPerFrame;
+		framesInFlight = std::max(_framesInFlight, 1);
+		freeList.clear();
+		if (persistentCount > 0) freeList[0] = persistentCount;
+		retired.assign(framesInFlight, {});
+		currentFrame = 0;
+		transientUsed = 0;
+		allocated = 0;
+		peakAllocated = 0;
+		pendingFree = 0;
+		failedAllocations = 0;
+	}
+
+	int totalCount() const
+	{
+		return persistentCount + transientPerFrame * framesInFlight;
+	}
+
+	// Returns the first index of count contiguous descriptors, or invalid when no free range is big enough
+	int allocate(int count = 1)
+	{
+		for (auto it = freeList.begin(); it != freeList.end(); ++it) {
+			if (it->second < count) continue;
+			int start = it->first;
+			int remaining = it->second - count;
+			freeList.erase(it);
+			if (remaining > 0) freeList[start + count] = remaining;
+			allocated += count;
+			peakAllocated = std::max(peakAllocated, allocated);
+			return start;
+		}
+		failedAllocations++;
+		return invalid;
+	}
+
+	void free(int start, int count = 1)
+	{
+		if (start == invalid || count <= 0) return;
+		retired[currentFrame].push_back({ start, count });
+		pendingFree += count;
+	}
+
+	// Descriptors for this frame only, e.g. a table built on the fly. Returns invalid when the frame's region is full.
+	int allocateTransient(int count = 1)
+	{
+		if (transientUsed + count > transientPerFrame) {
+			failedAllocations++;
+			return invalid;
+		}
+		int start = persistentCount + currentFrame * transientPerFrame + transientUsed;
+		transientUsed += count;
+		return start;
+	}
+
+	// Call once the fence for this frame slot has been waited on
+	void beginFrame(int frame)
+	{
+		currentFrame = frame % framesInFlight;
+		transientUsed = 0;
+		for (const std::pair<int, int>& range : retired[currentFrame]) {
+			release(range.first, range.second);
+		}
+		retired[currentFrame].clear();
+	}
+
+	DescriptorHeapStats stats() const
+	{
+		DescriptorHeapStats s;
+		s.capacity = persistentCount;
+		s.allocated = allocated;
+		s.peakAllocated = peakAllocated;
+		s.pendingFree = pendingFree;
+		s.freeRanges = (int)freeList.size();
+		for (auto& range : freeList) {
+			s.largestFreeRange = std::max(s.largestFreeRange, range.second);
+		}
+		s.transientCapacity = transientPerFrame;
+		s.transientUsed = transientUsed;
+		s.failedAllocations = failedAllocations;
+		return s;
+	}
+
+private:
+	int persistentCount = 0;
+	int transientPerFrame = 0;
+	int framesInFlight = 1;
+	int currentFrame = 0;
+	int transientUsed = 0;
+	int allocated = 0;
+	int peakAllocated = 0;
+	int pendingFree = 0;
+	int failedAllocations = 0;
+	std::map<int, int> freeList; // Start -> count, never touching
+	std::vector<std::vector<std::pair<int, int>>> retired; // Per frame slot
+
+	void release(int start, int count)
+	{
+		allocated -= count;
+		pendingFree -= count;
+		auto next = freeList.lower_bound(start);
+		if (next != freeList.begin()) {
+			auto prev = std::prev(next);
+			if (prev->first + prev->second == start) {
+				start = prev->first;
+				count += prev->second;
+				freeList.erase(prev);
+			}
+		}
+		if (next != freeList.end() && start + count == next->first) {
+			count += next->second;
+			freeList.erase(next);
+		}
+		freeList[start] = count;
+	}
+};
+
+#ifndef GAME_HEADLESS
 class DescriptorHeap {
 public:
-	ID3D12DescriptorHeap* heap;
-	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle;
+	ID3D12DescriptorHeap* heap = nullptr;
+	D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle; // Start of the heap
 	D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle;
 	unsigned int incrementSize;
-	int used;
-	void init(ID3D12Device5* device, int num)
+	DescriptorAllocator allocator;
+
+	void init(ID3D12Device5* device, int num, int transientPerFrame = 0, int framesInFlight = 1)
 	{
+		allocator.init(num, transientPerFrame, framesInFlight);
 		D3D12_DESCRIPTOR_HEAP_DESC uavcbvHeapDesc = {};
 		uavcbvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-		uavcbvHeapDesc.NumDescriptors = num;
+		uavcbvHeapDesc.NumDescriptors = allocator.totalCount();
 		uavcbvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 		device->CreateDescriptorHeap(&uavcbvHeapDesc, IID_PPV_ARGS(&heap));
 		cpuHandle = heap->GetCPUDescriptorHandleForHeapStart();
 		gpuHandle = heap->GetGPUDescriptorHandleForHeapStart();
 		incrementSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-		used = 0;
 	}
-	D3D12_CPU_DESCRIPTOR_HANDLE getNextCPUHandle()
+
+	int allocate(int count = 1)
 	{
-		if (used > 0)
-		{
-			cpuHandle.ptr += incrementSize;
-		}
-		used++;
-		return cpuHandle;
+		return allocator.allocate(count);
+	}
+
+	void free(int index, int count = 1)
+	{
+		allocator.free(index, count);
+	}
+
+	int allocateTransient(int count = 1)
+	{
+		return allocator.allocateTransient(count);
+	}
+
+	void beginFrame(int frame)
+	{
+		allocator.beginFrame(frame);
+	}
+
+	D3D12_CPU_DESCRIPTOR_HANDLE getCPUHandle(int index)
+	{
+		D3D12_CPU_DESCRIPTOR_HANDLE handle = cpuHandle;
+		handle.ptr += (SIZE_T)index * incrementSize;
+		return handle;
+	}
+
+	D3D12_GPU_DESCRIPTOR_HANDLE getGPUHandle(int index)
+	{
+		D3D12_GPU_DESCRIPTOR_HANDLE handle = gpuHandle;
+		handle.ptr += (UINT64)index * incrementSize;
+		return handle;
 	}
-};
\ No newline at end of file
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,402 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#ifndef GAME_HEADLESS
+#include <d3d12.h>
+#endif
+
+// Draws are not written straight into the command list. PSOManager::bind, PSOManager::apply, ShaderManager::updateTexturePS
+// and Mesh::draw fill in the current state of a DrawStream and every Mesh::draw appends a packet holding all of it.
+// At the end of the frame the packets are sorted and handed to a backend, D3D12 for the game or a recording one for tests.
+//
+// Sort key, most significant first: pass (4 bits), pipeline (16), texture table (20), depth front to back (24).
+// Submission skips any pipeline, root CBV, descriptor table, texture index or buffer binding that is already set.
+// In bindless mode materials pass a texture index as a root constant instead of switching tables, so those
+// packets all share table id 0 and sort by pipeline and depth alone.
+
+struct VertexBufferBinding
+{
+    unsigned long long location = 0;
+    unsigned int size = 0;
+    unsigned int stride = 0;
+};
+
+struct IndexBufferBinding
+{
+    unsigned long long location = 0;
+    unsigned int size = 0;
+    unsigned int format = 0; // DXGI_FORMAT
+};
+
+struct DrawPacket
+{
+    static const int rootCBVs = 2;
+
+    unsigned long long sortKey = 0;
+    void* pipeline = nullptr; // ID3D12PipelineState*
+    unsigned long long rootCBV[rootCBVs] = {}; // GPU virtual addresses for root parameters 0 and 1
+    unsigned long long descriptorTable = 0; // GPU descriptor handle for root parameter 2, 0 if none was set
+    int textureIndex = -1; // Root constant (parameter 4) indexing the bindless texture table, -1 if none was set
+    VertexBufferBinding vertexBuffer;
+    IndexBufferBinding indexBuffer;
+    unsigned int indexCount = 0;
+    unsigned int instanceCount = 1;
+};
+
+// State changes issued and skipped as redundant during one frame
+struct DrawStats
+{
+    int draws = 0;
+    int pipelineChanges = 0;
+    int pipelineSkipped = 0;
+    int cbvChanges = 0;
+    int cbvSkipped = 0;
+    int tableChanges = 0;
+    int tableSkipped = 0;
+    int constantChanges = 0;
+    int constantSkipped = 0;
+    int bufferChanges = 0;
+    int bufferSkipped = 0;
+
+    int skipped() const {
+        return pipelineSkipped + cbvSkipped + tableSkipped + constantSkipped + bufferSkipped;
+    }
+
+    void add(const DrawStats& other) {
+        draws += other.draws;
+        pipelineChanges += other.pipelineChanges;
+        pipelineSkipped += other.pipelineSkipped;
+        cbvChanges += other.cbvChanges;
+        cbvSkipped += other.cbvSkipped;
+        tableChanges += other.tableChanges;
+        tableSkipped += other.tableSkipped;
+        constantChanges += other.constantChanges;
+        constantSkipped += other.constantSkipped;
+        bufferChanges += other.bufferChanges;
+        bufferSkipped += other.bufferSkipped;
+    }
+};
+
+// What a command list currently has bound
+struct BoundDrawState
+{
+    DrawPacket packet;
+    bool any = false;
+};
+
+class DrawBackend {
+public:
+    virtual ~DrawBackend() {}
+    virtual void setPipeline(void* pipeline) = 0;
+    virtual void setRootCBV(int slot, unsigned long long address) = 0;
+    virtual void setDescriptorTable(int slot, unsigned long long handle) = 0;
+    virtual void setRootConstant(int slot, unsigned int value) = 0;
+    virtual void setVertexBuffer(const VertexBufferBinding& vb) = 0;
+    virtual void setIndexBuffer(const IndexBufferBinding& ib) = 0;
+    virtual void drawIndexed(unsigned int indexCount, unsigned int instanceCount) = 0;
+};
+
+class DrawStream {
+public:
+    DrawPacket current;
+    std::vector<DrawPacket> packets;
+    DrawStats stats;
+    DrawStats lastFrameStats;
+    float depthRange = 5000.0f; // Distances past this all share the furthest depth bucket
+
+    // Call at the start of a frame, the command list has no state bound yet
+    void beginFrame() {
+        lastFrameStats = stats;
+        stats = DrawStats();
+        current = DrawPacket();
+        packets.clear();
+        pass = 0;
+        depth = 0.0f;
+        bound = BoundDrawState();
+        pipelineIds.clear();
+        tableIds.clear();
+    }
+
+    void setPass(int _pass) {
+        pass = _pass;
+    }
+
+    void setEye(float x, float y, float z) {
+        eye[0] = x;
+        eye[1] = y;
+        eye[2] = z;
+    }
+
+    // World position of the object about to be drawn, used for the depth part of the key
+    void setObjectPosition(float x, float y, float z) {
+        float dx = x - eye[0];
+        float dy = y - eye[1];
+        float dz = z - eye[2];
+        depth = sqrtf(dx * dx + dy * dy + dz * dz);
+    }
+
+    void setPipeline(void* pipeline) {
+        current.pipeline = pipeline;
+    }
+
+    void setRootCBV(int slot, unsigned long long address) {
+        current.rootCBV[slot] = address;
+    }
+
+    void setDescriptorTable(unsigned long long handle) {
+        current.descriptorTable = handle;
+    }
+
+    void setTextureIndex(int index) {
+        current.textureIndex = index;
+    }
+
+    void drawIndexed(const VertexBufferBinding& vb, const IndexBufferBinding& ib, unsigned int indexCount, unsigned int instanceCount = 1) {
+        current.vertexBuffer = vb;
+        current.indexBuffer = ib;
+        current.indexCount = indexCount;
+        current.instanceCount = instanceCount;
+        current.sortKey = makeKey();
+        packets.push_back(current);
+    }
+
+    // Stable so packets with equal keys keep the order they were recorded in
+    void sort() {
+        std::stable_sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b) {
+            return a.sortKey < b.sortKey;
+        });
+    }
+
+    void submit(DrawBackend* backend) {
+        submitRange(backend, 0, (int)packets.size(), bound, stats);
+    }
+
+    // Translates packets [begin, end). A fresh command list starts from an empty BoundDrawState.
+    void submitRange(DrawBackend* backend, int begin, int end, BoundDrawState& state, DrawStats& out) const {
+        DrawPacket& bound = state.packet;
+        for (int p = begin; p < end; p++) {
+            const DrawPacket& packet = packets[p];
+            if (!state.any || packet.pipeline != bound.pipeline) {
+                backend->setPipeline(packet.pipeline);
+                bound.pipeline = packet.pipeline;
+                out.pipelineChanges++;
+            }
+            else {
+                out.pipelineSkipped++;
+            }
+
+            for (int i = 0; i < DrawPacket::rootCBVs; i++) {
+                if (!packet.rootCBV[i]) continue;
+                if (packet.rootCBV[i] != bound.rootCBV[i]) {
+                    backend->setRootCBV(i, packet.rootCBV[i]);
+                    bound.rootCBV[i] = packet.rootCBV[i];
+                    out.cbvChanges++;
+                }
+                else {
+                    out.cbvSkipped++;
+                }
+            }
+
+            if (packet.descriptorTable) {
+                if (packet.descriptorTable != bound.descriptorTable) {
+                    backend->setDescriptorTable(2, packet.descriptorTable);
+                    bound.descriptorTable = packet.descriptorTable;
+                    out.tableChanges++;
+                }
+                else {
+                    out.tableSkipped++;
+                }
+            }
+
+            if (packet.textureIndex >= 0) {
+                if (packet.textureIndex != bound.textureIndex) {
+                    backend->setRootConstant(4, (unsigned int)packet.textureIndex);
+                    bound.textureIndex = packet.textureIndex;
+                    out.constantChanges++;
+                }
+                else {
+                    out.constantSkipped++;
+                }
+            }
+
+            if (!state.any || packet.vertexBuffer.location != bound.vertexBuffer.location || packet.vertexBuffer.size != bound.vertexBuffer.size) {
+                backend->setVertexBuffer(packet.vertexBuffer);
+                bound.vertexBuffer = packet.vertexBuffer;
+                out.bufferChanges++;
+            }
+            else {
+                out.bufferSkipped++;
+            }
+
+            if (!state.any || packet.indexBuffer.location != bound.indexBuffer.location || packet.indexBuffer.size != bound.indexBuffer.size) {
+                backend->setIndexBuffer(packet.indexBuffer);
+                bound.indexBuffer = packet.indexBuffer;
+                out.bufferChanges++;
+            }
+            else {
+                out.bufferSkipped++;
+            }
+
+            state.any = true;
+            backend->drawIndexed(packet.indexCount, packet.instanceCount);
+            out.draws++;
+        }
+    }
+
+    // Cuts the packets into at most maxChunks contiguous ranges of at least minPackets each, for recording in parallel.
+    // Submitting the ranges in order gives the same draws as submitting the whole stream.
+    std::vector<std::pair<int, int>> split(int maxChunks, int minPackets) const {
+        std::vector<std::pair<int, int>> ranges;
+        int count = (int)packets.size();
+        if (count == 0) return ranges;
+        int chunks = std::max(1, std::min(maxChunks, count / std::max(minPackets, 1)));
+        int begin = 0;
+        for (int i = 0; i < chunks; i++) {
+            int end = (int)((long long)count * (i + 1) / chunks);
+            ranges.push_back({ begin, end });
+            begin = end;
+        }
+        return ranges;
+    }
+
+    // Call when draws move to a different command list, nothing is bound on the new one
+    void resetBound() {
+        bound = BoundDrawState();
+    }
+
+    // Sorts, submits and empties the stream. Anything written directly to the command list afterwards lands after these draws.
+    void flush(DrawBackend* backend) {
+        sort();
+        submit(backend);
+        packets.clear();
+    }
+
+private:
+    int pass = 0;
+    float depth = 0.0f;
+    float eye[3] = {};
+
+    // What the main command list has bound, carried across flushes within a frame
+    BoundDrawState bound;
+
+    // Pipelines and descriptor tables get small ids in first-seen order so they fit in the key. Started again every
+    // frame, so only what one frame draws has to fit and resources that are gone do not keep their ids.
+    std::unordered_map<void*, unsigned int> pipelineIds;
+    std::unordered_map<unsigned long long, unsigned int> tableIds;
+
+    unsigned long long makeKey() {
+        auto pipeline = pipelineIds.emplace(current.pipeline, (unsigned int)pipelineIds.size()).first->second;
+        auto table = tableIds.emplace(current.descriptorTable, (unsigned int)tableIds.size()).first->second;
+        unsigned long long depthBucket = (unsigned long long)(std::min(depth / depthRange, 1.0f) * 0xFFFFFF);
+        return ((unsigned long long)(pass & 0xF) << 60) |
+            ((unsigned long long)(pipeline & 0xFFFF) << 44) |
+            ((unsigned long long)(table & 0xFFFFF) << 24) |
+            depthBucket;
+    }
+};
+
+#ifndef GAME_HEADLESS
+class D3D12DrawBackend : public DrawBackend {
+public:
+    ID3D12GraphicsCommandList4* commandList = nullptr;
+
+    void setPipeline(void* pipeline) override {
+        commandList->SetPipelineState((ID3D12PipelineState*)pipeline);
+    }
+
+    void setRootCBV(int slot, unsigned long long address) override {
+        commandList->SetGraphicsRootConstantBufferView(slot, address);
+    }
+
+    void setDescriptorTable(int slot, unsigned long long handle) override {
+        D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle;
+        gpuHandle.ptr = handle;
+        commandList->SetGraphicsRootDescriptorTable(slot, gpuHandle);
+    }
+
+    void setRootConstant(int slot, unsigned int value) override {
+        commandList->SetGraphicsRoot32BitConstant(slot, value, 0);
+    }
+
+    void setVertexBuffer(const VertexBufferBinding& vb) override {
+        D3D12_VERTEX_BUFFER_VIEW view;
+        view.BufferLocation = vb.location;
+        view.SizeInBytes = vb.size;
+        view.StrideInBytes = vb.stride;
+        commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        commandList->IASetVertexBuffers(0, 1, &view);
+    }
+
+    void setIndexBuffer(const IndexBufferBinding& ib) override {
+        D3D12_INDEX_BUFFER_VIEW view;
+        view.BufferLocation = ib.location;
+        view.SizeInBytes = ib.size;
+        view.Format = (DXGI_FORMAT)ib.format;
+        commandList->IASetIndexBuffer(&view);
+    }
+
+    void drawIndexed(unsigned int indexCount, unsigned int instanceCount) override {
+        commandList->DrawIndexedInstanced(indexCount, instanceCount, 0, 0, 0);
+    }
+};
+#endif
+
+// Counts (and optionally keeps) every call instead of talking to a GPU, for headless tests and benchmarks
+class RecordingDrawBackend : public DrawBackend {
+public:
+    enum CommandType { SetPipeline, SetRootCBV, SetDescriptorTable, SetRootConstant, SetVertexBuffer, SetIndexBuffer, DrawIndexed };
+
+    struct Command
+    {
+        CommandType type;
+        int slot;
+        unsigned long long value;
+    };
+
+    bool keepCommands = true;
+    std::vector<Command> commands;
+    int counts[DrawIndexed + 1] = {};
+
+    void reset() {
+        commands.clear();
+        for (int& c : counts) c = 0;
+    }
+
+    void setPipeline(void* pipeline) override {
+        add(SetPipeline, 0, (unsigned long long)pipeline);
+    }
+
+    void setRootCBV(int slot, unsigned long long address) override {
+        add(SetRootCBV, slot, address);
+    }
+
+    void setDescriptorTable(int slot, unsigned long long handle) override {
+        add(SetDescriptorTable, slot, handle);
+    }
+
+    void setRootConstant(int slot, unsigned int value) override {
+        add(SetRootConstant, slot, value);
+    }
+
+    void setVertexBuffer(const VertexBufferBinding& vb) override {
+        add(SetVertexBuffer, 0, vb.location);
+    }
+
+    void setIndexBuffer(const IndexBufferBinding& ib) override {
+        add(SetIndexBuffer, 0, ib.location);
+    }
+
+    void drawIndexed(unsigned int indexCount, unsigned int instanceCount) override {
+        add(DrawIndexed, instanceCount, indexCount);
+    }
+
+private:
+    void add(CommandType type, int slot, unsigned long long value) {
+        counts[type]++;
+        if (keepCommands) {
+            commands.push_back({ type, slot, value });
+        }
+    }
+};
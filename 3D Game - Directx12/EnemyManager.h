@@ -1,86 +1,156 @@
 #pragma once
+#ifndef GAME_HEADLESS
 #include "AnimatedMesh.h"
-#include "Maths.h"
+#endif
+#include "Animation.h"
+#include "maths.h"
 #include "Collision.h"
+#include "TransformBatch.h"
+#include "Archetype.h"
 #include <vector>
 #include <cmath>
+#include <cstring>
 
-struct Enemy {
-    Vec3 position;
-    Vec3 rotation;
-    Vec3 scale;
-
-    Matrix transform;
-    AnimationInstance anim;
-    AABB collider;
-
+struct HealthComponent {
     float health = 100.0f;
     bool isDead = false;
+};
 
-    void updateTransform() {
-        Matrix S, R, T;
-        S.scaling(scale);
-        R.rotAroundY(rotation.y);
-        T.translation(position);
-        transform = S * R * T;
-
-        Vec3 size(1.0f, 2.0f, 1.0f);
-        collider.min = position - (size * 0.5f);
-        collider.max = position + (size * 0.5f);
-    }
+// Given once at spawn and never reused, so an enemy can be found again after rows have been moved around
+struct EnemyId {
+    unsigned int value = 0;
 };
 
 class EnemyManager {
 private:
+#ifndef GAME_HEADLESS
     AnimatedMesh* modelRef = nullptr;
-    std::vector<Enemy> enemies;
+#endif
+    Animation* animationRef = nullptr;
+
+    // Enemies are stored per component, a row index is the same enemy in every array.
+    // Transforms live in the TransformBatch so unchanged world matrices are not rebuilt.
+    TransformBatch transforms;
+    Archetype<AABB, HealthComponent, AnimationInstance, EnemyId> components;
+    unsigned int nextId = 0;
 
 public:
+#ifndef GAME_HEADLESS
     void init(AnimatedMesh* model) {
         modelRef = model;
+        animationRef = &model->animation;
+    }
+#endif
+
+    void init(Animation* animation) {
+        animationRef = animation;
+    }
+
+    static AABB makeCollider(const Vec3& position) {
+        Vec3 size(1.0f, 2.0f, 1.0f);
+        return AABB(position - (size * 0.5f), position + (size * 0.5f));
     }
 
     void spawnEnemy(Vec3 pos, Vec3 scale) {
-        Enemy e;
-        e.position = pos;
-        e.scale = scale;
-        e.rotation = Vec3(0, 0, 0);
-        e.health = 100.0f;
-        e.isDead = false;
-
-        e.anim.init(&modelRef->animation, 0);
-        e.anim.usingAnimation = "idle";
-        e.anim.t = ((float)rand() / RAND_MAX);
-
-        e.updateTransform();
-        enemies.push_back(e);
+        AnimationInstance anim;
+        anim.init(animationRef, 0);
+        anim.usingAnimation = "idle";
+        anim.t = ((float)rand() / RAND_MAX);
+
+        transforms.add(pos, 0.0f, scale);
+        components.add(makeCollider(pos), HealthComponent(), anim, EnemyId{ nextId++ });
     }
 
     void update(float dt, Vec3 playerPos) {
-        for (auto& e : enemies) {
-            if (e.isDead) continue;
+        std::vector<HealthComponent>& health = components.get<HealthComponent>();
+        std::vector<AnimationInstance>& anims = components.get<AnimationInstance>();
+
+        for (int i = 0; i < (int)health.size(); i++) {
+            if (health[i].isDead) continue;
 
-            e.anim.update("idle", dt);
+            anims[i].update("idle", dt);
 
-            Vec3 dir = playerPos - e.position; 
+            Vec3 dir = playerPos - transforms.positions[i];
 
             float angle = atan2(dir.x, dir.z);
 
-            e.rotation.y = angle + 3.14159f + 0.5f;
+            transforms.rotationsY[i] = angle + 3.14159f + 0.5f;
+        }
 
-            e.updateTransform();
+        // Only enemies that moved or turned get their world matrix and collider rebuilt
+        transforms.update();
+        std::vector<AABB>& colliders = components.get<AABB>();
+        for (int index : transforms.changed) {
+            colliders[index] = makeCollider(transforms.positions[index]);
         }
     }
 
+#ifndef GAME_HEADLESS
     void draw(Core* core, PSOManager* pso, ShaderManager* sm, TextureManager* tm, Matrix vp) {
-        for (auto& e : enemies) {
-            if (e.isDead) 
+        std::vector<HealthComponent>& health = components.get<HealthComponent>();
+        std::vector<AnimationInstance>& anims = components.get<AnimationInstance>();
+
+        for (int i = 0; i < health.size(); i++) {
+            if (health[i].isDead)
+                continue;
+            modelRef->draw(core, pso, sm, tm, &anims[i], vp, transforms.worlds[i]);
+        }
+    }
+
+    // Asks for the model's textures at the size of the nearest enemy on screen, projectionScaleY is p.m[5]
+    void requestTextures(TextureManager* tm, const Vec3& eye, float projectionScaleY, float viewportHeight,
+        const std::vector<Matrix>& worlds, const std::vector<char>& alive) {
+        float largest = 0.0f;
+        for (int i = 0; i < worlds.size(); i++) {
+            if (!alive[i])
                 continue;
-            modelRef->draw(core, pso, sm, tm, &e.anim, vp, e.transform);
+            largest = std::max(largest, modelRef->screenSize(worlds[i], eye, projectionScaleY, viewportHeight));
         }
+        if (largest > 0.0f)
+            modelRef->requestTextures(tm, largest);
+    }
+
+    // Draws enemies from snapshot data so the renderer never touches state the simulation is writing
+    void draw(Core* core, PSOManager* psos, ShaderManager* sm, TextureManager* tm, Matrix vp,
+        const std::vector<Matrix>& worlds, const std::vector<char>& alive, const std::vector<Matrix>& bones, int bonesPerEnemy) {
+        for (int i = 0; i < worlds.size(); i++) {
+            if (!alive[i])
+                continue;
+            modelRef->draw(core, psos, sm, tm, &bones[i * bonesPerEnemy], bonesPerEnemy, vp, worlds[i]);
+        }
+    }
+#endif
+
+    void writeSnapshot(std::vector<unsigned int>& ids, std::vector<Vec3>& positions, std::vector<float>& rotationsY, std::vector<Vec3>& scales,
+        std::vector<char>& alive, std::vector<Matrix>& bones, int& bonesPerEnemy) {
+        std::vector<HealthComponent>& health = components.get<HealthComponent>();
+        std::vector<AnimationInstance>& anims = components.get<AnimationInstance>();
+        std::vector<EnemyId>& enemyIds = components.get<EnemyId>();
+
+        positions = transforms.positions;
+        rotationsY = transforms.rotationsY;
+        scales = transforms.scales;
+
+        bonesPerEnemy = animationRef->bonesSize();
+        ids.resize(health.size());
+        alive.resize(health.size());
+        bones.resize(health.size() * bonesPerEnemy);
+        for (int i = 0; i < (int)health.size(); i++) {
+            ids[i] = enemyIds[i].value;
+            alive[i] = !health[i].isDead;
+            memcpy(&bones[i * bonesPerEnemy], anims[i].matrices, bonesPerEnemy * sizeof(Matrix));
+        }
+    }
+
+    int count() {
+        return components.size();
+    }
+
+    std::vector<AABB>& getColliders() {
+        return components.get<AABB>();
     }
 
-    std::vector<Enemy>& getEnemies() {
-        return enemies;
+    std::vector<HealthComponent>& getHealth() {
+        return components.get<HealthComponent>();
     }
 };
\ No newline at end of file
@@ -31,7 +31,9 @@ SOFTWARE.
 #include <sstream>
 #include <map>
 
+#ifdef _MSC_VER
 #pragma warning( disable : 26495)
+#endif
 
 namespace GEMLoader
 {
@@ -55,6 +57,10 @@ namespace GEMLoader
 		// Retrieves the property value as a string; returns a default string if empty
 		std::string getValue(std::string _default = "")
 		{
+			if (value == "")
+			{
+				return _default;
+			}
 			return value;
 		}
 
@@ -153,7 +159,7 @@ namespace GEMLoader
 		// Searches for a property by name and returns the found property or a default if not found
 		GEMProperty find(std::string name)
 		{
-			for (int i = 0; i < properties.size(); i++)
+			for (int i = 0; i < (int)properties.size(); i++)
 			{
 				if (properties[i].name == name)
 				{
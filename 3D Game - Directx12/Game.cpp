@@ -18,9 +18,22 @@
 #include "PlayerAnimManager.h"
 #include "EnemyManager.h"
 #include "BulletManager.h"
+#include "TransformBatch.h"
+#include "Archetype.h"
+#include "Simulation.h"
+#include "Input.h"
+#include "Level.h"
+#include "CookedLevel.h"
+#include "LevelStreamer.h"
+#include "SceneLoader.h"
+#include "Profiler.h"
+#include "GpuProfiler.h"
+#include "AssetLoader.h"
 #include <chrono>
 #include <vector>
 #include <cmath>
+#include <sstream>
+#include <algorithm>
 
 using namespace std;
 
@@ -43,17 +56,25 @@ public:
     }
 };
 
-struct RenderItem {
-    StaticMesh* mesh;
-    Matrix transform;
-    AABB collider;
-};
+// Returns the word following name on the command line, or an empty string
+string getArgument(const char* cmdLine, const string& name) {
+    if (!cmdLine) return "";
+    stringstream ss(cmdLine);
+    string word;
+    while (ss >> word) {
+        if (word == name && ss >> word) {
+            return word;
+        }
+    }
+    return "";
+}
 
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nCmdShow)
 {
     Window win;
     Core core;
     Timer tim;
+    AssetLoader assets;
 
     ShaderManager shaderMgr;
     PSOManager psoMgr;
@@ -74,22 +95,53 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
     BulletManager bulletMgr;
 
     map<string, StaticMesh*> meshCache;
-    vector<RenderItem> staticRenderList;
+    Archetype<StaticMesh*, Matrix> staticProps;
     vector<AABB> obstacles;
     vector<Matrix> wallMatrices;
 
     Matrix worldPlane;
 
     win.initialize(1024, 1024, "Game Scene");
-    core.initialize(win.hwnd, 1024, 1024);
+    // -framesinflight N (2-4), -backbuffers N, -waitable for the swapchain latency object, -novsync to present uncapped
+    CoreSettings coreSettings;
+    string framesInFlight = getArgument(lpCmdLine, "-framesinflight");
+    string backbuffers = getArgument(lpCmdLine, "-backbuffers");
+    if (!framesInFlight.empty()) coreSettings.framesInFlight = atoi(framesInFlight.c_str());
+    if (!backbuffers.empty()) coreSettings.backbufferCount = atoi(backbuffers.c_str());
+    coreSettings.waitableSwapchain = lpCmdLine && strstr(lpCmdLine, "-waitable");
+    coreSettings.vsync = !(lpCmdLine && strstr(lpCmdLine, "-novsync"));
+    core.initialize(win.hwnd, 1024, 1024, coreSettings);
+
+    // Extra threads for texture decoding and draw recording, "-workers 0" keeps it all on the main thread
+    string workers = getArgument(lpCmdLine, "-workers");
+    core.initJobs(workers.empty() ? min(3, max(0, (int)thread::hardware_concurrency() - 1)) : atoi(workers.c_str()));
+
+    // Video memory for streamed textures in MB, "-texturebudget 0" loads every texture in full up front instead
+    string textureBudget = getArgument(lpCmdLine, "-texturebudget");
+    int textureBudgetMB = textureBudget.empty() ? 256 : atoi(textureBudget.c_str());
+    if (textureBudgetMB > 0)
+        texMgr.initStreaming((size_t)textureBudgetMB * 1024 * 1024);
+
+    // Models and textures are read and decoded on their own threads ("-loaders N", 0 reads them here) and put on
+    // the GPU a few at a time at the start of each frame, drawn with a placeholder texture or not at all until then.
+    // "-syncload" finishes everything before the first frame instead.
+    string loaders = getArgument(lpCmdLine, "-loaders");
+    assets.init(loaders.empty() ? 2 : atoi(loaders.c_str()));
+    string assetsPerFrame = getArgument(lpCmdLine, "-assetsperframe");
+    int maxAssetsPerFrame = assetsPerFrame.empty() ? 4 : max(1, atoi(assetsPerFrame.c_str()));
+    texMgr.initPlaceholder(&core);
 
     planeModel.init(&core);
 
-    enemyModel.load(&core, "Models/Soldier1.gem", &psoMgr, &shaderMgr, &texMgr);
-    characterModel.load(&core, "Models/AutomaticCarbine.gem", &psoMgr, &shaderMgr, &texMgr);
+    int enemyAsset = enemyModel.loadAsync(&core, &assets, "Models/Soldier1.gem", &psoMgr, &shaderMgr, &texMgr);
+    int characterAsset = characterModel.loadAsync(&core, &assets, "Models/AutomaticCarbine.gem", &psoMgr, &shaderMgr, &texMgr);
 
     bulletSphere.init(&core, 12, 12, 1.0f);
 
+    // The simulation needs the skeletons and animations from the start, not the GPU side
+    assets.waitLoaded(enemyAsset);
+    assets.waitLoaded(characterAsset);
+
     characterAnim.init(&characterModel.animation, 0);
 
     bulletMgr.init(&bulletSphere);
@@ -104,117 +156,229 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
     worldPlane.scaling(Vec3(50.0f, 1.0f, 50.0f));
     worldPlane.translation(Vec3(0.0f, -0.1f, 0.0f));
 
-    ifstream file("LevelData.txt");
+    // Read from LevelData.txt.lvlc, cooked from the text the first time and whenever the text changes
+    CookedLevel level;
+    level.load("LevelData.txt");
+
+    // Level meshes are loaded the first time anything placed uses them. When the level streams, releaseUnusedMeshes
+    // below frees each one again once no resident prop uses it and it is loaded again if a cell brings it back.
+    vector<StaticMesh*> levelMeshes(level.meshCount, nullptr);
+    vector<int> levelMeshAssets(level.meshCount, -1); // Asset id of the load, -1 while not loaded
+    int levelMeshReleases = 0;
+    auto levelMesh = [&](int mesh) {
+        if (levelMeshAssets[mesh] == -1)
+        {
+            string path(level.meshPath(mesh));
+            // Only the first load of a mesh goes in the asset report, reloads come and go with the cells
+            bool firstLoad = !levelMeshes[mesh];
+            if (firstLoad)
+            {
+                levelMeshes[mesh] = new StaticMesh();
+                meshCache[path] = levelMeshes[mesh];
+            }
+            levelMeshAssets[mesh] = levelMeshes[mesh]->loadAsync(&core, &assets, path, firstLoad);
+        }
+        return levelMeshes[mesh];
+    };
 
-    if (file.is_open())
+    for (int i = 0; i < level.globalEntryCount; i++)
     {
-        string line;
-        while (getline(file, line))
+        if (level.entries[i].type == LevelPlane)
+            worldPlane = level.worlds[i];
+    }
+
+    // Cells of the level stream in and out around the player within "-levelbudget MB" of memory,
+    // "-levelbudget 0" loads the whole level up front instead. The budget is for the cells' own data, the meshes their
+    // props place are outside it: they are held only while a resident cell uses them.
+    string levelBudget = getArgument(lpCmdLine, "-levelbudget");
+    int levelBudgetMB = levelBudget.empty() ? 64 : atoi(levelBudget.c_str());
+    LevelStreamer levelStreamer;
+
+    // "-scene file" places the instances of a GEMScene instead of the level, nothing is streamed then
+    string sceneFile = getArgument(lpCmdLine, "-scene");
+    SceneLoader scene;
+    bool useScene = !sceneFile.empty() && scene.load(sceneFile);
+    if (useScene)
+        levelBudgetMB = 0;
+
+    // Props and walls to draw from the resident cells
+    auto rebuildLevel = [&]() {
+        staticProps.clear();
+        wallMatrices.clear();
+        for (const unique_ptr<LevelCell>& cell : levelStreamer.cells)
         {
-            if (line.empty() || line[0] == '#')
+            if (!cell)
                 continue;
+            for (int i = 0; i < cell->propMeshes.size(); i++)
+                staticProps.add(levelMesh(cell->propMeshes[i]), cell->propWorlds[i]);
+            wallMatrices.insert(wallMatrices.end(), cell->wallWorlds.begin(), cell->wallWorlds.end());
+        }
+        levelStreamer.changed = false;
+    };
+
+    // Frees the meshes whose last prop went with its cell, after rebuildLevel has taken them out of the draw lists.
+    // A mesh still loading is left until its load is done, as is one a cell has brought back since.
+    vector<int> unusedMeshes;
+    auto releaseUnusedMeshes = [&]() {
+        unusedMeshes.insert(unusedMeshes.end(), levelStreamer.unusedMeshes.begin(), levelStreamer.unusedMeshes.end());
+        levelStreamer.unusedMeshes.clear();
+        size_t waiting = 0;
+        for (int mesh : unusedMeshes)
+        {
+            if (levelStreamer.meshUsers[mesh] > 0 || levelMeshAssets[mesh] == -1)
+                continue;
+            if (assets.state(levelMeshAssets[mesh]) < AssetReady)
+            {
+                unusedMeshes[waiting++] = mesh;
+                continue;
+            }
+            levelMeshes[mesh]->release(&core);
+            levelMeshAssets[mesh] = -1;
+            levelMeshReleases++;
+        }
+        unusedMeshes.resize(waiting);
+    };
 
-            stringstream ss(line);
-            string type, path;
-            Vec3 pos, rot, sc;
-
-            ss >> type >> path
-                >> pos.x >> pos.y >> pos.z
-                >> rot.x >> rot.y >> rot.z
-                >> sc.x >> sc.y >> sc.z;
-
-            Matrix S, RX, RY, T;
-            S.scaling(sc);
-            RX.rotationX(rot.x);
-            RY.rotAroundY(rot.y);
-            Matrix R = RX * RY;
-            T.translation(pos);
+    if (useScene)
+    {
+        // Each mesh file is read once, all of them at the same time on the loading threads
+        vector<StaticMesh*> sceneMeshes;
+        vector<int> sceneAssets;
+        for (const string& path : scene.meshFilenames)
+        {
+            StaticMesh* newMesh = new StaticMesh();
+            sceneAssets.push_back(newMesh->loadAsync(&core, &assets, path));
+            meshCache[path] = newMesh;
+            sceneMeshes.push_back(newMesh);
+        }
+        for (int i = 0; i < scene.worlds.size(); i++)
+            staticProps.add(sceneMeshes[scene.instanceMeshes[i]], scene.worlds[i]);
 
-            Matrix worldMatrix = S * R * T;
+        // Colliders come from the meshes' bounds, so the simulation waits for the files to be read but not uploaded
+        vector<AABB> meshBounds;
+        for (int i = 0; i < sceneMeshes.size(); i++)
+        {
+            assets.waitLoaded(sceneAssets[i]);
+            meshBounds.push_back(sceneMeshes[i]->bounds);
+        }
+        scene.buildColliders(meshBounds);
+        obstacles = scene.colliders;
+    }
+    else if (levelBudgetMB > 0)
+    {
+        // The cells around the start are read before the first frame so the player never starts without collision
+        levelStreamer.init(&level, &assets, level.cellSize * 2.0f, level.cellSize * 2.5f, (size_t)levelBudgetMB * 1024 * 1024);
+        levelStreamer.update(player.position.x, player.position.z, true);
+        rebuildLevel();
+        levelStreamer.gatherColliders(obstacles);
+        for (int i = 0; i < levelStreamer.pendingSpawnPositions.size(); i++)
+            enemyMgr.spawnEnemy(levelStreamer.pendingSpawnPositions[i], levelStreamer.pendingSpawnScales[i]);
+        levelStreamer.pendingSpawnPositions.clear();
+        levelStreamer.pendingSpawnScales.clear();
+    }
+    else
+    {
+        for (int i = level.globalEntryCount; i < level.entryCount; i++)
+        {
+            const CookedLevelEntry& entry = level.entries[i];
+            const Matrix& worldMatrix = level.worlds[i];
 
-            if (type == "TREE")
-            {
-                if (meshCache.find(path) == meshCache.end())
-                {
-                    StaticMesh* newMesh = new StaticMesh();
-                    newMesh->init(&core, path);
-                    meshCache[path] = newMesh;
-                }
-
-                RenderItem item;
-                item.mesh = meshCache[path];
-                item.transform = worldMatrix;
-
-                Vec3 colSize(1.0f, 10.0f, 1.0f);
-                Vec3 halfSize = colSize * 0.5f;
-                Vec3 centerPos = pos;
-                centerPos.y += 5.0f;
-
-                item.collider.min = centerPos - halfSize;
-                item.collider.max = centerPos + halfSize;
-
-                staticRenderList.push_back(item);
-                obstacles.push_back(item.collider);
-            }
-            else if (type == "PLANE")
+            if (entry.type == LevelTree && entry.mesh != -1)
             {
-                worldPlane = worldMatrix;
+                staticProps.add(levelMesh(entry.mesh), worldMatrix);
+                obstacles.push_back(level.colliders[entry.collider]);
             }
-            else if (type == "ENEMY")
+            else if (entry.type == LevelEnemy)
             {
-                enemyMgr.spawnEnemy(pos, sc);
+                enemyMgr.spawnEnemy(entry.position, entry.scale);
             }
-            else if (type == "WALL")
+            else if (entry.type == LevelWall)
             {
                 wallMatrices.push_back(worldMatrix);
-
-                AABB wallCollider;
-                Vec3 wallSize;
-
-                if (abs(rot.y) < 0.1f)
-                    wallSize = Vec3(sc.x * 2.0f, sc.z * 2.0f, 1.0f);
-                else
-                    wallSize = Vec3(1.0f, sc.z * 2.0f, sc.x * 2.0f);
-
-                Vec3 halfSize = wallSize * 0.5f;
-                wallCollider.min = pos - halfSize;
-                wallCollider.max = pos + halfSize;
-
-                obstacles.push_back(wallCollider);
+                obstacles.push_back(level.colliders[entry.collider]);
             }
         }
-        file.close();
+
+        Level::addBoundary(obstacles, level.boundsMin, level.boundsMax);
     }
 
-    float mapLimit = 48.0f;
-    float wallThick = 10.0f;
-    float wallH = 100.0f;
+    if (lpCmdLine && strstr(lpCmdLine, "-syncload")) {
+        core.beginUploads();
+        assets.finishAll();
+        core.endUploads();
+    }
 
-    Vec3 sizeN(100.0f, wallH, wallThick);
-    Vec3 posN(0.0f, 0.0f, mapLimit + 5.0f);
-    AABB wN(posN - sizeN * 0.5f, posN + sizeN * 0.5f);
+    Matrix gunWorld = TransformBatch::compose(Vec3(0.05f, -0.07f, 0.15f), 0.0f, 3.14159f, Vec3(0.02f, 0.02f, 0.02f));
+
+    // -record <file> saves every tick of input, -replay <file> plays one back instead of reading the mouse and keyboard.
+    // Headless.cpp replays the same files without a window.
+    // With -threadedsim the window is still sampled here, once a frame, and the ticks take it from queuedInput.
+    bool threadedSim = lpCmdLine && strstr(lpCmdLine, "-threadedsim");
+    WindowInput windowInput;
+    windowInput.init(&win);
+    QueuedInput queuedInput;
+    InputSource* liveInput = threadedSim ? (InputSource*)&queuedInput : &windowInput;
+    InputRecorder inputRecorder;
+    InputReplay inputReplay;
+    InputSource* input = liveInput;
+
+    // Gameplay runs at a fixed step, rendering interpolates between the last two ticks.
+    // With -threadedsim the simulation ticks on its own thread and publishes snapshots.
+    Simulation sim;
+
+    string replayFile = getArgument(lpCmdLine, "-replay");
+    string recordFile = getArgument(lpCmdLine, "-record");
+    if (!replayFile.empty() && inputReplay.open(replayFile)) {
+        sim.step = inputReplay.step;
+        input = &inputReplay;
+    }
+    else if (!recordFile.empty() && inputRecorder.open(recordFile, liveInput, sim.step)) {
+        input = &inputRecorder;
+    }
 
-    Vec3 sizeS(100.0f, wallH, wallThick);
-    Vec3 posS(0.0f, 0.0f, -mapLimit - 5.0f);
-    AABB wS(posS - sizeS * 0.5f, posS + sizeS * 0.5f);
+    sim.init(&player, &playerAnimMgr, &characterAnim, &enemyMgr, &bulletMgr, input, &obstacles);
+    if (threadedSim) {
+        sim.start();
+    }
 
-    Vec3 sizeE(wallThick, wallH, 100.0f);
-    Vec3 posE(mapLimit + 5.0f, 0.0f, 0.0f);
-    AABB wE(posE - sizeE * 0.5f, posE + sizeE * 0.5f);
+    // "-gpuprofile" times each draw category on the GPU, read back a frame later and reported next to the CPU scopes.
+    // Draws are then only sorted within each category.
+    GpuProfiler gpuProfiler;
+#if PROFILER_ENABLED
+    D3D12TimerBackend gpuTimer;
+    gpuProfiler.enabled = lpCmdLine && strstr(lpCmdLine, "-gpuprofile");
+    if (gpuProfiler.enabled)
+        gpuTimer.init(&core, core.framesInFlight, 32);
+    gpuProfiler.init(&gpuTimer, core.framesInFlight, 32);
+#endif
 
-    Vec3 sizeW(wallThick, wallH, 100.0f);
-    Vec3 posW(-mapLimit - 5.0f, 0.0f, 0.0f);
-    AABB wW(posW - sizeW * 0.5f, posW + sizeW * 0.5f);
+    shared_ptr<const SimulationSnapshot> prevSnapshot;
+    shared_ptr<const SimulationSnapshot> curSnapshot;
+    RenderState renderState;
 
-    obstacles.push_back(wN);
-    obstacles.push_back(wS);
-    obstacles.push_back(wE);
-    obstacles.push_back(wW);
+    double firstFrameMs = 0.0;
+    double allAssetsMs = 0.0;
 
     while (true)
     {
+        PROFILE_SCOPE("Frame");
         core.beginFrame();
+        GPU_PROFILE_BEGIN_FRAME(&gpuProfiler, core.frameIndex());
         win.processMessages();
+        if (threadedSim && input != &inputReplay)
+            queuedInput.push(windowInput.sample());
+
+        if (firstFrameMs == 0.0)
+            firstFrameMs = assets.now();
+        {
+            // Copies recorded here go ahead of this frame's draws, which can then use what they upload
+            PROFILE_SCOPE("Asset uploads");
+            core.beginUploads();
+            assets.pump(maxAssetsPerFrame);
+            core.endUploads();
+            if (allAssetsMs == 0.0 && assets.pending() == 0)
+                allAssetsMs = assets.now();
+        }
 
         if (win.keys[VK_ESCAPE])
             break;
@@ -222,63 +386,156 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
         core.beginRenderPass();
         float dt = tim.dt();
 
-        player.update(dt, &win, obstacles);
-
-        playerAnimMgr.update(dt, player, obstacles);
+        if (!sim.isThreaded()) {
+            sim.advance(dt);
+        }
 
-        if (player.isReloading && playerAnimMgr.isCurrentActionFinished()) {
-            player.completeReload();
+        {
+            PROFILE_SCOPE("Interpolate");
+            float alpha = sim.latest(prevSnapshot, curSnapshot);
+            sim.interpolate(*prevSnapshot, *curSnapshot, alpha, renderState);
         }
 
-        enemyMgr.update(dt, player.position);
-        bulletMgr.update(dt, enemyMgr, obstacles);
+        if (levelBudgetMB > 0)
+        {
+            // Cells that came in with the pump above or went now: new draw lists here, new obstacles and any
+            // enemies to spawn for the simulation's next tick
+            PROFILE_SCOPE("Level streaming");
+            levelStreamer.update(renderState.playerPosition.x, renderState.playerPosition.z);
+            if (levelStreamer.changed)
+            {
+                rebuildLevel();
+                releaseUnusedMeshes();
+                shared_ptr<vector<AABB>> streamedObstacles = make_shared<vector<AABB>>();
+                levelStreamer.gatherColliders(*streamedObstacles);
+                sim.queueWorldChange(streamedObstacles, levelStreamer.pendingSpawnPositions, levelStreamer.pendingSpawnScales);
+                levelStreamer.pendingSpawnPositions.clear();
+                levelStreamer.pendingSpawnScales.clear();
+            }
+            else if (!unusedMeshes.empty())
+            {
+                releaseUnusedMeshes();
+            }
+        }
 
         float aspect = (float)win.width / (float)win.height;
         Matrix p;
         p = p.perspectiveProjection(aspect, 60.0f, 0.1f, 5000.0f);
 
-        Matrix v = player.getViewMatrix();
+        Matrix v = player.getViewMatrix(renderState.playerPosition, renderState.playerRotation);
         Matrix vp = v * p;
 
-        planeModel.draw(&core, worldPlane, vp);
-
-        for (int i = 0; i < wallMatrices.size(); i++)
-            planeModel.draw(&core, wallMatrices[i], vp);
-
-        for (int i = 0; i < staticRenderList.size(); i++)
-            staticRenderList[i].mesh->draw(&core, staticRenderList[i].transform, vp);
-
-        enemyMgr.draw(&core, &psoMgr, &shaderMgr, &texMgr, vp);
-
-        bulletMgr.draw(&core, vp);
+        Vec3 eye = renderState.playerPosition;
+        eye.y += player.eyeHeight;
+        core.drawStream.setEye(eye.x, eye.y, eye.z);
 
-        Matrix identityView;
+        {
+            // Texture demand from the same projection as vp, streamed before any draw looks a texture up.
+            // The weapon is drawn with an identity view, so its eye is the origin.
+            PROFILE_SCOPE("Texture streaming");
+            enemyMgr.requestTextures(&texMgr, eye, p.m[5], (float)win.height, renderState.enemyWorlds, curSnapshot->enemyAlive);
+            characterModel.requestTextures(&texMgr, characterModel.screenSize(gunWorld, Vec3(0, 0, 0), p.m[5], (float)win.height));
+            texMgr.stream(&core);
+        }
 
-        Matrix weaponVP = identityView * p;
+        {
+            // Recording only: streaming above and submitting in finishFrame have their own scopes
+            PROFILE_SCOPE("Render");
+            {
+                PROFILE_SCOPE("Draw plane");
+                GPU_PROFILE_SCOPE(&gpuProfiler, "Draw plane");
+                planeModel.draw(&core, worldPlane, vp);
+            }
 
-        Matrix gunS;
-        gunS.scaling(Vec3(0.02f, 0.02f, 0.02f));
+            {
+                PROFILE_SCOPE("Draw walls");
+                GPU_PROFILE_SCOPE(&gpuProfiler, "Draw walls");
+                for (int i = 0; i < wallMatrices.size(); i++)
+                    planeModel.draw(&core, wallMatrices[i], vp);
+            }
 
-        Matrix gunR;
-        gunR.rotAroundY(3.14159f);
+            {
+                PROFILE_SCOPE("Draw trees");
+                GPU_PROFILE_SCOPE(&gpuProfiler, "Draw trees");
+                vector<StaticMesh*>& propMeshes = staticProps.get<StaticMesh*>();
+                vector<Matrix>& propWorlds = staticProps.get<Matrix>();
+                for (int i = 0; i < propMeshes.size(); i++)
+                    propMeshes[i]->draw(&core, propWorlds[i], vp);
+            }
 
-        Matrix gunT;
-        gunT.translation(Vec3(0.05f, -0.07f, 0.15f));
+            {
+                PROFILE_SCOPE("Draw enemies");
+                GPU_PROFILE_SCOPE(&gpuProfiler, "Draw enemies");
+                enemyMgr.draw(&core, &psoMgr, &shaderMgr, &texMgr, vp, renderState.enemyWorlds, curSnapshot->enemyAlive, curSnapshot->enemyBones, curSnapshot->bonesPerEnemy);
+            }
 
-        Matrix gunWorld = gunS * gunR * gunT;
+            {
+                PROFILE_SCOPE("Draw bullets");
+                GPU_PROFILE_SCOPE(&gpuProfiler, "Draw bullets");
+                bulletMgr.draw(&core, vp, renderState.bulletPositions);
+            }
 
-        characterModel.draw(
-            &core,
-            &psoMgr,
-            &shaderMgr,
-            &texMgr,
-            &characterAnim,
-            weaponVP,
-            gunWorld
-        );
+            {
+                PROFILE_SCOPE("Draw weapon");
+                GPU_PROFILE_SCOPE(&gpuProfiler, "Draw weapon");
+                // The view model has its own projection, keep it in a later pass than the world
+                core.drawStream.setPass(1);
+                Matrix identityView;
+
+                Matrix weaponVP = identityView * p;
+
+                characterModel.draw(
+                    &core,
+                    &psoMgr,
+                    &shaderMgr,
+                    &texMgr,
+                    curSnapshot->gunBones.data(),
+                    (int)curSnapshot->gunBones.size(),
+                    weaponVP,
+                    gunWorld
+                );
+            }
+        }
 
+        GPU_PROFILE_END_FRAME(&gpuProfiler);
         core.finishFrame();
+        PROFILE_END_FRAME();
+    }
+
+    sim.stop();
+    assets.shutdown();
+
+#if PROFILER_ENABLED
+    // -profile <file> writes a Chrome trace of the last frames and the per scope stats next to it
+    string profileFile = getArgument(lpCmdLine, "-profile");
+    if (!profileFile.empty()) {
+        Profiler::get().endFrame();
+        Profiler::get().writeChromeTrace(profileFile);
+        ofstream statsFile(profileFile + ".txt");
+        Profiler::get().writeStats(statsFile);
+
+        const DrawStats& draws = core.drawStream.lastFrameStats;
+        statsFile << "\nlast frame: " << draws.draws << " draws, " << draws.skipped() << " redundant state changes skipped ("
+            << draws.pipelineSkipped << " pipeline, " << draws.cbvSkipped << " root CBV, "
+            << draws.tableSkipped << " descriptor table, " << draws.constantSkipped << " texture index, " << draws.bufferSkipped << " buffer)\n";
+        DescriptorHeapStats descriptors = core.srvHeap.allocator.stats();
+        statsFile << "srv heap: " << descriptors.allocated << "/" << descriptors.capacity << " allocated, peak " << descriptors.peakAllocated
+            << ", " << descriptors.pendingFree << " pending free, " << descriptors.freeRanges << " free ranges (largest " << descriptors.largestFreeRange << ")"
+            << ", transient " << descriptors.transientUsed << "/" << descriptors.transientCapacity << " per frame, " << descriptors.failedAllocations << " failed\n";
+        TextureResidencyStats residency = texMgr.residency.stats();
+        statsFile << "texture streaming: " << residency.residentBytes / 1024 << "/" << residency.budgetBytes / 1024 << " KB resident, peak "
+            << residency.peakResidentBytes / 1024 << " KB, " << residency.wantedBytes / 1024 << " KB wanted, " << residency.loads << " loads, "
+            << residency.evictions << " evictions, " << residency.starvedLoads << " over budget\n";
+        WorldPartitionStats cells = levelStreamer.partition.stats();
+        statsFile << "level streaming: " << cells.residentCells << "/" << cells.cells << " cells, " << cells.residentBytes / 1024 << "/"
+            << cells.budgetBytes / 1024 << " KB resident, peak " << cells.peakResidentBytes / 1024 << " KB, " << cells.loads << " loads, "
+            << cells.unloads << " unloads, " << cells.starvedLoads << " over budget, "
+            << count_if(levelMeshAssets.begin(), levelMeshAssets.end(), [](int id) { return id != -1; }) << "/" << level.meshCount
+            << " meshes loaded outside the budget, " << levelMeshReleases << " released\n";
+        statsFile << "\nstartup, from the asset loader starting: first frame at " << firstFrameMs << " ms, all assets ready at " << allAssetsMs << " ms\n";
+        assets.report(statsFile);
     }
+#endif
 
     for (auto const& [key, val] : meshCache)
         delete val;
@@ -0,0 +1,219 @@
+#pragma once
+#include "Profiler.h"
+#include <string>
+#include <vector>
+#ifndef GAME_HEADLESS
+#include "Core.h"
+#endif
+
+// Where timestamps are written and read back from. Every frame in flight owns its own range of query slots
+// so results are only read once that frame's fence has passed and nothing waits on the GPU.
+class GpuTimerBackend {
+public:
+    virtual ~GpuTimerBackend() {}
+    virtual void writeTimestamp(int frame, int query) = 0;
+    virtual void resolve(int frame, int count) = 0;
+    virtual void readResults(int frame, int count, unsigned long long* ticks) = 0;
+    virtual unsigned long long frequency() = 0; // Ticks per second
+};
+
+#ifndef GAME_HEADLESS
+class D3D12TimerBackend : public GpuTimerBackend {
+public:
+    Core* core = nullptr;
+    ID3D12QueryHeap* queryHeap = nullptr;
+    ID3D12Resource* readback = nullptr;
+    int queriesPerFrame = 0;
+    unsigned long long ticksPerSecond = 1;
+
+    void init(Core* _core, int framesInFlight, int _queriesPerFrame) {
+        core = _core;
+        queriesPerFrame = _queriesPerFrame;
+
+        D3D12_QUERY_HEAP_DESC heapDesc = {};
+        heapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+        heapDesc.Count = framesInFlight * queriesPerFrame;
+        core->device->CreateQueryHeap(&heapDesc, IID_PPV_ARGS(&queryHeap));
+
+        D3D12_HEAP_PROPERTIES heapProps = {};
+        heapProps.Type = D3D12_HEAP_TYPE_READBACK;
+        D3D12_RESOURCE_DESC bufferDesc = {};
+        bufferDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+        bufferDesc.Width = heapDesc.Count * sizeof(unsigned long long);
+        bufferDesc.Height = 1;
+        bufferDesc.DepthOrArraySize = 1;
+        bufferDesc.MipLevels = 1;
+        bufferDesc.SampleDesc.Count = 1;
+        bufferDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        core->device->CreateCommittedResource(&heapProps, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_COPY_DEST, NULL, IID_PPV_ARGS(&readback));
+
+        core->graphicsQueue->GetTimestampFrequency(&ticksPerSecond);
+    }
+
+    ~D3D12TimerBackend() {
+        if (queryHeap) queryHeap->Release();
+        if (readback) readback->Release();
+    }
+
+    // Pending draw packets are flushed first so the timestamp lands after the draws recorded before it. That cuts
+    // the frame's draw sort at every scope, which is why GpuProfiler is off unless switched on.
+    void writeTimestamp(int frame, int query) override {
+        core->flushDraws();
+        core->getCommandList()->EndQuery(queryHeap, D3D12_QUERY_TYPE_TIMESTAMP, frame * queriesPerFrame + query);
+    }
+
+    void resolve(int frame, int count) override {
+        UINT64 offset = frame * queriesPerFrame * sizeof(unsigned long long);
+        core->flushDraws();
+        core->getCommandList()->ResolveQueryData(queryHeap, D3D12_QUERY_TYPE_TIMESTAMP, frame * queriesPerFrame, count, readback, offset);
+    }
+
+    void readResults(int frame, int count, unsigned long long* ticks) override {
+        D3D12_RANGE range;
+        range.Begin = frame * queriesPerFrame * sizeof(unsigned long long);
+        range.End = range.Begin + count * sizeof(unsigned long long);
+        void* mapped = NULL;
+        readback->Map(0, &range, &mapped);
+        memcpy(ticks, (unsigned char*)mapped + range.Begin, count * sizeof(unsigned long long));
+        D3D12_RANGE written = { 0, 0 };
+        readback->Unmap(0, &written);
+    }
+
+    unsigned long long frequency() override {
+        return ticksPerSecond;
+    }
+};
+#endif
+
+// Stands in for the GPU when there is none, each timestamp advances a fake clock by a set amount
+class MockTimerBackend : public GpuTimerBackend {
+public:
+    std::vector<unsigned long long> queries;
+    std::vector<unsigned long long> resolved;
+    int queriesPerFrame = 0;
+    unsigned long long clock = 0;
+    unsigned long long ticksPerTimestamp = 1000;
+
+    void init(int framesInFlight, int _queriesPerFrame) {
+        queriesPerFrame = _queriesPerFrame;
+        queries.assign(framesInFlight * queriesPerFrame, 0);
+        resolved.assign(framesInFlight * queriesPerFrame, 0);
+    }
+
+    void writeTimestamp(int frame, int query) override {
+        clock += ticksPerTimestamp;
+        queries[frame * queriesPerFrame + query] = clock;
+    }
+
+    void resolve(int frame, int count) override {
+        for (int i = 0; i < count; i++) {
+            resolved[frame * queriesPerFrame + i] = queries[frame * queriesPerFrame + i];
+        }
+    }
+
+    void readResults(int frame, int count, unsigned long long* ticks) override {
+        for (int i = 0; i < count; i++) {
+            ticks[i] = resolved[frame * queriesPerFrame + i];
+        }
+    }
+
+    unsigned long long frequency() override {
+        return 1000000000ull;
+    }
+};
+
+// Times named ranges of GPU work and publishes them through Profiler as "GPU <name>". Scopes do nothing until
+// enabled is set, as timing a range of draws means they cannot be sorted together with the rest of the frame.
+class GpuProfiler {
+public:
+    bool enabled = false;
+    GpuTimerBackend* backend = nullptr;
+    int framesInFlight = 0;
+    int queriesPerFrame = 0;
+
+    void init(GpuTimerBackend* _backend, int _framesInFlight, int _queriesPerFrame) {
+        backend = _backend;
+        framesInFlight = _framesInFlight;
+        queriesPerFrame = _queriesPerFrame;
+        frames.resize(framesInFlight);
+        ticks.resize(queriesPerFrame);
+    }
+
+    // Call after the frame's fence wait, the results this slot recorded last time are finished by now
+    void beginFrame(int frame) {
+        current = frame;
+        FrameQueries& slot = frames[current];
+        if (slot.pending && !slot.names.empty()) {
+            int count = (int)slot.names.size() * 2;
+            backend->readResults(current, count, ticks.data());
+            double toMs = 1000.0 / backend->frequency();
+            for (int i = 0; i < (int)slot.names.size(); i++) {
+                unsigned long long start = ticks[i * 2];
+                unsigned long long end = ticks[i * 2 + 1];
+                float ms = end > start ? (float)((end - start) * toMs) : 0.0f;
+                Profiler::get().record(slot.names[i], ms);
+            }
+        }
+        slot.names.clear();
+        slot.pending = false;
+    }
+
+    // Returns the range index to pass to end(), or -1 when this frame is out of query slots
+    int begin(const char* name) {
+        if (!enabled) return -1;
+        FrameQueries& slot = frames[current];
+        int range = (int)slot.names.size();
+        if ((range + 1) * 2 > queriesPerFrame) return -1;
+        slot.names.push_back(std::string("GPU ") + name);
+        backend->writeTimestamp(current, range * 2);
+        return range;
+    }
+
+    void end(int range) {
+        if (range < 0) return;
+        backend->writeTimestamp(current, range * 2 + 1);
+    }
+
+    // Call before the command list is closed
+    void endFrame() {
+        FrameQueries& slot = frames[current];
+        if (slot.names.empty()) return;
+        backend->resolve(current, (int)slot.names.size() * 2);
+        slot.pending = true;
+    }
+
+private:
+    struct FrameQueries
+    {
+        std::vector<std::string> names;
+        bool pending = false;
+    };
+    std::vector<FrameQueries> frames;
+    std::vector<unsigned long long> ticks;
+    int current = 0;
+};
+
+class GpuProfileScope {
+public:
+    GpuProfiler* profiler;
+    int range;
+
+    GpuProfileScope(GpuProfiler* _profiler, const char* name) {
+        profiler = _profiler;
+        range = profiler->begin(name);
+    }
+
+    ~GpuProfileScope() {
+        profiler->end(range);
+    }
+};
+
+#if PROFILER_ENABLED
+#define GPU_PROFILE_SCOPE(profiler, name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(profiler, name)
+#define GPU_PROFILE_BEGIN_FRAME(profiler, frame) (profiler)->beginFrame(frame)
+#define GPU_PROFILE_END_FRAME(profiler) (profiler)->endFrame()
+#else
+#define GPU_PROFILE_SCOPE(profiler, name)
+#define GPU_PROFILE_BEGIN_FRAME(profiler, frame)
+#define GPU_PROFILE_END_FRAME(profiler)
+#endif
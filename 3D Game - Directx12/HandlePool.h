@@ -0,0 +1,139 @@
+#pragma once
+#include <vector>
+
+// 32 bit reference to a slot of a HandlePool: the low bits index the slot, the high bits are the generation the slot
+// was on when the handle was made. A slot's generation moves on when it is freed, so old handles stop resolving
+// instead of reaching whatever took the slot next. 0 is never a valid handle.
+struct ResourceHandle
+{
+    static const unsigned int indexBits = 20;
+    static const unsigned int indexMask = (1u << indexBits) - 1;
+
+    unsigned int value = 0;
+
+    int index() const
+    {
+        return (int)(value & indexMask);
+    }
+
+    unsigned int generation() const
+    {
+        return value >> indexBits;
+    }
+
+    bool valid() const
+    {
+        return value != 0;
+    }
+
+    bool operator==(const ResourceHandle& other) const
+    {
+        return value == other.value;
+    }
+
+    bool operator!=(const ResourceHandle& other) const
+    {
+        return value != other.value;
+    }
+};
+
+// Slot array of T with a reference count per slot. get is an index and a generation compare, freed slots are
+// reused most recent first.
+template <typename T>
+class HandlePool {
+public:
+    // The new handle holds one reference
+    ResourceHandle add(const T& value)
+    {
+        int index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else {
+            index = (int)slots.size();
+            slots.emplace_back();
+        }
+        Slot& slot = slots[index];
+        slot.value = value;
+        slot.refs = 1;
+        live++;
+        ResourceHandle handle;
+        handle.value = (slot.generation << ResourceHandle::indexBits) | (unsigned int)index;
+        return handle;
+    }
+
+    // NULL for a handle whose slot has been freed since
+    T* get(ResourceHandle handle)
+    {
+        Slot* slot = resolve(handle);
+        return slot ? &slot->value : nullptr;
+    }
+
+    const T* get(ResourceHandle handle) const
+    {
+        return const_cast<HandlePool*>(this)->get(handle);
+    }
+
+    void addRef(ResourceHandle handle)
+    {
+        if (Slot* slot = resolve(handle)) slot->refs++;
+    }
+
+    // Drops a reference. Returns true when it was the last one: the slot is freed and out holds the value it had,
+    // for the caller to clean up.
+    bool release(ResourceHandle handle, T& out)
+    {
+        Slot* slot = resolve(handle);
+        if (!slot || --slot->refs > 0) return false;
+        out = slot->value;
+        slot->value = T();
+        // Generation 0 is skipped so no handle ever comes out as 0
+        slot->generation = (slot->generation + 1) & (0xFFFFFFFFu >> ResourceHandle::indexBits);
+        if (slot->generation == 0) slot->generation = 1;
+        freeSlots.push_back(handle.index());
+        live--;
+        return true;
+    }
+
+    int refs(ResourceHandle handle) const
+    {
+        const Slot* slot = const_cast<HandlePool*>(this)->resolve(handle);
+        return slot ? slot->refs : 0;
+    }
+
+    int count() const
+    {
+        return live;
+    }
+
+    // Calls f(value) for every live slot
+    template <typename F>
+    void forEach(F f)
+    {
+        for (Slot& slot : slots) {
+            if (slot.refs > 0) f(slot.value);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        T value = T();
+        unsigned int generation = 1;
+        int refs = 0;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    int live = 0;
+
+    Slot* resolve(ResourceHandle handle)
+    {
+        int index = handle.index();
+        if (!handle.valid() || index >= (int)slots.size()) return nullptr;
+        Slot& slot = slots[index];
+        if (slot.refs == 0 || slot.generation != handle.generation()) return nullptr;
+        return &slot;
+    }
+};
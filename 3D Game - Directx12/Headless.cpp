@@ -0,0 +1,1703 @@
+// Runs the gameplay simulation with no window or GPU, driven by a recorded input file.
+// Prints a state hash for every tick so two runs (or two builds) can be diffed for determinism,
+// and the time spent per tick for performance comparisons.
+//
+// Built on its own, outside the Visual Studio project, e.g.
+//   g++ -std=c++20 -O2 Headless.cpp -o headless
+//   ./headless -replay run.inpt -ticks 3600 -hashes hashes.txt -profile trace.json
+//
+// "-loadbench N" instead times the CPU side of loading the level's models and textures, one after another and then
+// through an AssetLoader with N threads, and prints the per asset report. "-texturecache 0" decodes every texture
+// from its source rather than reading the cooked copy.
+//
+// "-levelbench N" writes a level of N entries and times reading it as text against the cooked, mapped copy.
+//
+// "-worldbench N" streams the cells of such a level around a player following a path across it at 60 ticks a second
+// for "-seconds S", at "-speed" m/s, with "-levelbudget MB" and "-loaders N" as in the game. Reports the peak memory,
+// the main thread cost of streaming per tick and how often the player stood in a cell that was not in yet, and fails
+// when the cells go over budget, when LevelStreamer's mesh users stop matching the resident props or when the streamed
+// loads leave asset records behind.
+//
+// "-scenebench N" writes a GEMScene of N instances over "-meshes M" mesh files and times GEMLoader::GEMScene against
+// SceneLoader, then reading the meshes one after another against "-loaders N" threads. "-scene file" replays on the
+// colliders of a scene instead of the level, as the game does with the same option.
+//
+// "-animbench N" times AnimationInstance::update on N instances of a 60 bone skeleton, playing one clip and then
+// cross-fading between two.
+//
+// "-mathbench N" times the maths.h SIMD kernels against the scalar code they replace on N items each and prints how far
+// apart their results are. multiplySIMD is timed against multiply, which stays scalar until a kernel beats it here.
+// Build with -DMATHS_NO_SIMD or -mavx to time the other kernel levels.
+//
+// "-ecsbench N" times a tick of enemy and bullet updates on N enemies stored per component, as EnemyManager keeps them,
+// against one struct per enemy, and prints how much of each layout the bullets' collision pass reads, e.g. for N 1000
+// and 10000.
+//
+// "-streambench N" flies a camera for "-frames F" through N objects, each with its own texture, requesting mips by
+// on screen size as Game.cpp does, within "-texturebudget MB" and "-textureloads N" per frame. Reports the
+// TextureResidency update cost, how much of the demand was met and what moved, and fails when it goes over budget.
+//
+// "-test name" runs one of the checks below, or all of them with "-test all", and prints ok or FAILED for each:
+//   jobs         back to back JobSystem::parallelFor calls, each index run exactly once and never after the call returned
+//   descriptors  DescriptorAllocator first fit, merging, transient regions and frees held back for the frames in flight
+//   constants    ConstantRing ranges per frame in flight, growing when a frame draws more than its range holds
+//   mips         mip level sizes for odd and non-square images, 2x2 box filter rounding, SSE2 against scalar output
+//   input        QueuedInput merging the frames pushed between ticks, pushed and taken on two threads
+//   interpolate  Simulation::interpolate matching enemies by id across moved rows and stepping bullets back by ticks
+//   draws        DrawStream sort order, redundant state skipped on submit, split ranges on fresh command lists
+//   profiler     Profiler ring readers keeping off the slot each thread writes next, with a thread writing throughout
+//   gpuprofiler  GpuProfiler nested scopes timed on MockTimerBackend, read back only once the frame's slot comes round
+//   residency    TextureResidency mip choice, tails, budget and LRU eviction, block aligned largest levels
+//   animation    AnimationInstance crossFade interrupting a fade without a jump, additive clips on a zero scale reference
+//
+// Record input with the game using "-record run.inpt".
+#define GAME_HEADLESS
+#include "Animation.h"
+#include "GEMLoader.h"
+#include "Player.h"
+#include "PlayerAnimManager.h"
+#include "EnemyManager.h"
+#include "BulletManager.h"
+#include "Simulation.h"
+#include "Input.h"
+#include "Level.h"
+#include "CookedLevel.h"
+#include "LevelStreamer.h"
+#include "SceneLoader.h"
+#include "Profiler.h"
+#include "AssetLoader.h"
+#include "TextureCook.h"
+#include "JobSystem.h"
+#include "DescriptorHeap.h"
+#include "ConstantRing.h"
+#include "DrawPacket.h"
+#include "GpuProfiler.h"
+#include "TextureResidency.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <filesystem>
+#include <set>
+#include <memory>
+
+using namespace std;
+
+static bool loadAnimation(const string& filename, Animation& animation) {
+    GEMLoader::GEMModelLoader loader;
+    vector<GEMLoader::GEMMesh> gemmeshes;
+    GEMLoader::GEMAnimation gemanimation;
+    loader.load(filename, gemmeshes, gemanimation);
+    if (gemanimation.bones.empty()) return false;
+    animation.load(gemanimation);
+    return true;
+}
+
+// Albedo texture of every mesh in filename, what AnimatedMesh loads
+static bool loadModel(const string& filename, bool animated, vector<string>& textures) {
+    GEMLoader::GEMModelLoader loader;
+    vector<GEMLoader::GEMMesh> gemmeshes;
+    if (animated) {
+        GEMLoader::GEMAnimation gemanimation;
+        loader.load(filename, gemmeshes, gemanimation);
+        Animation animation;
+        animation.load(gemanimation);
+        for (GEMLoader::GEMMesh& mesh : gemmeshes) {
+            textures.push_back(mesh.material.find("albedo").getValue());
+        }
+    }
+    else {
+        loader.load(filename, gemmeshes);
+    }
+    return !gemmeshes.empty();
+}
+
+static int loadBench(const vector<string>& animatedModels, const vector<string>& staticModels, int threads, bool useCache) {
+    vector<pair<string, bool>> models;
+    for (const string& m : animatedModels) models.push_back({ m, true });
+    for (const string& m : staticModels) models.push_back({ m, false });
+
+    // One pass first so the cooked copies exist and the files are in the OS cache for both timed runs
+    vector<string> textures;
+    for (const auto& model : models) {
+        loadModel(model.first, model.second, textures);
+    }
+    sort(textures.begin(), textures.end());
+    textures.erase(unique(textures.begin(), textures.end()), textures.end());
+    for (const string& texture : textures) {
+        CookedTexture cooked;
+        TextureCook::prepare(texture, cooked, useCache);
+    }
+
+    auto start = chrono::steady_clock::now();
+    for (const auto& model : models) {
+        vector<string> unused;
+        loadModel(model.first, model.second, unused);
+    }
+    for (const string& texture : textures) {
+        CookedTexture cooked;
+        TextureCook::prepare(texture, cooked, useCache);
+    }
+    chrono::duration<double, milli> serial = chrono::steady_clock::now() - start;
+
+    // As the game does it: a model's textures are only known, and submitted, once the model has been pumped
+    start = chrono::steady_clock::now();
+    AssetLoader assets;
+    assets.init(threads);
+    vector<vector<string>> modelTextures(models.size());
+    vector<string> submitted;
+    for (int i = 0; i < (int)models.size(); i++) {
+        assets.submit(models[i].first, [&models, &modelTextures, i]() { return loadModel(models[i].first, models[i].second, modelTextures[i]); },
+            [&assets, &modelTextures, &submitted, useCache, i]() {
+                for (const string& texture : modelTextures[i]) {
+                    if (find(submitted.begin(), submitted.end(), texture) != submitted.end()) continue;
+                    submitted.push_back(texture);
+                    auto cooked = make_shared<CookedTexture>();
+                    assets.submit(texture, [texture, cooked, useCache]() { return TextureCook::prepare(texture, *cooked, useCache); });
+                }
+            });
+    }
+    double submitMs = assets.now();
+    assets.finishAll();
+    chrono::duration<double, milli> loaded = chrono::steady_clock::now() - start;
+
+    assets.report(cout);
+    printf("%d models, %d textures\n", (int)models.size(), (int)textures.size());
+    printf("one after another %.2f ms, %d loading threads %.2f ms (%.2fx), submitting took %.2f ms\n",
+        serial.count(), threads, loaded.count(), serial.count() / max(loaded.count(), 0.001), submitMs);
+    return 0;
+}
+
+// What Game.cpp keeps from a level, for comparing the text and cooked paths
+struct LevelArrays {
+    vector<Matrix> worlds;
+    vector<AABB> colliders;
+    vector<Vec3> spawns;
+};
+
+// With cellOrder the entries are put in the order that level holds them in, globals first and then cell by cell
+static void readTextLevel(const string& filename, LevelArrays& out, const CookedLevel* cellOrder = nullptr) {
+    vector<LevelEntry> level;
+    Level::load(filename, level);
+    if (cellOrder) {
+        auto cellOf = [cellOrder](const LevelEntry& e) {
+            LevelEntryType type = CookedLevel::typeOf(e.type);
+            return type == LevelPlane || type == LevelOther ? -1 : cellOrder->cellAt(e.position.x, e.position.z);
+        };
+        stable_sort(level.begin(), level.end(), [&cellOf](const LevelEntry& a, const LevelEntry& b) { return cellOf(a) < cellOf(b); });
+    }
+    for (const LevelEntry& entry : level) {
+        out.worlds.push_back(TransformBatch::compose(entry.position, entry.rotation.x, entry.rotation.y, entry.scale));
+        if (entry.type == "TREE")
+            out.colliders.push_back(Level::treeCollider(entry.position));
+        else if (entry.type == "WALL")
+            out.colliders.push_back(Level::wallCollider(entry.position, entry.rotation, entry.scale));
+        else if (entry.type == "ENEMY")
+            out.spawns.push_back(entry.position);
+    }
+}
+
+static bool readCookedLevel(CookedLevel& level, LevelArrays& out) {
+    out.worlds.assign(level.worlds, level.worlds + level.entryCount);
+    out.colliders.assign(level.colliders, level.colliders + level.colliderCount);
+    for (int i = 0; i < level.entryCount; i++) {
+        if (level.entries[i].type == LevelEnemy)
+            out.spawns.push_back(level.entries[i].position);
+    }
+    return true;
+}
+
+template <typename F>
+static double bestOf(int runs, F f) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        auto start = chrono::steady_clock::now();
+        f();
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        best = min(best, elapsed.count());
+    }
+    return best;
+}
+
+// Mostly trees from a handful of models, some walls and enemies, over a 4 km square
+static bool writeBenchLevel(const string& filename, int count) {
+    FILE* out = fopen(filename.c_str(), "w");
+    if (!out) return false;
+    fprintf(out, "# Generated by headless\nPLANE    PROCEDURAL    0.0 0.0 0.0    0.0 0.0 0.0    2000.0 1.0 2000.0\n");
+    unsigned int seed = 1;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    for (int i = 1; i < count; i++) {
+        float x = random() * 4000.0f - 2000.0f, z = random() * 4000.0f - 2000.0f, yaw = random() * 6.2831853f;
+        float kind = random();
+        // Eight kinds of tree in each of eight bands across x, so cells far apart place different meshes
+        if (kind < 0.9f)
+            fprintf(out, "TREE     Models/tree_%02d.gem    %.3f 0.0 %.3f    0.0 %.4f 0.0    %.3f %.3f %.3f\n", min((int)((x + 2000.0f) / 500.0f), 7) * 8 + (int)(random() * 8),
+                x, z, yaw, 0.01f, 0.01f, 0.01f);
+        else if (kind < 0.96f)
+            fprintf(out, "WALL     PROCEDURAL    %.3f 0.0 %.3f    1.5708 %.4f 0.0    5.0 1.0 2.0\n", x, z, random() < 0.5f ? 0.0f : 1.5708f);
+        else
+            fprintf(out, "ENEMY    Models/Soldier1.gem    %.3f 0.0 %.3f    0.0 %.4f 0.0    0.05 0.05 0.05\n", x, z, yaw);
+    }
+    fclose(out);
+    remove(CookedLevel::cachePath(filename).c_str());
+    return true;
+}
+
+static int levelBench(int count) {
+    string filename = "LevelBench.txt";
+    if (!writeBenchLevel(filename, count)) return 1;
+
+    double cookMs = bestOf(1, [&]() { CookedLevel level; level.load(filename); });
+    LevelArrays text, cooked;
+    CookedLevel check;
+    if (!check.load(filename) || !readCookedLevel(check, cooked)) {
+        printf("Could not cook %s\n", filename.c_str());
+        return 1;
+    }
+    readTextLevel(filename, text, &check);
+
+    // The cooked matrices are composed four at a time, which can round differently in the last bit
+    bool same = text.worlds.size() == cooked.worlds.size() && text.colliders.size() == cooked.colliders.size() && text.spawns.size() == cooked.spawns.size();
+    for (size_t i = 0; same && i < text.worlds.size(); i++) {
+        for (int j = 0; j < 16; j++) same = same && fabsf(text.worlds[i].m[j] - cooked.worlds[i].m[j]) <= 1e-5f * max(1.0f, fabsf(text.worlds[i].m[j]));
+    }
+    same = same && memcmp(text.colliders.data(), cooked.colliders.data(), text.colliders.size() * sizeof(AABB)) == 0;
+    same = same && memcmp(text.spawns.data(), cooked.spawns.data(), text.spawns.size() * sizeof(Vec3)) == 0;
+
+    int runs = 5;
+    double textMs = bestOf(runs, [&]() { LevelArrays a; readTextLevel(filename, a); });
+    double loadMs = bestOf(runs, [&]() { CookedLevel level; LevelArrays a; level.load(filename); readCookedLevel(level, a); });
+    double openMs = bestOf(runs, [&]() { CookedLevel level; LevelArrays a; level.open(CookedLevel::cachePath(filename)); readCookedLevel(level, a); });
+    int mapped = 0;
+    double mapMs = bestOf(runs, [&]() { CookedLevel level; if (level.open(CookedLevel::cachePath(filename))) mapped++; });
+
+    MappedFile source, cookedFile;
+    source.open(filename);
+    cookedFile.open(CookedLevel::cachePath(filename));
+    printf("%d entries, %d colliders, %d meshes: text %.1f KB, cooked %.1f KB\n", check.entryCount, check.colliderCount, check.meshCount,
+        source.size() / 1024.0, cookedFile.size() / 1024.0);
+    same = same && mapped == runs;
+    printf("cooked matches text: %s\n", same ? "ok" : "FAILED");
+    printf("cook once %.2f ms\n", cookMs);
+    printf("text parse %.2f ms, cooked with source check %.2f ms (%.1fx), cooked only %.2f ms (%.1fx), map and validate %.3f ms\n",
+        textMs, loadMs, textMs / loadMs, openMs, textMs / openMs, mapMs);
+    source.close();
+    cookedFile.close();
+    remove(filename.c_str());
+    remove(CookedLevel::cachePath(filename).c_str());
+    return same ? 0 : 1;
+}
+
+// Resident set of the process in MB, 0 where it is not known
+static double residentMB() {
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0.0;
+    long pages = 0, resident = 0;
+    int read = fscanf(statm, "%ld %ld", &pages, &resident);
+    fclose(statm);
+    return read == 2 ? resident * 4096.0 / 1048576.0 : 0.0;
+}
+
+static int worldBench(int count, double budgetMB, int threads, float seconds, float speed, float hitchMs) {
+    string filename = "WorldBench.txt";
+    if (!writeBenchLevel(filename, count)) return 1;
+    CookedLevel level;
+    if (!level.load(filename)) {
+        printf("Could not cook %s\n", filename.c_str());
+        return 1;
+    }
+
+    AssetLoader assets;
+    assets.init(threads);
+    LevelStreamer streamer;
+    size_t budgetBytes = (size_t)(budgetMB * 1048576.0);
+    streamer.init(&level, &assets, level.cellSize * 2.0f, level.cellSize * 2.5f, budgetBytes);
+
+    // Along a circle of radius 1500 m around the middle with a wobble that crosses cell edges back and forth
+    float step = 1.0f / 60.0f;
+    float radius = 1500.0f;
+    int ticks = max(1, (int)(seconds / step));
+    auto pathAt = [radius](float angle, float& x, float& z) {
+        float r = radius + 20.0f * sinf(angle * 200.0f);
+        x = cosf(angle) * r;
+        z = sinf(angle) * r;
+    };
+
+    // As Game.cpp does it: pump, update, rebuild the draw lists and obstacles when something changed
+    float x, z;
+    pathAt(0.0f, x, z);
+    streamer.update(x, z, true);
+    vector<AABB> obstacles;
+    vector<int> drawMeshes;
+    vector<Matrix> drawWorlds;
+    vector<double> tickMs(ticks);
+    int missed = 0, rebuilds = 0;
+    // Meshes held as Game.cpp holds them: from the first prop using one until streamer says the last has gone
+    vector<char> meshHeld(level.meshCount, 0);
+    int meshesHeld = 0, peakMeshesHeld = 0, meshReleases = 0;
+    double startMB = residentMB(), peakMB = startMB;
+    auto stepDuration = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float>(step));
+    auto next = chrono::steady_clock::now();
+    for (int i = 0; i < ticks; i++) {
+        pathAt(i * speed * step / radius, x, z);
+        auto start = chrono::steady_clock::now();
+        assets.pump();
+        streamer.update(x, z);
+        if (streamer.changed) {
+            drawMeshes.clear();
+            drawWorlds.clear();
+            for (const unique_ptr<LevelCell>& cell : streamer.cells) {
+                if (!cell) continue;
+                drawMeshes.insert(drawMeshes.end(), cell->propMeshes.begin(), cell->propMeshes.end());
+                drawWorlds.insert(drawWorlds.end(), cell->propWorlds.begin(), cell->propWorlds.end());
+            }
+            streamer.gatherColliders(obstacles);
+            streamer.pendingSpawnPositions.clear();
+            streamer.pendingSpawnScales.clear();
+            streamer.changed = false;
+            rebuilds++;
+            for (int mesh : drawMeshes) {
+                if (!meshHeld[mesh]) meshesHeld++;
+                meshHeld[mesh] = 1;
+            }
+            for (int mesh : streamer.unusedMeshes) {
+                if (streamer.meshUsers[mesh] > 0 || !meshHeld[mesh]) continue;
+                meshHeld[mesh] = 0;
+                meshesHeld--;
+                meshReleases++;
+            }
+            streamer.unusedMeshes.clear();
+            peakMeshesHeld = max(peakMeshesHeld, meshesHeld);
+        }
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        tickMs[i] = elapsed.count();
+        if (!streamer.readyAt(x, z)) missed++;
+        if (i % 60 == 0) peakMB = max(peakMB, residentMB());
+        next += stepDuration;
+        this_thread::sleep_until(next);
+    }
+    assets.shutdown();
+
+    vector<double> sorted = tickMs;
+    sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (double t : tickMs) total += t;
+    int hitches = (int)count_if(tickMs.begin(), tickMs.end(), [hitchMs](double t) { return t > hitchMs; });
+    WorldPartitionStats stats = streamer.partition.stats();
+    printf("%d entries in %d x %d cells of %.0f m, budget %.2f MB, %d loading threads, %.0f m/s for %.0f s\n", level.entryCount, level.cellsX, level.cellsZ,
+        level.cellSize, budgetMB, threads, speed, seconds);
+    printf("%d ticks: streaming %.3f ms mean, %.3f ms 99th percentile, %.3f ms worst, %d over %.1f ms, %d rebuilds\n",
+        ticks, total / ticks, sorted[(size_t)(ticks * 0.99)], sorted.back(), hitches, hitchMs, rebuilds);
+    printf("player in a cell not loaded yet for %d ticks\n", missed);
+    printf("cells resident %d/%d, peak %.3f MB, %d loads, %d unloads, %d over budget\n",
+        stats.residentCells, stats.cells, stats.peakResidentBytes / 1048576.0, stats.loads, stats.unloads, stats.starvedLoads);
+    printf("process resident %.1f MB at the start, %.1f MB at peak\n", startMB, peakMB);
+
+    // Every mesh user is a prop of a resident cell, and the streamed loads leave no asset records behind
+    vector<int> users(level.meshCount, 0);
+    for (const unique_ptr<LevelCell>& cell : streamer.cells) {
+        if (!cell) continue;
+        for (int mesh : cell->propMeshes) users[mesh]++;
+    }
+    bool usersOk = users == streamer.meshUsers;
+    size_t records = assets.records().size();
+    printf("meshes held %d/%d, peak %d, %d releases, users %s, %zu asset records kept\n", meshesHeld, level.meshCount, peakMeshesHeld,
+        meshReleases, usersOk ? "match the resident props" : "DIFFER from the resident props", records);
+    bool ok = stats.peakResidentBytes <= budgetBytes && usersOk && records == 0;
+    if (stats.peakResidentBytes > budgetBytes) printf("FAILED: over budget\n");
+    if (!usersOk || records != 0) printf("FAILED: mesh users or asset records\n");
+    remove(filename.c_str());
+    remove(CookedLevel::cachePath(filename).c_str());
+    return ok ? 0 : 1;
+}
+
+// Model space bounds of a static model, all StaticMesh::loadFile keeps for collision
+static bool loadMeshBounds(const string& filename, AABB& bounds) {
+    GEMLoader::GEMModelLoader loader;
+    vector<GEMLoader::GEMMesh> gemmeshes;
+    loader.load(filename, gemmeshes);
+    for (const GEMLoader::GEMMesh& mesh : gemmeshes) {
+        for (const GEMLoader::GEMStaticVertex& v : mesh.verticesStatic) {
+            bounds.extend(Vec3(v.position.x, v.position.y, v.position.z));
+        }
+    }
+    return !gemmeshes.empty();
+}
+
+// Reads each of the scene's mesh files once on assets' threads and gives the scene its colliders
+static void loadSceneMeshes(SceneLoader& scene, AssetLoader& assets) {
+    vector<AABB> bounds(scene.meshFilenames.size());
+    for (int i = 0; i < (int)scene.meshFilenames.size(); i++) {
+        assets.submit(scene.meshFilenames[i], [&scene, &bounds, i]() { return loadMeshBounds(scene.meshFilenames[i], bounds[i]); });
+    }
+    assets.finishAll();
+    scene.buildColliders(bounds);
+}
+
+// Copies of the tree model placed over a 4 km square, as an exporter would write it with one instance per line.
+// Every 20th instance is marked as not colliding.
+static bool writeBenchScene(const string& filename, int count, int meshCount, vector<string>& meshFiles) {
+    for (int i = 0; i < meshCount; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "SceneBench_%02d.gem", i);
+        error_code ec;
+        filesystem::copy_file("Models/acacia_003.gem", name, filesystem::copy_options::overwrite_existing, ec);
+        if (ec) return false;
+        meshFiles.push_back(name);
+    }
+    FILE* out = fopen(filename.c_str(), "w");
+    if (!out) return false;
+    fprintf(out, "{\n  \"name\": \"Scene bench\",\n  \"instances\": [\n");
+    unsigned int seed = 1;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    for (int i = 0; i < count; i++) {
+        Vec3 position(random() * 4000.0f - 2000.0f, 0.0f, random() * 4000.0f - 2000.0f);
+        float scale = 0.005f + random() * 0.01f;
+        Matrix w = TransformBatch::compose(position, 0.0f, random() * 6.2831853f, Vec3(scale, scale, scale));
+        fprintf(out, "    { \"filename\": \"%s\", \"world\": [", meshFiles[(int)(random() * meshCount) % meshCount].c_str());
+        for (int j = 0; j < 16; j++) {
+            fprintf(out, j == 0 ? "%.7g" : ", %.7g", w.m[j]);
+        }
+        fprintf(out, "]%s }%s\n", i % 20 == 0 ? ", \"collision\": false" : "", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    return true;
+}
+
+static int sceneBench(int count, int meshCount, int threads) {
+    string filename = "SceneBench.json";
+    vector<string> meshFiles;
+    if (!writeBenchScene(filename, count, meshCount, meshFiles)) {
+        printf("Could not write %s\n", filename.c_str());
+        return 1;
+    }
+
+    // Both read the same instances with the same matrices
+    GEMLoader::GEMScene tree;
+    tree.load(filename);
+    SceneLoader scene;
+    bool same = scene.load(filename) && tree.instances.size() == scene.worlds.size();
+    for (size_t i = 0; same && i < scene.worlds.size(); i++) {
+        same = tree.instances[i].meshFilename == scene.meshFilenames[scene.instanceMeshes[i]] &&
+            memcmp(tree.instances[i].w.m, scene.worlds[i].m, sizeof(float) * 16) == 0;
+    }
+
+    double treeMs = bestOf(3, [&]() { GEMLoader::GEMScene s; s.load(filename); });
+    double streamMs = bestOf(5, [&]() { SceneLoader s; s.load(filename); });
+
+    // Files are in the OS cache after the first pass, so both timed runs measure parsing rather than the disk
+    vector<AABB> bounds(scene.meshFilenames.size());
+    for (int i = 0; i < (int)scene.meshFilenames.size(); i++) {
+        loadMeshBounds(scene.meshFilenames[i], bounds[i]);
+    }
+    double serialMs = bestOf(3, [&]() {
+        for (int i = 0; i < (int)scene.meshFilenames.size(); i++) {
+            AABB b;
+            loadMeshBounds(scene.meshFilenames[i], b);
+        }
+    });
+    AssetLoader assets;
+    assets.init(threads);
+    double threadedMs = bestOf(3, [&]() { loadSceneMeshes(scene, assets); });
+    assets.shutdown();
+    double collidersMs = bestOf(5, [&]() { scene.buildColliders(bounds); });
+
+    MappedFile source;
+    source.open(filename);
+    printf("%d instances of %d mesh files, %.1f KB of JSON, %d colliders\n", (int)scene.worlds.size(), (int)scene.meshFilenames.size(),
+        source.size() / 1024.0, (int)scene.colliders.size());
+    printf("SceneLoader matches GEMScene: %s\n", same ? "ok" : "FAILED");
+    printf("GEMScene %.2f ms, SceneLoader %.2f ms (%.1fx)\n", treeMs, streamMs, treeMs / streamMs);
+    printf("meshes one after another %.2f ms, %d loading threads %.2f ms (%.2fx), colliders %.3f ms\n", serialMs, threads, threadedMs,
+        serialMs / threadedMs, collidersMs);
+    source.close();
+    remove(filename.c_str());
+    for (const string& mesh : meshFiles) {
+        remove(mesh.c_str());
+    }
+    return same ? 0 : 1;
+}
+
+// Short calls one after the other give a worker that is late from one call every chance to run into the next
+static bool testJobs() {
+    bool ok = true;
+    for (int workers = 1; workers <= 4 && ok; workers++) {
+        JobSystem jobs;
+        jobs.init(workers);
+        atomic<int> ran = 0;
+        long long expected = 0;
+        for (int call = 0; call < 20000 && ok; call++) {
+            int count = 2 + call % 13;
+            vector<atomic<int>> hits(count);
+            jobs.parallelFor(count, [&hits, &ran, call](int i, int) {
+                // Now and then a job gives up its time slice so calls overlap on fewer cores too
+                if ((i + call) % 7 == 0) this_thread::yield();
+                hits[i]++;
+                ran++;
+            });
+            for (int i = 0; i < count; i++) ok = ok && hits[i] == 1;
+            expected += count;
+        }
+        jobs.shutdown();
+        ok = ok && ran == expected;
+        if (!ok) printf("jobs: %d workers, %d jobs ran, %lld expected\n", workers, ran.load(), expected);
+    }
+    return ok;
+}
+
+static bool testDescriptors() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("descriptors: %s\n", what);
+        ok = ok && condition;
+    };
+
+    // A freed range comes back once the frame slot it was freed in begins again, merged with its neighbours
+    DescriptorAllocator heap;
+    heap.init(16, 4, 3);
+    heap.beginFrame(0);
+    int a = heap.allocate(4), b = heap.allocate(4), c = heap.allocate(8);
+    check(a == 0 && b == 4 && c == 8, "first fit from the start");
+    check(heap.allocate() == DescriptorAllocator::invalid && heap.stats().failedAllocations == 1, "full heap fails");
+    heap.free(b, 4);
+    heap.free(a, 4);
+    heap.beginFrame(1);
+    check(heap.allocate() == DescriptorAllocator::invalid, "free held back in the next frame");
+    heap.beginFrame(2);
+    check(heap.allocate() == DescriptorAllocator::invalid && heap.stats().pendingFree == 8, "free held back for every frame in flight");
+    heap.beginFrame(3);
+    DescriptorHeapStats stats = heap.stats();
+    check(stats.pendingFree == 0 && stats.freeRanges == 1 && stats.largestFreeRange == 8, "freed neighbours merged when the slot comes round");
+    heap.free(c, 8);
+    heap.beginFrame(4);
+    heap.beginFrame(5);
+    heap.beginFrame(6);
+    stats = heap.stats();
+    check(stats.allocated == 0 && stats.freeRanges == 1 && stats.largestFreeRange == 16, "everything merged back into one range");
+
+    // Transient ranges sit after the persistent part, one region per frame slot, and reset with their slot
+    check(heap.allocateTransient(3) == 16, "transient in slot 0");
+    check(heap.allocateTransient(2) == DescriptorAllocator::invalid, "transient region full");
+    heap.beginFrame(7);
+    check(heap.allocateTransient(4) == 20, "transient in slot 1");
+    heap.beginFrame(9);
+    check(heap.allocateTransient(4) == 16, "transient slot 0 reset");
+
+    // Random allocations and frees against a model of which descriptors are in use or still waiting for the GPU
+    unsigned int seed = 7;
+    auto random = [&seed](int n) { seed = seed * 1664525u + 1013904223u; return (int)((seed >> 8) % (unsigned int)n); };
+    int capacity = 256, frames = 3;
+    heap.init(capacity, 0, frames);
+    vector<int> owner(capacity, 0); // 0 free, 1 live, 2 + slot while waiting to be released
+    vector<pair<int, int>> live;
+    for (int frame = 0; frame < 2000 && ok; frame++) {
+        int slot = frame % frames;
+        heap.beginFrame(frame);
+        for (int& o : owner) {
+            if (o == 2 + slot) o = 0;
+        }
+        for (int i = 0; i < 4; i++) {
+            if (!live.empty() && random(2) == 0) {
+                int pick = random((int)live.size());
+                pair<int, int> range = live[pick];
+                live.erase(live.begin() + pick);
+                heap.free(range.first, range.second);
+                for (int j = 0; j < range.second; j++) owner[range.first + j] = 2 + slot;
+            }
+            int count = 1 + random(8);
+            int start = heap.allocate(count);
+            if (start == DescriptorAllocator::invalid) {
+                // Only allowed when no run of count free descriptors exists
+                int run = 0, longest = 0;
+                for (int o : owner) {
+                    run = o == 0 ? run + 1 : 0;
+                    longest = max(longest, run);
+                }
+                check(longest < count, "allocation failed with room left");
+                continue;
+            }
+            for (int j = 0; j < count; j++) {
+                check(start + j < capacity && owner[start + j] == 0, "range handed out while in use or waiting for the GPU");
+                if (start + j < capacity) owner[start + j] = 1;
+            }
+            live.push_back({ start, count });
+        }
+    }
+    return ok;
+}
+
+static bool testConstants() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("constants: %s\n", what);
+        ok = ok && condition;
+    };
+
+    // Each frame slot writes its own range, which starts over when the slot comes round
+    ConstantRing ring;
+    ring.init(4, 2);
+    ring.beginFrame(0);
+    check(ring.current() == 0 && ring.next() && ring.current() == 1, "frame 0 from the start of the buffer");
+    ring.beginFrame(1);
+    check(ring.current() == 4, "frame 1 after frame 0's range");
+    ring.beginFrame(2);
+    check(ring.current() == 0, "frame 0's range reused once its slot comes round");
+
+    // Frames drawing more than a range grow into a new buffer. No slot of a buffer is written twice by one frame or
+    // by two frames that can be in flight together.
+    unsigned int seed = 3;
+    auto random = [&seed](int n) { seed = seed * 1664525u + 1013904223u; return (int)((seed >> 8) % (unsigned int)n); };
+    const int frames = 3;
+    ring.init(4, frames);
+    int buffer = 0; // Counts the buffers made as the ring grows
+    vector<set<pair<int, int>>> written(frames); // Buffer and slot per frame slot, until the slot comes round
+    for (int frame = 0; frame < 500 && ok; frame++) {
+        int slot = frame % frames;
+        ring.beginFrame(frame);
+        written[slot].clear();
+        int draws = frame < 400 ? random(12) : random(3); // Fewer once grown, so ranges get reused
+        for (int d = 0; d < draws; d++) {
+            pair<int, int> use(buffer, ring.current());
+            check(use.second >= slot * ring.perFrame() && use.second < (slot + 1) * ring.perFrame(), "slot outside the frame's range");
+            for (const set<pair<int, int>>& inFlight : written) {
+                check(!inFlight.count(use), "slot written while the GPU may still read it");
+            }
+            written[slot].insert(use);
+            if (!ring.next()) {
+                ring.grow();
+                buffer++;
+            }
+        }
+    }
+    check(ring.perFrame() >= 8 && ring.peak() >= 8, "grown past the largest frame");
+    return ok;
+}
+
+static bool testMips() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("mips: %s\n", what);
+        ok = ok && condition;
+    };
+    auto level = [](int width, int height, const vector<unsigned char>& pixels) {
+        ImageLevel image;
+        image.width = width;
+        image.height = height;
+        image.pixels = pixels;
+        return image;
+    };
+
+    // Every level halves, rounding down to 1, until 1x1
+    auto sizes = [](int width, int height) {
+        vector<ImageLevel> levels(1);
+        levels[0].width = width;
+        levels[0].height = height;
+        levels[0].pixels.assign((size_t)width * height * 4, 0);
+        ImageProcessing::generateMips(levels);
+        vector<pair<int, int>> out;
+        for (const ImageLevel& l : levels) out.push_back({ l.width, l.height });
+        return out;
+    };
+    check(sizes(5, 3) == vector<pair<int, int>>{ { 5, 3 }, { 2, 1 }, { 1, 1 } }, "5x3 levels");
+    check(sizes(1, 7) == vector<pair<int, int>>{ { 1, 7 }, { 1, 3 }, { 1, 1 } }, "1x7 levels");
+    check(sizes(8, 8).size() == 4 && sizes(1, 1).size() == 1 && ImageProcessing::mipCount(1024, 1) == 11, "level counts");
+
+    // A 2x2 block averages with halves rounded up and quarters down, channels kept apart
+    ImageLevel out;
+    ImageProcessing::downsample(level(2, 2, { 0, 1, 1, 255, 0, 1, 1, 255, 0, 1, 0, 255, 1, 0, 0, 255 }), out);
+    check(out.width == 1 && out.height == 1 && out.pixels == vector<unsigned char>{ 0, 1, 1, 255 }, "2x2 rounding");
+    ImageProcessing::downsample(level(2, 2, { 10, 0, 0, 0, 11, 0, 0, 0, 11, 0, 0, 0, 11, 0, 0, 0 }), out);
+    check(out.pixels[0] == 11, "quarter past rounds to the nearest");
+    // An odd last column is dropped once halved; a single column averages each pair of rows
+    ImageProcessing::downsample(level(3, 1, { 4, 0, 0, 0, 8, 0, 0, 0, 200, 0, 0, 0 }), out);
+    check(out.width == 1 && out.pixels[0] == 6, "3x1 drops the odd column");
+    ImageProcessing::downsample(level(1, 3, { 4, 0, 0, 0, 9, 0, 0, 0, 200, 0, 0, 0 }), out);
+    check(out.height == 1 && out.pixels[0] == 7, "1x3 averages the first pair of rows");
+
+    // The SSE2 loop against the scalar one at every width up to past a few steps, so every tail is left
+    unsigned int seed = 11;
+    ImageLevel reference;
+    for (int width = 1; width <= 21; width++) {
+        for (int height = 1; height <= 5; height++) {
+            vector<unsigned char> pixels((size_t)width * height * 4);
+            for (unsigned char& p : pixels) {
+                seed = seed * 1664525u + 1013904223u;
+                p = (unsigned char)(seed >> 24);
+            }
+            ImageProcessing::downsample(pixels.data(), width, height, out);
+            ImageProcessing::downsampleScalar(pixels.data(), width, height, reference);
+            if (out.pixels != reference.pixels) {
+                printf("mips: %dx%d\n", width, height);
+                check(false, "SSE2 and scalar differ");
+            }
+        }
+    }
+    return ok;
+}
+
+static bool testInput() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("input: %s\n", what);
+        ok = ok && condition;
+    };
+    auto pushed = [](float lookX, bool forward, bool fire) {
+        InputFrame f;
+        f.lookX = lookX;
+        f.forward = forward;
+        f.fire = fire;
+        return f;
+    };
+
+    // Frames pushed between two ticks: look summed, newest keys, a click in any of them kept
+    QueuedInput queued;
+    queued.push(pushed(3.0f, true, true));
+    queued.push(pushed(-1.0f, true, false));
+    queued.push(pushed(2.5f, false, false));
+    InputFrame tick = queued.sample();
+    check(tick.lookX == 4.5f && !tick.forward && tick.fire, "frames merged into one tick");
+
+    // A tick with no new frame keeps the held keys but does not turn again or fire a released click again
+    queued.push(pushed(1.0f, true, false));
+    queued.sample();
+    tick = queued.sample();
+    check(tick.lookX == 0.0f && tick.forward && !tick.fire, "held keys without look or a click repeated");
+    queued.push(pushed(0.0f, true, true));
+    queued.sample();
+    check(queued.sample().fire, "fire held down stays on");
+
+    // Pushed from one thread and taken from another, no look movement is lost or counted twice
+    QueuedInput shared;
+    const int frames = 20000;
+    atomic<bool> done = false;
+    double taken = 0.0;
+    thread ticks([&]() {
+        while (!done) taken += shared.sample().lookX;
+        taken += shared.sample().lookX;
+    });
+    for (int i = 0; i < frames; i++) shared.push(pushed(1.0f, false, false));
+    done = true;
+    ticks.join();
+    check(taken == frames, "look movement lost or repeated across threads");
+    return ok;
+}
+
+static bool testInterpolate() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("interpolate: %s\n", what);
+        ok = ok && condition;
+    };
+    auto near = [](const Vec3& a, const Vec3& b) { Vec3 d = a - b; return fabsf(d.x) + fabsf(d.y) + fabsf(d.z) < 1e-4f; };
+
+    // Enemy 1 was swapped out of row 1 by enemy 3 and enemy 4 spawned into row 3 in the same tick
+    SimulationSnapshot prev, cur;
+    prev.tick = 10;
+    prev.enemyIds = { 0, 1, 2, 3 };
+    prev.enemyPositions = { Vec3(0, 0, 0), Vec3(10, 0, 0), Vec3(20, 0, 0), Vec3(30, 0, 0) };
+    cur.tick = 11;
+    cur.enemyIds = { 0, 3, 2, 4 };
+    cur.enemyPositions = { Vec3(0, 0, 2), Vec3(30, 0, 2), Vec3(20, 0, 2), Vec3(40, 0, 0) };
+    prev.enemyRotationsY.assign(4, 0.0f);
+    cur.enemyRotationsY.assign(4, 1.0f);
+    prev.enemyScales.assign(4, Vec3(1, 1, 1));
+    cur.enemyScales.assign(4, Vec3(1, 1, 1));
+
+    // Bullets go back one step per tick between the snapshots, however far apart they were published
+    cur.bulletPositions = { Vec3(5, 1, 0) };
+    cur.bulletVelocities = { Vec3(60, 0, 0) };
+    cur.time = prev.time + chrono::milliseconds(100);
+
+    Simulation sim;
+    RenderState out;
+    sim.interpolate(prev, cur, 0.5f, out);
+    check(near(out.enemyWorlds[0].mulPoint(Vec3(0, 0, 0)), Vec3(0, 0, 1)), "enemy in an unmoved row blended with itself");
+    check(near(out.enemyWorlds[1].mulPoint(Vec3(0, 0, 0)), Vec3(30, 0, 1)), "enemy moved into a removed row blended with its old row");
+    check(near(out.enemyWorlds[3].mulPoint(Vec3(0, 0, 0)), Vec3(40, 0, 0)), "spawned enemy drawn where it is");
+    check(near(out.bulletPositions[0], Vec3(5.0f - 60.0f * 0.5f * sim.step, 1, 0)), "bullet stepped back by half a tick");
+
+    prev.tick = 11;
+    sim.interpolate(prev, cur, 0.0f, out);
+    check(near(out.bulletPositions[0], Vec3(5, 1, 0)), "bullet left alone between snapshots of the same tick");
+    return ok;
+}
+
+// Bytes per level of a BC1 texture of size x size
+static vector<size_t> bc1Levels(int size) {
+    vector<size_t> levels;
+    for (int s = size; ; s = max(s / 2, 1)) {
+        size_t blocks = (size_t)((s + 3) / 4) * ((s + 3) / 4);
+        levels.push_back(blocks * 8);
+        if (s == 1) break;
+    }
+    return levels;
+}
+
+static size_t bytesFrom(const vector<size_t>& levels, int mip) {
+    size_t total = 0;
+    for (int i = mip; i < (int)levels.size(); i++) total += levels[i];
+    return total;
+}
+
+static bool testResidency() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("residency: %s\n", what);
+        ok = ok && condition;
+    };
+
+    check(TextureResidency::mipForScreenSize(1024, 1024, 2000.0f) == 0, "mip 0 when the texture is smaller than the screen size");
+    check(TextureResidency::mipForScreenSize(1024, 1024, 512.0f) == 1, "mip 1 at half size");
+    check(TextureResidency::mipForScreenSize(1024, 512, 100.0f) == 3, "mip follows the larger side");
+    check(TextureResidency::mipForScreenSize(1024, 1024, 0.0f) == 10, "nothing on screen wants 1x1");
+    check(TextureResidency::tailMipFor(1024, 1024, 11, 64, true) == 4, "tail starts at 64x64");
+    check(TextureResidency::tailMipFor(32, 32, 6, 64, true) == 0, "small textures are all tail");
+    check(TextureResidency::tailMipFor(1000, 1000, 10, 64, true) == 1, "block compressed tail stays a multiple of 4");
+    float near = TextureResidency::screenSize(1.0f, 10.0f, 1.732f, 1024.0f);
+    float far = TextureResidency::screenSize(1.0f, 20.0f, 1.732f, 1024.0f);
+    check(fabsf(near - 2.0f * far) < 0.01f, "screen size halves with twice the distance");
+
+    vector<size_t> levels = bc1Levels(1024);
+    size_t tail = bytesFrom(levels, 4);
+    vector<TextureMipChange> loads, evictions;
+
+    // Plenty of budget: everything reaches what it asked for, one level per texture per update at most 4 a frame
+    {
+        TextureResidency r;
+        r.init(64 << 20, 4);
+        for (int i = 0; i < 4; i++) r.add(levels, 4);
+        check(r.stats().residentBytes == tail * 4, "tails are resident from the start");
+        for (unsigned int frame = 0; frame < 8; frame++) {
+            for (int i = 0; i < 4; i++) r.request(i, i, frame);
+            r.update(frame, loads, evictions);
+            check((int)loads.size() <= 4, "loads per update are capped");
+            check(evictions.empty(), "nothing is evicted under budget");
+        }
+        for (int i = 0; i < 4; i++) check(r.residentMip(i) == i, "resident mip reaches the requested mip");
+    }
+
+    // Tight budget: never over it once tails fit, least recently used levels go first, tails never go
+    {
+        TextureResidency r;
+        size_t budget = tail * 3 + bytesFrom(levels, 1) - tail + levels[1] / 2;
+        r.init(budget, 8);
+        for (int i = 0; i < 3; i++) r.add(levels, 4);
+        unsigned int frame = 0;
+        for (; frame < 10; frame++) {
+            r.request(0, 1, frame);
+            r.update(frame, loads, evictions);
+        }
+        check(r.residentMip(0) == 1, "texture 0 streams in to mip 1");
+        for (; frame < 20; frame++) {
+            r.request(1, 1, frame);
+            r.update(frame, loads, evictions);
+            check(r.stats().residentBytes <= budget, "resident bytes stay within budget");
+        }
+        check(r.residentMip(1) == 1, "texture 1 takes the room texture 0 no longer uses");
+        check(r.residentMip(0) > 1, "the least recently used texture was evicted");
+        check(r.residentMip(2) == 4, "unrequested textures keep only their tail");
+        for (; frame < 30; frame++) {
+            r.request(0, 0, frame);
+            r.request(1, 0, frame);
+            r.request(2, 0, frame);
+            r.update(frame, loads, evictions);
+            check(r.stats().residentBytes <= budget, "demand over budget still stays within it");
+            for (int i = 0; i < 3; i++) check(r.residentMip(i) <= r.tailMip(i), "tails are never evicted");
+        }
+        check(r.stats().starvedLoads > 0, "demand over budget is reported");
+    }
+
+    // Lowering the budget drops the least recently used levels at the next update
+    {
+        TextureResidency r;
+        r.init(64 << 20, 16);
+        r.add(levels, 4);
+        r.add(levels, 4);
+        for (unsigned int frame = 0; frame < 5; frame++) {
+            r.request(0, 0, frame);
+            r.request(1, 0, frame);
+            r.update(frame, loads, evictions);
+        }
+        r.request(1, 0, 5);
+        r.update(5, loads, evictions);
+        r.setBudget(bytesFrom(levels, 0) + tail);
+        r.request(1, 0, 6);
+        r.update(6, loads, evictions);
+        check(r.residentMip(0) == 4 && r.residentMip(1) == 0, "a lower budget evicts the unused texture down to its tail");
+    }
+
+    // 800x800 BC1 with a tail of 12x12 (mip 6): mips 4 and 5 (50 and 25 texels) cannot be the largest level of a
+    // block compressed texture, so they come and go with mip 3 and the texture never starts at them
+    {
+        vector<size_t> npot = bc1Levels(800);
+        int npotTail = TextureResidency::tailMipFor(800, 800, (int)npot.size(), 8, true);
+        check(npotTail == 6, "tail of 800x800 rounds up to 12x12");
+        TextureResidency r;
+        r.init(64 << 20, 4);
+        r.add(npot, npotTail, 800, 800, true);
+        bool aligned = true;
+        unsigned int frame = 0;
+        for (; frame < 4; frame++) {
+            r.request(0, 5, frame);
+            r.update(frame, loads, evictions);
+            aligned = aligned && TextureResidency::isBlockAligned(800, 800, r.residentMip(0));
+        }
+        check(r.residentMip(0) == 3, "a request for mip 5 loads up to mip 3");
+        check(r.stats().residentBytes == bytesFrom(npot, 3), "the skipped levels are counted");
+        r.setBudget(bytesFrom(npot, 3) - 1);
+        for (; frame < 8; frame++) {
+            r.update(frame, loads, evictions);
+            aligned = aligned && TextureResidency::isBlockAligned(800, 800, r.residentMip(0));
+        }
+        check(r.residentMip(0) == 6, "evicting mip 3 drops mips 4 and 5 with it");
+        check(aligned, "the largest resident level is always a multiple of 4");
+    }
+    return ok;
+}
+
+struct StreamObject {
+    float x, z;
+    int texture;
+    int size;
+};
+
+// A camera flying a loop through a field of objects, each with its own texture, requesting mips by on screen size
+// the same way Game.cpp does. Reports the update cost, how much of the demand was met and what moved.
+static int streamBench(int objects, int frames, int budgetMB, int loadsPerFrame) {
+    // Objects of radius 2 scattered over a 400x400 area with 512 to 2048 textures
+    TextureResidency residency;
+    residency.init((size_t)budgetMB << 20, loadsPerFrame);
+    vector<StreamObject> field(objects);
+    unsigned int seed = 1;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    size_t fullBytes = 0;
+    for (StreamObject& o : field) {
+        o.x = random() * 400.0f - 200.0f;
+        o.z = random() * 400.0f - 200.0f;
+        o.size = 512 << (int)(random() * 3.0f);
+        vector<size_t> levels = bc1Levels(o.size);
+        fullBytes += bytesFrom(levels, 0);
+        o.texture = residency.add(levels, TextureResidency::tailMipFor(o.size, o.size, (int)levels.size(), 64, true), o.size, o.size, true);
+    }
+
+    // Same projection as Game.cpp: 60 degree fov, 1024 high
+    float projectionScaleY = 1.0f / tanf(30.0f * 3.14159265f / 180.0f);
+    float viewportHeight = 1024.0f;
+    vector<TextureMipChange> loads, evictions;
+    double totalMs = 0.0, worstMs = 0.0;
+    long long requests = 0, met = 0, levelsShort = 0;
+    size_t peakResident = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        float angle = frame * 0.002f;
+        float eyeX = cosf(angle) * 150.0f, eyeZ = sinf(angle * 1.7f) * 150.0f;
+        float forwardX = -sinf(angle), forwardZ = 1.7f * cosf(angle * 1.7f);
+
+        auto start = chrono::steady_clock::now();
+        for (const StreamObject& o : field) {
+            float dx = o.x - eyeX, dz = o.z - eyeZ;
+            if (dx * forwardX + dz * forwardZ < 0.0f) continue; // Behind the camera
+            float distance = sqrtf(dx * dx + dz * dz);
+            float pixels = TextureResidency::screenSize(2.0f, distance, projectionScaleY, viewportHeight);
+            if (pixels < 2.0f) continue;
+            residency.request(o.texture, TextureResidency::mipForScreenSize(o.size, o.size, pixels), frame);
+        }
+        residency.update(frame, loads, evictions);
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        totalMs += elapsed.count();
+        worstMs = max(worstMs, elapsed.count());
+
+        for (const StreamObject& o : field) {
+            int wanted = residency.wantedMip(o.texture);
+            if (wanted == residency.tailMip(o.texture)) continue;
+            requests++;
+            int shortBy = residency.residentMip(o.texture) - wanted;
+            if (shortBy <= 0) met++;
+            else levelsShort += shortBy;
+        }
+        peakResident = max(peakResident, residency.stats().residentBytes);
+    }
+
+    TextureResidencyStats s = residency.stats();
+    printf("%d objects, %.1f MB of textures at full size, budget %d MB\n", objects, fullBytes / 1048576.0, budgetMB);
+    printf("%d frames: update %.3f ms mean, %.3f ms worst\n", frames, totalMs / frames, worstMs);
+    printf("demand met %.1f%% of the time, %.2f levels short on average otherwise\n",
+        requests ? 100.0 * met / requests : 100.0, requests > met ? (double)levelsShort / (requests - met) : 0.0);
+    printf("resident %.1f MB, peak %.1f MB, %d loads, %d evictions, %d over budget\n",
+        s.residentBytes / 1048576.0, peakResident / 1048576.0, s.loads, s.evictions, s.starvedLoads);
+    bool withinBudget = peakResident <= ((size_t)budgetMB << 20);
+    if (!withinBudget) printf("FAILED: over budget\n");
+    return withinBudget ? 0 : 1;
+}
+
+static bool testDraws() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("draws: %s\n", what);
+        ok = ok && condition;
+    };
+    typedef RecordingDrawBackend R;
+    void* pipelineA = (void*)0x100;
+    void* pipelineB = (void*)0x200;
+    VertexBufferBinding vb = { 0x1000, 64, 32 };
+    IndexBufferBinding ib = { 0x2000, 12, 42 };
+    auto draw = [&](DrawStream& stream, int pass, void* pipeline, unsigned long long table, float distance, unsigned int indexCount) {
+        stream.setPass(pass);
+        stream.setPipeline(pipeline);
+        stream.setRootCBV(0, 0x3000);
+        stream.setDescriptorTable(table);
+        stream.setObjectPosition(0.0f, 0.0f, distance);
+        stream.drawIndexed(vb, ib, indexCount);
+    };
+
+    // Pass, then pipeline and table in the order first seen, then front to back, equal keys as recorded.
+    // The index count tells the draws apart.
+    DrawStream stream;
+    stream.beginFrame();
+    draw(stream, 1, pipelineA, 0x10, 1.0f, 1);
+    draw(stream, 0, pipelineB, 0x20, 50.0f, 2);
+    draw(stream, 0, pipelineA, 0x20, 50.0f, 3);
+    draw(stream, 0, pipelineA, 0x10, 90.0f, 4);
+    draw(stream, 0, pipelineA, 0x10, 10.0f, 5);
+    draw(stream, 0, pipelineA, 0x10, 10.0f, 6);
+    stream.sort();
+    unsigned int expected[] = { 5, 6, 4, 3, 2, 1 };
+    bool sorted = true;
+    for (int i = 0; i < 6; i++) sorted = sorted && stream.packets[i].indexCount == expected[i];
+    check(sorted, "sorted by pass, pipeline, table, then depth, stable for equal keys");
+
+    // Whole stream on one list: only what changes between neighbours is set again
+    R whole;
+    stream.submit(&whole);
+    check(whole.counts[R::DrawIndexed] == 6, "every packet drawn");
+    check(whole.counts[R::SetPipeline] == 3, "pipeline set only when it changes");
+    check(whole.counts[R::SetRootCBV] == 1 && stream.stats.cbvSkipped == 5, "same root CBV set once");
+    check(whole.counts[R::SetDescriptorTable] == 3, "table set only when it changes");
+    check(whole.counts[R::SetVertexBuffer] == 1 && whole.counts[R::SetIndexBuffer] == 1, "same buffers set once");
+    check(stream.stats.draws == 6 && stream.stats.pipelineSkipped == 3 && stream.stats.tableSkipped == 3 && stream.stats.bufferSkipped == 10,
+        "skipped changes counted");
+    check(whole.commands[0].type == R::SetPipeline && whole.commands.back().type == R::DrawIndexed && whole.commands.back().value == 1,
+        "state set before the draw that needs it");
+
+    // Split ranges on fresh lists: each range binds everything it needs, and the draws come out in the same order
+    vector<pair<int, int>> ranges = stream.split(3, 2);
+    check(ranges.size() == 3 && ranges[0].first == 0 && ranges[2].second == 6, "split covers every packet");
+    vector<unsigned long long> draws;
+    DrawStats rangeStats;
+    for (const pair<int, int>& range : ranges) {
+        R list;
+        BoundDrawState state;
+        stream.submitRange(&list, range.first, range.second, state, rangeStats);
+        check(list.commands[0].type == R::SetPipeline && list.counts[R::SetVertexBuffer] == 1 && list.counts[R::SetIndexBuffer] == 1
+            && list.counts[R::SetRootCBV] == 1, "range starts with its own state");
+        for (const R::Command& c : list.commands) {
+            if (c.type == R::DrawIndexed) draws.push_back(c.value);
+        }
+    }
+    check(draws == vector<unsigned long long>(begin(expected), end(expected)), "ranges draw what the whole stream draws");
+
+    // Pipeline ids start again each frame: after a frame with enough pipelines to fill the key, the next frame's
+    // first pipeline still sorts before its second
+    for (int i = 0; i < 0xFFFF; i++) draw(stream, 0, (void*)(uintptr_t)(0x10000 + i), 0x10, 1.0f, 1);
+    stream.beginFrame();
+    draw(stream, 0, pipelineB, 0x10, 1.0f, 1);
+    draw(stream, 0, pipelineA, 0x10, 1.0f, 2);
+    stream.sort();
+    check(stream.packets[0].indexCount == 1, "pipeline ids reset between frames");
+    return ok;
+}
+
+static bool testProfiler() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("profiler: %s\n", what);
+        ok = ok && condition;
+    };
+
+    // Readers keep off the slot the owner writes next, which once the ring has wrapped is the one at head - capacity
+    const unsigned int capacity = ProfileThreadBuffer::capacity;
+    check(ProfileThreadBuffer::oldest(5) == 0, "everything readable before the ring wraps");
+    check(ProfileThreadBuffer::oldest(capacity) == 1 && ProfileThreadBuffer::oldest(capacity + 10) == 11, "next slot skipped once wrapped");
+
+    // An event copied out is only kept while the owner has not come round to its slot
+    unique_ptr<ProfileThreadBuffer> buffer = make_unique<ProfileThreadBuffer>();
+    const char* names[] = { "first", "second" };
+    buffer->events[3] = { names[0], 1, 2 };
+    buffer->head = 3 + capacity - 1;
+    ProfileEvent e;
+    check(buffer->copy(3, e) && e.name == names[0], "oldest readable event kept");
+    buffer->head = 3 + capacity;
+    buffer->events[3] = { names[1], 3, 4 };
+    check(!buffer->copy(3, e), "event dropped once the owner may be rewriting it");
+
+    // Scopes from another thread, folded into stats and dumped while it keeps writing, only ever name real scopes
+    atomic<bool> stop = false;
+    thread writer([&stop]() {
+        while (!stop) {
+            PROFILE_SCOPE("profiler test a");
+            PROFILE_SCOPE("profiler test b");
+        }
+    });
+    string tracePath = "profiler_test.json";
+    for (int i = 0; i < 20; i++) {
+        Profiler::get().endFrame();
+        Profiler::get().writeChromeTrace(tracePath);
+    }
+    stop = true;
+    writer.join();
+    for (const auto& kv : Profiler::get().getAllStats()) {
+        if (kv.first.rfind("profiler test", 0) == 0) check(kv.first == "profiler test a" || kv.first == "profiler test b", "torn scope name");
+    }
+    check(Profiler::get().getStats("profiler test a").count > 0, "writer's scopes recorded");
+    filesystem::remove(tracePath);
+    return ok;
+}
+
+static bool testGpuProfiler() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("gpuprofiler: %s\n", what);
+        ok = ok && condition;
+    };
+    auto stats = [](const char* name) { return Profiler::get().getStats(name); };
+
+    // Two frames in flight, room for two ranges a frame. Each timestamp moves the mock clock on by 1000 ns.
+    MockTimerBackend timer;
+    timer.init(2, 4);
+    GpuProfiler profiler;
+    profiler.init(&timer, 2, 4);
+
+    profiler.beginFrame(0);
+    check(profiler.begin("Test off") == -1, "scopes do nothing until enabled");
+    profiler.enabled = true;
+    {
+        GpuProfileScope outer(&profiler, "Test outer");
+        {
+            GpuProfileScope inner(&profiler, "Test inner");
+            check(profiler.begin("Test spare") == -1, "scope past the frame's query slots is dropped");
+        }
+    }
+    profiler.endFrame();
+    check(stats("GPU Test outer").count == 0, "nothing read back in the frame it was recorded");
+
+    // Frame 1 uses the other slot, frame 0's results are still in flight
+    profiler.beginFrame(1);
+    check(stats("GPU Test outer").count == 0, "nothing read back from another frame's slot");
+    {
+        GpuProfileScope outer(&profiler, "Test outer");
+    }
+    profiler.endFrame();
+
+    // Frame 0's slot comes round again: its outer range spans the inner one's two timestamps
+    profiler.beginFrame(0);
+    ProfileStats outer = stats("GPU Test outer"), inner = stats("GPU Test inner");
+    check(outer.count == 1 && fabsf(outer.last - 0.003f) < 1e-6f, "outer scope timed around the nested one");
+    check(inner.count == 1 && fabsf(inner.last - 0.001f) < 1e-6f, "nested scope timed between its own timestamps");
+    check(stats("GPU Test off").count == 0 && stats("GPU Test spare").count == 0, "dropped scopes not recorded");
+    profiler.endFrame();
+
+    profiler.beginFrame(1);
+    check(stats("GPU Test outer").count == 2 && fabsf(stats("GPU Test outer").last - 0.001f) < 1e-6f, "frame 1 read back a frame later");
+    return ok;
+}
+
+// A chain of bones where every clip holds each bone at (x, 0, 0) from its parent, turning about y by spin radians a
+// frame, for tests and benchmarks
+static void addTestClip(Animation& animation, const string& name, float x, int frameCount, Vec3 firstScale = Vec3(1, 1, 1), float spin = 0.0f) {
+    AnimationSequence seq;
+    seq.ticksPerSecond = 30.0f;
+    for (int f = 0; f < frameCount; f++) {
+        AnimationFrame frame;
+        for (int b = 0; b < animation.bonesSize(); b++) {
+            float half = 0.5f * spin * (f + b);
+            frame.positions.push_back(Vec3(x, 0, 0));
+            frame.rotations.push_back(Quaternion(0, sinf(half), 0, cosf(half)));
+            frame.scales.push_back(f == 0 ? firstScale : Vec3(1, 1, 1));
+        }
+        seq.frames.push_back(frame);
+    }
+    animation.animations[name] = seq;
+}
+
+static void makeTestSkeleton(Animation& animation, int bones) {
+    animation.skeleton.bones.clear();
+    for (int b = 0; b < bones; b++) {
+        animation.skeleton.bones.push_back({ "bone" + to_string(b), Matrix(), b - 1 });
+    }
+}
+
+static bool testAnimation() {
+    bool ok = true;
+    auto check = [&ok](bool condition, const char* what) {
+        if (!condition) printf("animation: %s\n", what);
+        ok = ok && condition;
+    };
+    Animation animation;
+    makeTestSkeleton(animation, 2);
+    addTestClip(animation, "a", 0.0f, 30);
+    addTestClip(animation, "b", 10.0f, 30);
+    addTestClip(animation, "c", 20.0f, 30);
+    addTestClip(animation, "zero", 0.0f, 30, Vec3(0, 0, 0));
+    AnimationInstance instance;
+    instance.init(&animation, 0);
+    auto rootX = [&instance]() { return instance.matricesPose[0].mulPoint(Vec3(0, 0, 0)).x; };
+
+    instance.update("a", 0.0f);
+    instance.crossFade("b", 1.0f);
+    instance.update("b", 0.5f);
+    check(fabsf(rootX() - 5.0f) < 1e-3f, "halfway through a fade");
+
+    // Interrupted halfway from a to b, a fade to c starts where the blend was and not at b
+    instance.crossFade("c", 1.0f);
+    instance.update("c", 0.0f);
+    check(fabsf(rootX() - 5.0f) < 1e-3f, "no jump when a fade is interrupted");
+    instance.update("c", 0.5f);
+    check(fabsf(rootX() - 12.5f) < 1e-3f, "interrupted pose faded out towards the new clip");
+    instance.update("c", 0.6f);
+    check(fabsf(rootX() - 20.0f) < 1e-3f && !instance.isBlending(), "fade finishes on the new clip");
+
+    // An additive clip whose first frame scales to zero adds no scale rather than dividing by it
+    instance.addLayer("zero", 1.0f, true);
+    instance.update("c", 0.5f);
+    bool finite = true;
+    for (int b = 0; b < animation.bonesSize(); b++) {
+        for (float v : instance.matricesPose[b].m) finite = finite && isfinite(v);
+    }
+    check(finite, "zero scale reference gives a finite pose");
+    return ok;
+}
+
+// AnimationInstance::update for one clip against a cross-fade between two. The fade blends local poses and walks the
+// hierarchy once, so it should cost well under twice the single clip.
+static int animBench(int instances) {
+    const int bones = 60, frames = 600;
+    Animation animation;
+    makeTestSkeleton(animation, bones);
+    addTestClip(animation, "walk", 1.0f, 30, Vec3(1, 1, 1), 0.05f);
+    addTestClip(animation, "run", 2.0f, 20, Vec3(1, 1, 1), 0.08f);
+    vector<AnimationInstance> anims(instances);
+    auto run = [&](bool fade) {
+        for (AnimationInstance& anim : anims) {
+            anim.init(&animation, 0);
+            anim.update("walk", 0.0f);
+            // Long enough that every update below blends both clips
+            if (fade) anim.crossFade("run", 1000.0f);
+        }
+        return bestOf(3, [&]() {
+            for (int f = 0; f < frames; f++) {
+                for (AnimationInstance& anim : anims) anim.update(anim.usingAnimation, 1.0f / 60.0f);
+            }
+        });
+    };
+    double singleMs = run(false);
+    double fadeMs = run(true);
+    double updates = (double)instances * frames;
+    printf("%d instances of %d bones, %d updates each\n", instances, bones, frames);
+    printf("one clip %.2f us per update, cross-fade %.2f us per update, %.2fx\n", singleMs * 1000.0 / updates, fadeMs * 1000.0 / updates,
+        fadeMs / singleMs);
+    return 0;
+}
+
+// The maths.h kernels at the MATHS_SIMD_LEVEL this was built with, against the scalar code they replace, over count
+// random affine matrices, points and rotations. Build with -DMATHS_NO_SIMD or -mavx for the other levels.
+static int mathBench(int count) {
+    unsigned int seed = 1;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f * 2.0f - 1.0f; };
+    vector<Matrix> a(count), b(count), out(count), reference(count);
+    vector<Vec3> points(count), moved(count), movedReference(count);
+    vector<Quaternion> quats(count);
+    for (int i = 0; i < count; i++) {
+        Quaternion q(random(), random(), random(), random() + 2.0f);
+        q.Normalize();
+        quats[i] = q;
+        Quaternion q2(random(), random(), random(), random() + 2.0f);
+        q2.Normalize();
+        a[i] = Matrix::scaling3D(Vec3(1.0f + random() * 0.5f, 1.0f, 1.0f)) * q.toMatrix() * Matrix::translation3D(Vec3(random(), random(), random()) * 100.0f);
+        b[i] = q2.toMatrix() * Matrix::translation3D(Vec3(random(), random(), random()) * 10.0f);
+        points[i] = Vec3(random(), random(), random()) * 50.0f;
+    }
+    const int runs = 5;
+    auto largestDifference = [](const float* x, const float* y, size_t floats) {
+        float largest = 0.0f;
+        for (size_t i = 0; i < floats; i++) largest = max(largest, fabsf(x[i] - y[i]) / max(1.0f, fabsf(y[i])));
+        return largest;
+    };
+    auto report = [count](const char* kernel, double fastMs, const char* replaced, double scalarMs, float difference) {
+        printf("%-16s %6.2f ns, %-21s %6.2f ns, %5.2fx, largest relative difference %.2g\n", kernel, fastMs * 1e6 / count, replaced,
+            scalarMs * 1e6 / count, scalarMs / fastMs, difference);
+    };
+    printf("MATHS_SIMD_LEVEL %d, %d of each, ns per item\n", MATHS_SIMD_LEVEL, count);
+
+    double fastMs, scalarMs;
+#if MATHS_SIMD_LEVEL > 0
+    // multiply stays scalar until this beats it
+    fastMs = bestOf(runs, [&]() { for (int i = 0; i < count; i++) out[i] = a[i].multiplySIMD(b[i]); });
+    scalarMs = bestOf(runs, [&]() { for (int i = 0; i < count; i++) reference[i] = a[i].multiply(b[i]); });
+    report("multiplySIMD", fastMs, "multiply", scalarMs, largestDifference(out[0].m, reference[0].m, (size_t)count * 16));
+#endif
+
+    fastMs = bestOf(runs, [&]() { for (int i = 0; i < count; i++) out[i] = a[i].invertAffine(); });
+    scalarMs = bestOf(runs, [&]() { for (int i = 0; i < count; i++) reference[i] = a[i].invert(); });
+    report("invertAffine", fastMs, "invert", scalarMs, largestDifference(out[0].m, reference[0].m, (size_t)count * 16));
+
+    fastMs = bestOf(runs, [&]() { for (int i = 0; i + 1024 <= count; i += 1024) Matrix::transformPoints(a[i], &points[i], &moved[i], 1024); });
+    scalarMs = bestOf(runs, [&]() { for (int i = 0; i + 1024 <= count; i += 1024) for (int j = i; j < i + 1024; j++) movedReference[j] = a[i].mulPoint(points[j]); });
+    report("transformPoints", fastMs, "mulPoint", scalarMs, largestDifference(&moved[0].x, &movedReference[0].x, (size_t)(count / 1024 * 1024) * 3));
+
+    fastMs = bestOf(runs, [&]() { Quaternion::toMatrices(quats.data(), out.data(), count); });
+    scalarMs = bestOf(runs, [&]() { for (int i = 0; i < count; i++) reference[i] = quats[i].toMatrix(); });
+    report("toMatrices", fastMs, "Quaternion::toMatrix", scalarMs, largestDifference(out[0].m, reference[0].m, (size_t)count * 16));
+    return 0;
+}
+
+// Enemies as they were stored before EnemyManager split them into component arrays: one struct each, animation state
+// and all, so a pass that only wants the collider and the dead flag still strides over the whole of it
+struct EnemyAoS {
+    Vec3 position;
+    Vec3 rotation;
+    Vec3 scale;
+    Matrix transform;
+    AnimationInstance anim;
+    AABB collider;
+    float health = 100.0f;
+    bool isDead = false;
+};
+
+// A tick of enemy and bullet updates over count enemies, EnemyManager and BulletManager against the same work on
+// EnemyAoS. Bullets fly clear of every enemy so each one tests all of their colliders.
+static int ecsBench(int count) {
+    const int bulletCount = 200, ticks = 120;
+    const float step = 1.0f / 60.0f;
+    Animation animation;
+    makeTestSkeleton(animation, 30);
+    addTestClip(animation, "idle", 0.0f, 30, Vec3(1, 1, 1), 0.05f);
+    Vec3 playerPosition(0.0f, 0.0f, -10.0f);
+    auto enemyPosition = [](int i) { return Vec3((float)(i % 100) * 3.0f, 0.0f, (float)(i / 100) * 3.0f + 10.0f); };
+    vector<AABB> walls;
+
+    EnemyManager enemies;
+    enemies.init(&animation);
+    for (int i = 0; i < count; i++) enemies.spawnEnemy(enemyPosition(i), Vec3(1, 1, 1));
+    BulletManager bullets;
+    auto spawnBullets = [&]() { for (int i = 0; i < bulletCount; i++) bullets.spawnBullet(Vec3((float)i, 100.0f, 0.0f), Vec3(0, 1, 0)); };
+
+    vector<EnemyAoS> aos(count);
+    TransformBatch aosTransforms;
+    for (int i = 0; i < count; i++) {
+        EnemyAoS& e = aos[i];
+        e.position = enemyPosition(i);
+        e.scale = Vec3(1, 1, 1);
+        e.anim.init(&animation, 0);
+        e.anim.usingAnimation = "idle";
+        aosTransforms.add(e.position, 0.0f, e.scale);
+    }
+    vector<BulletComponent> aosBullets(bulletCount);
+
+    // Times the whole tick and, on their own, the bullet passes that only read colliders and dead flags
+    auto run = [&](auto tick, auto collide) {
+        double tickMs = bestOf(3, [&]() { for (int t = 0; t < ticks; t++) tick(); }) / ticks;
+        double collideMs = bestOf(3, [&]() { for (int t = 0; t < ticks; t++) collide(); }) / ticks;
+        return make_pair(tickMs, collideMs);
+    };
+    pair<double, double> soa = run(
+        [&]() {
+            enemies.update(step, playerPosition);
+            spawnBullets();
+            bullets.update(step, enemies, walls);
+            bullets = BulletManager();
+        },
+        [&]() {
+            spawnBullets();
+            bullets.update(step, enemies, walls);
+            bullets = BulletManager();
+        });
+    auto aosCollide = [&]() {
+        for (int b = 0; b < bulletCount; b++) {
+            BulletComponent& bullet = aosBullets[b];
+            bullet.position = Vec3((float)b, 100.0f, 0.0f) + Vec3(0, 1, 0) * bullet.speed * step;
+            AABB collider(bullet.position - Vec3(0.05f, 0.05f, 0.05f), bullet.position + Vec3(0.05f, 0.05f, 0.05f));
+            for (EnemyAoS& e : aos) {
+                if (e.isDead) continue;
+                if (AABB::check(collider, e.collider)) {
+                    e.isDead = true;
+                    break;
+                }
+            }
+        }
+    };
+    pair<double, double> aosTimes = run(
+        [&]() {
+            for (int i = 0; i < count; i++) {
+                EnemyAoS& e = aos[i];
+                if (e.isDead) continue;
+                e.anim.update("idle", step);
+                Vec3 dir = playerPosition - e.position;
+                e.rotation.y = atan2f(dir.x, dir.z) + 3.14159f + 0.5f;
+                aosTransforms.positions[i] = e.position;
+                aosTransforms.rotationsY[i] = e.rotation.y;
+                aosTransforms.scales[i] = e.scale;
+            }
+            aosTransforms.update();
+            for (int index : aosTransforms.changed) {
+                aos[index].transform = aosTransforms.worlds[index];
+                aos[index].collider = EnemyManager::makeCollider(aos[index].position);
+            }
+            aosCollide();
+        },
+        aosCollide);
+
+    // Cache lines each bullet's pass over the enemies reads: the one or two lines of every struct holding the collider and
+    // the dead flag, a struct apart, against two dense arrays
+    size_t aosLines = (offsetof(EnemyAoS, isDead) / 64) - (offsetof(EnemyAoS, collider) / 64) + 1;
+    double aosScanKB = (double)count * aosLines * 64 / 1024.0;
+    double soaScanKB = (double)count * (sizeof(AABB) + sizeof(HealthComponent)) / 1024.0;
+    printf("%d enemies, %d bullets a tick\n", count, bulletCount);
+    printf("per component: tick %.3f ms, bullet collision %.3f ms, %.0f KB read per scan of the enemies\n", soa.first, soa.second, soaScanKB);
+    printf("one struct each: tick %.3f ms, bullet collision %.3f ms, %.0f KB read per scan of the enemies, %zu bytes apart\n", aosTimes.first,
+        aosTimes.second, aosScanKB, sizeof(EnemyAoS));
+    printf("tick %.2fx, bullet collision %.2fx faster per component\n", aosTimes.first / soa.first, aosTimes.second / soa.second);
+    return 0;
+}
+
+static int runTests(const string& name) {
+    struct Test {
+        const char* name;
+        bool (*run)();
+    };
+    Test tests[] = {
+        { "jobs", testJobs },
+        { "descriptors", testDescriptors },
+        { "constants", testConstants },
+        { "mips", testMips },
+        { "input", testInput },
+        { "interpolate", testInterpolate },
+        { "draws", testDraws },
+        { "profiler", testProfiler },
+        { "gpuprofiler", testGpuProfiler },
+        { "animation", testAnimation },
+        { "residency", testResidency },
+    };
+    int failed = 0, matched = 0;
+    for (const Test& test : tests) {
+        if (name != "all" && name != test.name) continue;
+        matched++;
+        bool ok = test.run();
+        printf("%-12s %s\n", test.name, ok ? "ok" : "FAILED");
+        if (!ok) failed++;
+    }
+    if (matched == 0) printf("No test called %s\n", name.c_str());
+    return failed == 0 && matched > 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    string replayFile;
+    string hashFile;
+    string profileFile;
+    string levelFile = "LevelData.txt";
+    string enemyModel = "Models/Soldier1.gem";
+    string weaponModel = "Models/AutomaticCarbine.gem";
+    int ticks = -1;
+    unsigned int seed = 1;
+    int loadBenchThreads = -1;
+    int levelBenchEntries = 0;
+    int worldBenchEntries = 0;
+    int sceneBenchInstances = 0;
+    int sceneBenchMeshes = 16;
+    int animBenchInstances = 0;
+    int mathBenchCount = 0;
+    int ecsBenchCount = 0;
+    int streamBenchObjects = 0;
+    int streamBenchFrames = 2000;
+    int textureBudgetMB = 256;
+    int textureLoads = 4;
+    string sceneFile;
+    string testName;
+    double levelBudgetMB = 64.0;
+    int loaders = 2;
+    float seconds = 20.0f;
+    float speed = 40.0f;
+    float hitchMs = 1.0f;
+    bool textureCache = true;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string name = argv[i];
+        if (name == "-replay") replayFile = argv[i + 1];
+        else if (name == "-hashes") hashFile = argv[i + 1];
+        else if (name == "-profile") profileFile = argv[i + 1];
+        else if (name == "-level") levelFile = argv[i + 1];
+        else if (name == "-enemy") enemyModel = argv[i + 1];
+        else if (name == "-weapon") weaponModel = argv[i + 1];
+        else if (name == "-ticks") ticks = atoi(argv[i + 1]);
+        else if (name == "-seed") seed = (unsigned int)atoi(argv[i + 1]);
+        else if (name == "-loadbench") loadBenchThreads = atoi(argv[i + 1]);
+        else if (name == "-texturecache") textureCache = atoi(argv[i + 1]) != 0;
+        else if (name == "-levelbench") levelBenchEntries = atoi(argv[i + 1]);
+        else if (name == "-worldbench") worldBenchEntries = atoi(argv[i + 1]);
+        else if (name == "-levelbudget") levelBudgetMB = atof(argv[i + 1]);
+        else if (name == "-seconds") seconds = (float)atof(argv[i + 1]);
+        else if (name == "-speed") speed = (float)atof(argv[i + 1]);
+        else if (name == "-loaders") loaders = atoi(argv[i + 1]);
+        else if (name == "-hitch") hitchMs = (float)atof(argv[i + 1]);
+        else if (name == "-scenebench") sceneBenchInstances = atoi(argv[i + 1]);
+        else if (name == "-meshes") sceneBenchMeshes = max(1, atoi(argv[i + 1]));
+        else if (name == "-scene") sceneFile = argv[i + 1];
+        else if (name == "-test") testName = argv[i + 1];
+        else if (name == "-animbench") animBenchInstances = atoi(argv[i + 1]);
+        else if (name == "-mathbench") mathBenchCount = atoi(argv[i + 1]);
+        else if (name == "-ecsbench") ecsBenchCount = atoi(argv[i + 1]);
+        else if (name == "-streambench") streamBenchObjects = atoi(argv[i + 1]);
+        else if (name == "-frames") streamBenchFrames = atoi(argv[i + 1]);
+        else if (name == "-texturebudget") textureBudgetMB = atoi(argv[i + 1]);
+        else if (name == "-textureloads") textureLoads = atoi(argv[i + 1]);
+    }
+
+    if (worldBenchEntries > 0) {
+        return worldBench(worldBenchEntries, levelBudgetMB, loaders, seconds, speed, hitchMs);
+    }
+
+    if (!testName.empty()) {
+        return runTests(testName);
+    }
+
+    if (animBenchInstances > 0) {
+        return animBench(animBenchInstances);
+    }
+
+    if (mathBenchCount > 0) {
+        return mathBench(mathBenchCount);
+    }
+
+    if (ecsBenchCount > 0) {
+        return ecsBench(ecsBenchCount);
+    }
+
+    if (streamBenchObjects > 0) {
+        return streamBench(streamBenchObjects, streamBenchFrames, textureBudgetMB, textureLoads);
+    }
+
+    if (sceneBenchInstances > 0) {
+        return sceneBench(sceneBenchInstances, sceneBenchMeshes, loaders);
+    }
+
+    if (levelBenchEntries > 0) {
+        return levelBench(levelBenchEntries);
+    }
+
+    if (loadBenchThreads >= 0) {
+        vector<LevelEntry> level;
+        Level::load(levelFile, level);
+        vector<string> trees;
+        for (const LevelEntry& entry : level) {
+            if (entry.type == "TREE" && find(trees.begin(), trees.end(), entry.path) == trees.end())
+                trees.push_back(entry.path);
+        }
+        return loadBench({ enemyModel, weaponModel }, trees, loadBenchThreads, textureCache);
+    }
+
+    srand(seed);
+
+    Animation enemyAnimation;
+    Animation characterAnimation;
+    if (!loadAnimation(enemyModel, enemyAnimation) || !loadAnimation(weaponModel, characterAnimation)) {
+        printf("Could not load the animated models\n");
+        return 1;
+    }
+
+    AnimationInstance characterAnim;
+    Player player;
+    PlayerAnimManager playerAnimMgr;
+    EnemyManager enemyMgr;
+    BulletManager bulletMgr;
+    vector<AABB> obstacles;
+
+    characterAnim.init(&characterAnimation, 0);
+    playerAnimMgr.init(&characterAnim, &bulletMgr);
+    enemyMgr.init(&enemyAnimation);
+    player.init(Vec3(0, 0, -10));
+
+    CookedLevel level;
+    SceneLoader scene;
+    if (!sceneFile.empty()) {
+        if (!scene.load(sceneFile)) {
+            printf("Could not read scene %s\n", sceneFile.c_str());
+            return 1;
+        }
+        AssetLoader assets;
+        assets.init(loaders);
+        loadSceneMeshes(scene, assets);
+        obstacles = scene.colliders;
+    }
+    else {
+        if (!level.load(levelFile)) {
+            printf("Could not open %s\n", levelFile.c_str());
+            return 1;
+        }
+        for (int i = 0; i < level.entryCount; i++) {
+            const CookedLevelEntry& entry = level.entries[i];
+            if (entry.collider != -1)
+                obstacles.push_back(level.colliders[entry.collider]);
+            if (entry.type == LevelEnemy)
+                enemyMgr.spawnEnemy(entry.position, entry.scale);
+        }
+        Level::addBoundary(obstacles, level.boundsMin, level.boundsMax);
+    }
+
+    // With no recording the player stands still, which still exercises enemies and animation
+    Simulation sim;
+    InputReplay input;
+    if (!replayFile.empty()) {
+        if (!input.open(replayFile)) {
+            printf("Could not read input recording %s\n", replayFile.c_str());
+            return 1;
+        }
+        sim.step = input.step;
+    }
+    if (ticks < 0) {
+        ticks = input.frames.empty() ? 600 : (int)input.frames.size();
+    }
+
+    sim.init(&player, &playerAnimMgr, &characterAnim, &enemyMgr, &bulletMgr, &input, &obstacles);
+
+    FILE* hashOut = hashFile.empty() ? nullptr : fopen(hashFile.c_str(), "w");
+
+    shared_ptr<const SimulationSnapshot> prev;
+    shared_ptr<const SimulationSnapshot> cur;
+    unsigned long long runHash = 14695981039346656037ull;
+    double slowestTick = 0.0;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < ticks; i++) {
+        auto tickStart = chrono::steady_clock::now();
+        sim.tickOnce();
+        chrono::duration<double, micro> tickTime = chrono::steady_clock::now() - tickStart;
+        slowestTick = max(slowestTick, tickTime.count());
+
+        sim.latest(prev, cur);
+        unsigned long long h = cur->hash();
+        runHash = (runHash ^ h) * 1099511628211ull;
+        if (hashOut) {
+            fprintf(hashOut, "%llu %016llx\n", cur->tick, h);
+        }
+        PROFILE_END_FRAME();
+    }
+    chrono::duration<double, milli> total = chrono::steady_clock::now() - start;
+
+    if (hashOut) fclose(hashOut);
+
+    printf("ticks %d\n", ticks);
+    printf("total %.3f ms, %.3f us per tick, slowest %.3f us\n", total.count(), total.count() * 1000.0 / max(ticks, 1), slowestTick);
+    printf("run hash %016llx\n", runHash);
+
+#if PROFILER_ENABLED
+    Profiler::get().writeStats(cout);
+    if (!profileFile.empty()) {
+        Profiler::get().writeChromeTrace(profileFile);
+    }
+#endif
+    return 0;
+}
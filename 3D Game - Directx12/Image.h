@@ -0,0 +1,231 @@
+#pragma once
+#include "maths.h"
+#include <vector>
+#include <cstring>
+#if defined(_MSC_VER) && MATHS_SIMD_LEVEL > 0
+#include <intrin.h>
+#endif
+
+// One level of an RGBA8 image, rows tightly packed
+struct ImageLevel
+{
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels;
+};
+
+// CPU side image work for textures, kept free of D3D so it can run headless
+class ImageProcessing
+{
+public:
+	// Levels down to and including 1x1
+	static int mipCount(int width, int height)
+	{
+		int count = 1;
+		int size = std::max(width, height);
+		while (size > 1)
+		{
+			size >>= 1;
+			count++;
+		}
+		return count;
+	}
+
+	// RGB to RGBA with alpha 255. The widest path the CPU running it supports is picked the first time: AVX2 does 8
+	// pixels a step, SSSE3 4, and expandRGBScalar does the rest and everything on CPUs with neither.
+	static void expandRGB(const unsigned char* src, unsigned char* dst, int pixelCount)
+	{
+#if MATHS_SIMD_LEVEL > 0
+		static const int level = cpuLevel();
+		if (level == 2)
+		{
+			expandRGBAVX2(src, dst, pixelCount);
+			return;
+		}
+		if (level == 1)
+		{
+			expandRGBSSSE3(src, dst, pixelCount);
+			return;
+		}
+#endif
+		expandRGBScalar(src, dst, pixelCount);
+	}
+
+	// Which expandRGB path runs here: 0 scalar, 1 SSSE3, 2 AVX2
+	static int expandRGBLevel()
+	{
+#if MATHS_SIMD_LEVEL > 0
+		return cpuLevel();
+#else
+		return 0;
+#endif
+	}
+
+	static void expandRGBScalar(const unsigned char* src, unsigned char* dst, int pixelCount)
+	{
+		for (int i = 0; i < pixelCount; i++)
+		{
+			dst[i * 4] = src[i * 3];
+			dst[i * 4 + 1] = src[i * 3 + 1];
+			dst[i * 4 + 2] = src[i * 3 + 2];
+			dst[i * 4 + 3] = 255;
+		}
+	}
+
+	// Copies rows between buffers with different pitches, e.g. tightly packed pixels into a staging footprint whose
+	// RowPitch is rounded up to D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+	static void copyRows(const unsigned char* src, size_t srcPitch, unsigned char* dst, size_t dstPitch, size_t rowBytes, int rows)
+	{
+		for (int row = 0; row < rows; row++)
+		{
+			memcpy(dst + row * dstPitch, src + row * srcPitch, rowBytes);
+		}
+	}
+
+	// 2x2 box filter with rounding. An odd last row or column is averaged with itself.
+	static void downsample(const ImageLevel& src, ImageLevel& dst)
+	{
+		downsample(src.pixels.data(), src.width, src.height, dst);
+	}
+
+	// Same from packed RGBA8 rows that are not held in an ImageLevel
+	static void downsample(const unsigned char* srcPixels, int srcWidth, int srcHeight, ImageLevel& dst)
+	{
+		halfSize(srcWidth, srcHeight, dst);
+		for (int y = 0; y < dst.height; y++)
+		{
+			const unsigned char* row0 = srcPixels + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+			const unsigned char* row1 = srcPixels + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+			unsigned char* out = &dst.pixels[(size_t)y * dst.width * 4];
+			int x = 0;
+#if MATHS_SIMD_LEVEL > 0
+			// Two output pixels from four source pixels of each row
+			__m128i zero = _mm_setzero_si128();
+			__m128i round = _mm_set1_epi16(2);
+			for (; x + 2 <= dst.width && x * 2 + 4 <= srcWidth; x += 2)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+				__m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+				__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+				hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+				__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), 2);
+				_mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(sum, zero));
+			}
+#endif
+			downsampleRow(row0, row1, srcWidth, out, x, dst.width);
+		}
+	}
+
+	// Same without SIMD, the reference the SSE2 loop is checked against
+	static void downsampleScalar(const unsigned char* srcPixels, int srcWidth, int srcHeight, ImageLevel& dst)
+	{
+		halfSize(srcWidth, srcHeight, dst);
+		for (int y = 0; y < dst.height; y++)
+		{
+			const unsigned char* row0 = srcPixels + (size_t)std::min(y * 2, srcHeight - 1) * srcWidth * 4;
+			const unsigned char* row1 = srcPixels + (size_t)std::min(y * 2 + 1, srcHeight - 1) * srcWidth * 4;
+			downsampleRow(row0, row1, srcWidth, &dst.pixels[(size_t)y * dst.width * 4], 0, dst.width);
+		}
+	}
+
+	// Fills in every level below levels[0]
+	static void generateMips(std::vector<ImageLevel>& levels)
+	{
+		int count = mipCount(levels[0].width, levels[0].height);
+		levels.resize(count);
+		for (int i = 1; i < count; i++)
+		{
+			downsample(levels[i - 1], levels[i]);
+		}
+	}
+private:
+	static void halfSize(int srcWidth, int srcHeight, ImageLevel& dst)
+	{
+		dst.width = std::max(srcWidth / 2, 1);
+		dst.height = std::max(srcHeight / 2, 1);
+		dst.pixels.resize((size_t)dst.width * dst.height * 4);
+	}
+
+	// Output pixels from x to the end of the row
+	static void downsampleRow(const unsigned char* row0, const unsigned char* row1, int srcWidth, unsigned char* out, int x, int dstWidth)
+	{
+		for (; x < dstWidth; x++)
+		{
+			int x0 = std::min(x * 2, srcWidth - 1) * 4;
+			int x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+			for (int c = 0; c < 4; c++)
+			{
+				out[x * 4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+			}
+		}
+	}
+
+#if MATHS_SIMD_LEVEL > 0
+#if defined(_MSC_VER) && !defined(__clang__)
+#define IMAGE_TARGET(isa)
+#else
+#define IMAGE_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+	// The intrinsics below are compiled for their instruction sets whatever the build targets, so they must only be
+	// called once this says the CPU has them
+	static int cpuLevel()
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		bool ssse3 = (info[2] & (1 << 9)) != 0;
+		// AVX2 also needs the OS to save the YMM registers
+		bool ymmSaved = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+		bool avx2 = false;
+		if (maxLeaf >= 7 && ymmSaved)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+		return avx2 ? 2 : ssse3 ? 1 : 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("ssse3") ? 1 : 0;
+#endif
+	}
+
+	IMAGE_TARGET("avx2")
+	static void expandRGBAVX2(const unsigned char* src, unsigned char* dst, int pixelCount)
+	{
+		int i = 0;
+		__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+		__m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		__m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+		// Each load reads 32 bytes for 24 used, so stop while the last one stays inside src
+		for (; (i + 8) * 3 + 8 <= pixelCount * 3; i += 8)
+		{
+			__m256i rgb = _mm256_loadu_si256((const __m256i*)(src + i * 3));
+			rgb = _mm256_permutevar8x32_epi32(rgb, lanes);
+			_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), alpha));
+		}
+		expandRGBSSSE3(src + i * 3, dst + i * 4, pixelCount - i);
+	}
+
+	IMAGE_TARGET("ssse3")
+	static void expandRGBSSSE3(const unsigned char* src, unsigned char* dst, int pixelCount)
+	{
+		int i = 0;
+		__m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		__m128i alpha = _mm_set1_epi32((int)0xFF000000);
+		for (; (i + 4) * 3 + 4 <= pixelCount * 3; i += 4)
+		{
+			__m128i rgb = _mm_loadu_si128((const __m128i*)(src + i * 3));
+			_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+		}
+		expandRGBScalar(src + i * 3, dst + i * 4, pixelCount - i);
+	}
+
+#undef IMAGE_TARGET
+#endif
+};
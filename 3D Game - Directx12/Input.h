@@ -0,0 +1,176 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <mutex>
+#ifndef GAME_HEADLESS
+#include "Window.h"
+#endif
+
+// Everything gameplay reads from the player for one simulation tick
+struct InputFrame
+{
+    float lookX = 0.0f; // Mouse movement in pixels since the last tick
+    float lookY = 0.0f;
+    bool forward = false;
+    bool back = false;
+    bool left = false;
+    bool right = false;
+    bool fire = false;
+    bool reload = false;
+};
+
+class InputSource {
+public:
+    virtual ~InputSource() {}
+    virtual InputFrame sample() = 0;
+};
+
+// Input sampled on one thread and taken by the simulation's ticks on another. The window and cursor are only touched
+// by the thread that owns them, which pushes a frame of input each time it pumps messages. A tick gets the look
+// movement of every frame pushed since the last one, the newest key state, and fire or reload if any of those frames
+// had them, so a click shorter than a tick is not lost. A tick with nothing new keeps the held keys.
+class QueuedInput : public InputSource {
+public:
+    void push(const InputFrame& frame) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.push_back(frame);
+    }
+
+    InputFrame sample() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        InputFrame frame = held;
+        if (queued.empty()) return frame;
+        frame.fire = false;
+        frame.reload = false;
+        for (const InputFrame& f : queued) {
+            frame.lookX += f.lookX;
+            frame.lookY += f.lookY;
+            frame.forward = f.forward;
+            frame.back = f.back;
+            frame.left = f.left;
+            frame.right = f.right;
+            frame.fire = frame.fire || f.fire;
+            frame.reload = frame.reload || f.reload;
+        }
+        held = queued.back();
+        held.lookX = 0.0f;
+        held.lookY = 0.0f;
+        queued.clear();
+        return frame;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<InputFrame> queued;
+    InputFrame held; // Newest pushed key state, without its look movement
+};
+
+#ifndef GAME_HEADLESS
+// Live input from the window and the OS cursor, the mouse is re-centred every sample. Only call it from the thread
+// that pumps the window's messages, with -threadedsim through QueuedInput.
+class WindowInput : public InputSource {
+public:
+    Window* win = nullptr;
+
+    void init(Window* _win) {
+        win = _win;
+    }
+
+    InputFrame sample() override {
+        InputFrame frame;
+        frame.forward = win->keys['W'];
+        frame.back = win->keys['S'];
+        frame.left = win->keys['A'];
+        frame.right = win->keys['D'];
+        frame.reload = (GetAsyncKeyState('R') & 0x8000) || win->keys['R'];
+        frame.fire = (GetAsyncKeyState(VK_LBUTTON) & 0x8000) != 0;
+
+        if (GetForegroundWindow() == win->hwnd) {
+            POINT cursorPos;
+            GetCursorPos(&cursorPos);
+            RECT rect;
+            GetWindowRect(win->hwnd, &rect);
+            int centerX = (rect.left + rect.right) / 2;
+            int centerY = (rect.top + rect.bottom) / 2;
+
+            frame.lookX = (float)(cursorPos.x - centerX);
+            frame.lookY = (float)(cursorPos.y - centerY);
+
+            SetCursorPos(centerX, centerY);
+        }
+        return frame;
+    }
+};
+#endif
+
+// Recorded input files start with this header, followed by one InputFrame per tick
+struct InputFileHeader
+{
+    char magic[4] = { 'I', 'N', 'P', 'T' };
+    unsigned int version = 1;
+    float step = 0.0f; // Simulation step the input was recorded at, replays must use the same one
+};
+
+// Passes another source through unchanged while writing every frame to disk
+class InputRecorder : public InputSource {
+public:
+    InputSource* source = nullptr;
+    std::ofstream file;
+
+    bool open(const std::string& filename, InputSource* _source, float step) {
+        source = _source;
+        file.open(filename, std::ios::binary);
+        if (!file.is_open()) return false;
+
+        InputFileHeader header;
+        header.step = step;
+        file.write((const char*)&header, sizeof(header));
+        return true;
+    }
+
+    InputFrame sample() override {
+        InputFrame frame = source->sample();
+        if (file.is_open()) {
+            file.write((const char*)&frame, sizeof(frame));
+        }
+        return frame;
+    }
+};
+
+// Plays back a recorded file, returns empty frames once the recording runs out
+class InputReplay : public InputSource {
+public:
+    std::vector<InputFrame> frames;
+    float step = 0.0f;
+    int position = 0;
+
+    bool open(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) return false;
+
+        InputFileHeader header;
+        InputFileHeader expected;
+        file.read((char*)&header, sizeof(header));
+        if (!file || memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version) {
+            return false;
+        }
+        step = header.step;
+
+        InputFrame frame;
+        while (file.read((char*)&frame, sizeof(frame))) {
+            frames.push_back(frame);
+        }
+        return true;
+    }
+
+    bool finished() {
+        return position >= (int)frames.size();
+    }
+
+    InputFrame sample() override {
+        if (finished()) return InputFrame();
+        return frames[position++];
+    }
+};
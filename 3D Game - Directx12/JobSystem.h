@@ -0,0 +1,115 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Fixed pool of worker threads. parallelFor hands out indices to the workers and the calling thread and returns once all are done.
+class JobSystem {
+public:
+    ~JobSystem() {
+        shutdown();
+    }
+
+    void init(int workerCount) {
+        for (int i = 0; i < workerCount; i++) {
+            workers.emplace_back([this, i]() { workerLoop(i + 1); });
+        }
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        workers.clear();
+    }
+
+    // Threads that can run jobs, the caller counts as thread 0
+    int threadCount() {
+        return (int)workers.size() + 1;
+    }
+
+    // job(index, thread) is called once for every index in [0, count)
+    void parallelFor(int count, const std::function<void(int, int)>& job) {
+        if (count <= 0) return;
+        if (workers.empty() || count == 1) {
+            for (int i = 0; i < count; i++) job(i, 0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &job;
+            jobCount = count;
+            nextIndex = 0;
+            remaining = count;
+            generation++;
+        }
+        wake.notify_all();
+
+        runJobs(&job, count, 0);
+
+        // A worker still inside runJobs could otherwise take an index of the next call from nextIndex
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return remaining == 0 && active == 0; });
+        current = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int, int)>* current = nullptr;
+    int jobCount = 0;
+    std::atomic<int> nextIndex = 0;
+    int remaining = 0;
+    int active = 0; // Workers inside runJobs
+    unsigned int generation = 0;
+    bool quit = false;
+
+    void runJobs(const std::function<void(int, int)>* job, int count, int thread) {
+        int finished = 0;
+        while (true) {
+            int index = nextIndex.fetch_add(1);
+            if (index >= count) break;
+            (*job)(index, thread);
+            finished++;
+        }
+        if (finished > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            remaining -= finished;
+            if (remaining == 0) done.notify_all();
+        }
+    }
+
+    void workerLoop(int thread) {
+        unsigned int seen = 0;
+        while (true) {
+            const std::function<void(int, int)>* job;
+            int count;
+            {
+                // Copied under the lock so a late wake sees one call's job and count, never a mix of two
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]() { return quit || generation != seen; });
+                if (quit) return;
+                seen = generation;
+                job = current;
+                count = jobCount;
+                // Woken after that call returned, with every index handed out
+                if (!job) continue;
+                active++;
+            }
+            runJobs(job, count, thread);
+            std::lock_guard<std::mutex> lock(mutex);
+            active--;
+            if (active == 0 && remaining == 0) done.notify_all();
+        }
+    }
+};
@@ -0,0 +1,98 @@
+#pragma once
+#include "maths.h"
+#include "Collision.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+// One line of LevelData.txt: type, model path, position, rotation (radians) and scale
+struct LevelEntry
+{
+    std::string type;
+    std::string path;
+    Vec3 position;
+    Vec3 rotation;
+    Vec3 scale;
+};
+
+class Level {
+public:
+    static bool load(const std::string& filename, std::vector<LevelEntry>& entries) {
+        std::ifstream file(filename);
+        if (!file.is_open()) return false;
+
+        std::string line;
+        while (getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::stringstream ss(line);
+            LevelEntry entry;
+
+            ss >> entry.type >> entry.path
+                >> entry.position.x >> entry.position.y >> entry.position.z
+                >> entry.rotation.x >> entry.rotation.y >> entry.rotation.z
+                >> entry.scale.x >> entry.scale.y >> entry.scale.z;
+
+            entries.push_back(entry);
+        }
+        return true;
+    }
+
+    static AABB treeCollider(const Vec3& pos) {
+        Vec3 colSize(1.0f, 10.0f, 1.0f);
+        Vec3 halfSize = colSize * 0.5f;
+        Vec3 centerPos = pos;
+        centerPos.y += 5.0f;
+        return AABB(centerPos - halfSize, centerPos + halfSize);
+    }
+
+    static AABB wallCollider(const Vec3& pos, const Vec3& rot, const Vec3& sc) {
+        Vec3 wallSize;
+        if (std::abs(rot.y) < 0.1f)
+            wallSize = Vec3(sc.x * 2.0f, sc.z * 2.0f, 1.0f);
+        else
+            wallSize = Vec3(1.0f, sc.z * 2.0f, sc.x * 2.0f);
+
+        Vec3 halfSize = wallSize * 0.5f;
+        AABB wallCollider;
+        wallCollider.min = pos - halfSize;
+        wallCollider.max = pos + halfSize;
+        return wallCollider;
+    }
+
+    // Invisible walls around the edge of the ground, boundaryInset in from it. See CookedLevel::bounds.
+    static void addBoundary(std::vector<AABB>& obstacles, const Vec3& groundMin, const Vec3& groundMax) {
+        float boundaryInset = 2.0f;
+        float wallThick = 10.0f;
+        float wallH = 100.0f;
+
+        float minX = groundMin.x + boundaryInset;
+        float maxX = groundMax.x - boundaryInset;
+        float minZ = groundMin.z + boundaryInset;
+        float maxZ = groundMax.z - boundaryInset;
+        float centreX = (minX + maxX) * 0.5f;
+        float centreZ = (minZ + maxZ) * 0.5f;
+        float lengthX = groundMax.x - groundMin.x;
+        float lengthZ = groundMax.z - groundMin.z;
+
+        Vec3 sizeN(lengthX, wallH, wallThick);
+        Vec3 posN(centreX, 0.0f, maxZ + wallThick * 0.5f);
+        obstacles.push_back(AABB(posN - sizeN * 0.5f, posN + sizeN * 0.5f));
+
+        Vec3 sizeS(lengthX, wallH, wallThick);
+        Vec3 posS(centreX, 0.0f, minZ - wallThick * 0.5f);
+        obstacles.push_back(AABB(posS - sizeS * 0.5f, posS + sizeS * 0.5f));
+
+        Vec3 sizeE(wallThick, wallH, lengthZ);
+        Vec3 posE(maxX + wallThick * 0.5f, 0.0f, centreZ);
+        obstacles.push_back(AABB(posE - sizeE * 0.5f, posE + sizeE * 0.5f));
+
+        Vec3 sizeW(wallThick, wallH, lengthZ);
+        Vec3 posW(minX - wallThick * 0.5f, 0.0f, centreZ);
+        obstacles.push_back(AABB(posW - sizeW * 0.5f, posW + sizeW * 0.5f));
+    }
+};
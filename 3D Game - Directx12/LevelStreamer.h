@@ -0,0 +1,164 @@
+#pragma once
+#include "CookedLevel.h"
+#include "WorldPartition.h"
+#include "AssetLoader.h"
+#include <vector>
+#include <memory>
+#include <string>
+
+// What a resident cell adds to the world, copied out of the mapped level
+struct LevelCell
+{
+    std::vector<int> propMeshes; // Into the level's mesh table
+    std::vector<Matrix> propWorlds;
+    std::vector<Matrix> wallWorlds;
+    std::vector<AABB> colliders;
+    std::vector<Vec3> spawnPositions;
+    std::vector<Vec3> spawnScales;
+
+    // Most a cell with this many entries and colliders can hold, what the budget counts it as
+    static size_t maxBytes(const CookedLevelCell& cell)
+    {
+        return cell.entryCount * (sizeof(Matrix) + sizeof(int)) + cell.colliderCount * sizeof(AABB);
+    }
+};
+
+// Streams the cells of a CookedLevel in and out around the player. WorldPartition picks the cells, each one is copied
+// out of the mapped file on one of assets' threads (the first touch of its pages is the disk read) and handed over
+// when assets is pumped. Whoever draws or collides with the level rebuilds from the resident cells when changed is
+// set. Enemies are spawned the first time their cell comes in and are left to the simulation after that.
+//
+// The budget covers what the cells themselves hold, not the meshes their props place: those are counted by meshUsers
+// so whoever loads them can release each one when the last resident prop using it goes.
+class LevelStreamer {
+public:
+    CookedLevel* level = nullptr;
+    AssetLoader* assets = nullptr;
+    WorldPartition partition;
+    std::vector<std::unique_ptr<LevelCell>> cells; // NULL when not resident or still loading
+    bool changed = false; // Set when cells come or go, for the caller to clear once it has rebuilt
+
+    // Spawns from cells that came in since the caller last took them
+    std::vector<Vec3> pendingSpawnPositions;
+    std::vector<Vec3> pendingSpawnScales;
+
+    std::vector<int> meshUsers; // Props in resident cells placing each of the level's meshes
+    std::vector<int> unusedMeshes; // Meshes whose last user went since the caller last took them, may be in use again since
+
+    void init(CookedLevel* _level, AssetLoader* _assets, float loadRadius, float unloadRadius, size_t budgetBytes, int maxLoadsPerUpdate = 4)
+    {
+        level = _level;
+        assets = _assets;
+        std::vector<size_t> cellBytes(level->cellCount());
+        for (int i = 0; i < level->cellCount(); i++) {
+            cellBytes[i] = LevelCell::maxBytes(level->cells[i]);
+        }
+        partition.init(level->cellsX, level->cellsZ, level->originX, level->originZ, level->cellSize, cellBytes, loadRadius, unloadRadius,
+            budgetBytes, maxLoadsPerUpdate);
+        cells.clear();
+        cells.resize(level->cellCount());
+        tickets.assign(level->cellCount(), 0);
+        spawned.assign(level->cellCount(), 0);
+        meshUsers.assign(level->meshCount, 0);
+        unusedMeshes.clear();
+    }
+
+    // Starts loading the cells the player at (x, z) now needs and drops those it has left. With immediate the
+    // loads are done before returning, e.g. for the cells around the start position.
+    void update(float x, float z, bool immediate = false)
+    {
+        do {
+            updateOnce(x, z, immediate);
+        } while (immediate && !loads.empty());
+    }
+
+    // True when the cell holding (x, z) is in, or has nothing to load
+    bool readyAt(float x, float z) const
+    {
+        int cell = level->cellAt(x, z);
+        if (cell == -1 || level->cells[cell].entryCount == 0) return true;
+        return cells[cell] != nullptr;
+    }
+
+    // Colliders of every resident cell plus the boundary around the level
+    void gatherColliders(std::vector<AABB>& out) const
+    {
+        out.clear();
+        for (const std::unique_ptr<LevelCell>& cell : cells) {
+            if (cell) out.insert(out.end(), cell->colliders.begin(), cell->colliders.end());
+        }
+        Level::addBoundary(out, level->boundsMin, level->boundsMax);
+    }
+
+    std::string cellName(int cell) const
+    {
+        return "Level cell " + std::to_string(cell % level->cellsX) + "," + std::to_string(cell / level->cellsX);
+    }
+
+private:
+    std::vector<unsigned int> tickets; // Bumped by every load and unload, a load only lands if it is still current
+    std::vector<char> spawned;
+    std::vector<int> loads;
+    std::vector<int> unloads;
+
+    void updateOnce(float x, float z, bool immediate)
+    {
+        partition.update(x, z, loads, unloads);
+        for (int cell : unloads) {
+            // A load still in flight is dropped when it finishes
+            tickets[cell]++;
+            if (cells[cell]) {
+                for (int mesh : cells[cell]->propMeshes) {
+                    if (--meshUsers[mesh] == 0) unusedMeshes.push_back(mesh);
+                }
+                cells[cell].reset();
+                changed = true;
+            }
+        }
+        for (int cell : loads) {
+            unsigned int ticket = ++tickets[cell];
+            std::shared_ptr<LevelCell> data = std::make_shared<LevelCell>();
+            if (immediate || !assets) {
+                read(cell, *data);
+                install(cell, ticket, *data);
+                continue;
+            }
+            assets->submit(cellName(cell), [this, cell, data]() { read(cell, *data); return true; },
+                [this, cell, ticket, data]() { install(cell, ticket, *data); }, false);
+        }
+    }
+
+    // Touches nothing but the mapped level and out, so it can run on any thread
+    void read(int cell, LevelCell& out) const
+    {
+        const CookedLevelCell& c = level->cells[cell];
+        for (unsigned int i = c.firstEntry; i < c.firstEntry + c.entryCount; i++) {
+            const CookedLevelEntry& e = level->entries[i];
+            if (e.type == LevelTree && e.mesh != -1) {
+                out.propMeshes.push_back(e.mesh);
+                out.propWorlds.push_back(level->worlds[i]);
+            }
+            else if (e.type == LevelWall) {
+                out.wallWorlds.push_back(level->worlds[i]);
+            }
+            else if (e.type == LevelEnemy) {
+                out.spawnPositions.push_back(e.position);
+                out.spawnScales.push_back(e.scale);
+            }
+        }
+        out.colliders.assign(level->colliders + c.firstCollider, level->colliders + c.firstCollider + c.colliderCount);
+    }
+
+    void install(int cell, unsigned int ticket, LevelCell& data)
+    {
+        if (tickets[cell] != ticket) return;
+        if (!spawned[cell]) {
+            spawned[cell] = 1;
+            pendingSpawnPositions.insert(pendingSpawnPositions.end(), data.spawnPositions.begin(), data.spawnPositions.end());
+            pendingSpawnScales.insert(pendingSpawnScales.end(), data.spawnScales.begin(), data.spawnScales.end());
+        }
+        for (int mesh : data.propMeshes) meshUsers[mesh]++;
+        cells[cell] = std::make_unique<LevelCell>(std::move(data));
+        changed = true;
+    }
+};
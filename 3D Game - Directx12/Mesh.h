@@ -18,6 +18,14 @@ public:
         if (indexBuffer) indexBuffer->Release();
     }
 
+    // Hands the buffers to core to free once the frames in flight are done with them
+    void releaseAfterFrame(Core* core) {
+        if (vertexBuffer) core->releaseAfterFrame(vertexBuffer);
+        if (indexBuffer) core->releaseAfterFrame(indexBuffer);
+        vertexBuffer = nullptr;
+        indexBuffer = nullptr;
+    }
+
     template<typename VERTEX_TYPE>
     void init(Core* core,const std::vector<VERTEX_TYPE>& vertices,const std::vector<unsigned int>& indices) {
         int vBufferSize = sizeof(VERTEX_TYPE) * vertices.size();
@@ -79,11 +87,17 @@ public:
     }
 
     void draw(Core* core) {
-        auto cmd = core->getCommandList();
-        cmd->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-        cmd->IASetVertexBuffers(0, 1, &vbView);
-        cmd->IASetIndexBuffer(&ibView);
-        cmd->DrawIndexedInstanced(numMeshIndices, 1, 0, 0, 0);
+        VertexBufferBinding vb;
+        vb.location = vbView.BufferLocation;
+        vb.size = vbView.SizeInBytes;
+        vb.stride = vbView.StrideInBytes;
+
+        IndexBufferBinding ib;
+        ib.location = ibView.BufferLocation;
+        ib.size = ibView.SizeInBytes;
+        ib.format = ibView.Format;
+
+        core->drawStream.drawIndexed(vb, ib, numMeshIndices);
     }
 };
 
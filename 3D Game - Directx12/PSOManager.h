@@ -194,7 +194,7 @@ public:
         for (auto& descCB : reflectedVS)
         {
             ConstantBuffer* cb = new ConstantBuffer(); 
-            cb->init(core, descCB, 1024);
+            cb->init(core, descCB);
             vsCBs.push_back(cb);
         }
 
@@ -202,7 +202,7 @@ public:
         for (auto& descCB : reflectedPS)
         {
             ConstantBuffer* cb = new ConstantBuffer(); 
-            cb->init(core, descCB, 1024);
+            cb->init(core, descCB);
             psCBs.push_back(cb);
         }
 
@@ -230,7 +230,7 @@ public:
             OutputDebugStringA("PSOManager::bind  PSO not found or null\n");
             return;
         }
-        core->getCommandList()->SetPipelineState(it->second);
+        core->drawStream.setPipeline(it->second);
     }
 
     ConstantBuffer* getVSConstantBuffer(const string& name, size_t index = 0)
@@ -257,7 +257,7 @@ public:
             if (vsCBs[i])
             {
                 if (i == 0) {
-                    core->getCommandList()->SetGraphicsRootConstantBufferView(0, vsCBs[i]->getGPUAddress());
+                    core->drawStream.setRootCBV(0, vsCBs[i]->getGPUAddress());
                 }
                 vsCBs[i]->next();
             }
@@ -269,7 +269,7 @@ public:
             if (psCBs[i])
             {
                 if (i == 0) {
-                    core->getCommandList()->SetGraphicsRootConstantBufferView(1, psCBs[i]->getGPUAddress());
+                    core->drawStream.setRootCBV(1, psCBs[i]->getGPUAddress());
                 }
                 psCBs[i]->next();
             }
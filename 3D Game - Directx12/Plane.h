@@ -58,6 +58,7 @@ public:
 
     void draw(Core* core, Matrix world, Matrix vp) {
         psoMgr.bind(core, "PlanePSO");
+        core->drawStream.setObjectPosition(world.m[3], world.m[7], world.m[11]);
 
         PlaneConstantBuffer cbData;
         cbData.W = world;
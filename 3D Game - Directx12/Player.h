@@ -1,7 +1,6 @@
 #pragma once
-#include "Maths.h"
-#include "Core.h"
-#include "Window.h"
+#include "maths.h"
+#include "Input.h"
 #include "Collision.h" 
 #include <vector>
 #include <cmath>
@@ -91,7 +90,8 @@ public:
         return AABB(min, max);
     }
 
-    void update(float dt, Window* win, const std::vector<AABB>& obstacles) {
+    // All gameplay input comes through an InputFrame so the same ticks can be replayed without a window
+    void update(float dt, const InputFrame& input, const std::vector<AABB>& obstacles) {
         if (fireTimer > 0.0f) fireTimer -= dt;
 
         isFiring = false;
@@ -100,39 +100,25 @@ public:
             startReload();
         }
 
-        if ((GetAsyncKeyState('R') & 0x8000) || win->keys['R']) {
+        if (input.reload) {
             startReload();
         }
 
-        if ((GetAsyncKeyState(VK_LBUTTON) & 0x8000) && !isReloading && currentAmmo > 0 && fireTimer <= 0.0f) {
+        if (input.fire && !isReloading && currentAmmo > 0 && fireTimer <= 0.0f) {
             isFiring = true;
             currentAmmo--;
             fireTimer = fireRate;
         }
 
-        POINT cursorPos;
-        GetCursorPos(&cursorPos);
-        RECT rect;
-        GetWindowRect(win->hwnd, &rect);
-        int centerX = (rect.left + rect.right) / 2;
-        int centerY = (rect.top + rect.bottom) / 2;
+        rotation.y += input.lookX * mouseSensitivity;
+        rotation.x += input.lookY * mouseSensitivity;
 
-        if (GetForegroundWindow() == win->hwnd) {
-            float deltaX = (float)(cursorPos.x - centerX);
-            float deltaY = (float)(cursorPos.y - centerY);
-
-            rotation.y += deltaX * mouseSensitivity;
-            rotation.x += deltaY * mouseSensitivity;
-
-            if (rotation.x > 1.5f) {
-                rotation.x = 1.5f;
-            }
-                
-            if (rotation.x < -1.5f) {
-                rotation.x = -1.5f;
-            }
-                
-            SetCursorPos(centerX, centerY);
+        if (rotation.x > 1.5f) {
+            rotation.x = 1.5f;
+        }
+            
+        if (rotation.x < -1.5f) {
+            rotation.x = -1.5f;
         }
 
         Vec3 forwardFlat;
@@ -145,10 +131,10 @@ public:
 
         Vec3 moveDir(0, 0, 0);
 
-        if (win->keys['W']) moveDir += forwardFlat;
-        if (win->keys['S']) moveDir -= forwardFlat;
-        if (win->keys['D']) moveDir -= rightFlat;
-        if (win->keys['A']) moveDir += rightFlat;
+        if (input.forward) moveDir += forwardFlat;
+        if (input.back) moveDir -= forwardFlat;
+        if (input.right) moveDir -= rightFlat;
+        if (input.left) moveDir += rightFlat;
 
         if (moveDir.x != 0 || moveDir.z != 0) {
             moveDir = moveDir.normalize();
@@ -190,13 +176,18 @@ public:
     }
 
     Matrix getViewMatrix() {
-        Vec3 eyePos = position;
+        return getViewMatrix(position, rotation);
+    }
+
+    // View from an interpolated position and rotation rather than the current simulation state
+    Matrix getViewMatrix(Vec3 pos, Vec3 rot) const {
+        Vec3 eyePos = pos;
         eyePos.y += eyeHeight;
 
         Vec3 lookDir;
-        lookDir.x = sinf(rotation.y) * cosf(rotation.x);
-        lookDir.y = -sinf(rotation.x);
-        lookDir.z = cosf(rotation.y) * cosf(rotation.x);
+        lookDir.x = sinf(rot.y) * cosf(rot.x);
+        lookDir.y = -sinf(rot.x);
+        lookDir.z = cosf(rot.y) * cosf(rot.x);
         lookDir.normalize();
 
         Vec3 target = eyePos + lookDir;
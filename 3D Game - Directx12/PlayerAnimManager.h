@@ -25,6 +25,7 @@ private:
 
     bool isActionActive = false;
     float currentAnimTime = 0.0f;
+    float crossFadeDuration = 0.1f;
 
 public:
     void init(AnimationInstance* animInst, BulletManager* bMgr) {
@@ -120,8 +121,7 @@ private:
 
         std::string animName = animMap[newState];
         if (targetAnimInstance->usingAnimation != animName) {
-            targetAnimInstance->usingAnimation = animName;
-            targetAnimInstance->t = 0.0f;
+            targetAnimInstance->crossFade(animName, crossFadeDuration);
         }
     }
 };
\ No newline at end of file
@@ -0,0 +1,230 @@
+#pragma once
+
+// Hierarchical scope profiler. PROFILE_SCOPE("name") times the enclosing block on the calling thread.
+// Each thread writes into its own ring buffer with no locks, Profiler::endFrame() folds the new events into
+// rolling min/avg/p99 per scope and writeChromeTrace() dumps the buffered events for chrome://tracing.
+// Build with PROFILER_ENABLED 0 to compile every macro out.
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <iomanip>
+#include <cstdio>
+
+// Rolling statistics for one scope, in milliseconds over the last `window` samples
+struct ProfileStats
+{
+    float min = 0.0f;
+    float avg = 0.0f;
+    float p99 = 0.0f;
+    float last = 0.0f;
+    unsigned long long count = 0; // Samples recorded since start up
+
+    static const int window = 256;
+    std::vector<float> samples;
+    std::vector<float> scratch;
+    int next = 0;
+
+    void add(float ms) {
+        if (samples.size() < window) {
+            samples.push_back(ms);
+        }
+        else {
+            samples[next] = ms;
+        }
+        next = (next + 1) % window;
+        last = ms;
+        count++;
+    }
+
+    void update() {
+        if (samples.empty()) return;
+        float sum = 0.0f;
+        min = samples[0];
+        for (float s : samples) {
+            sum += s;
+            min = std::min(min, s);
+        }
+        avg = sum / samples.size();
+
+        scratch = samples;
+        int rank = std::min((int)scratch.size() - 1, (int)(scratch.size() * 0.99f));
+        std::nth_element(scratch.begin(), scratch.begin() + rank, scratch.end());
+        p99 = scratch[rank];
+    }
+};
+
+struct ProfileEvent
+{
+    const char* name;
+    long long start; // Nanoseconds since the profiler epoch
+    long long end;
+};
+
+// One per thread. Only the owning thread writes, readers only look at events behind `head`.
+// The slot at head - capacity is the one the owner writes next, so readers keep to the capacity - 1 events before
+// it and drop any the owner has come round to by the time they are copied out.
+struct ProfileThreadBuffer
+{
+    static const unsigned int capacity = 1 << 15;
+    ProfileEvent events[capacity];
+    std::atomic<unsigned int> head = 0;
+    unsigned int read = 0; // Next event endFrame has not folded into stats yet
+    int threadId = 0;
+
+    // Oldest event a reader may look at while the owner keeps writing
+    static unsigned int oldest(unsigned int head) {
+        return head - std::min(head, capacity - 1);
+    }
+
+    // Copies event i out, false if the owner may have overwritten it meanwhile
+    bool copy(unsigned int i, ProfileEvent& out) const {
+        out = events[i % capacity];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return head.load(std::memory_order_relaxed) - i < capacity;
+    }
+};
+
+class Profiler {
+public:
+    static Profiler& get() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - get().epoch).count();
+    }
+
+    static ProfileThreadBuffer* threadBuffer() {
+        thread_local ProfileThreadBuffer* buffer = get().registerThread();
+        return buffer;
+    }
+
+    // Adds a sample that was not measured by a scope, e.g. GPU time read back from timestamp queries
+    void record(const std::string& name, float ms) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats[name].add(ms);
+    }
+
+    // Call once per frame from the main thread
+    void endFrame() {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        {
+            std::lock_guard<std::mutex> threadLock(threadsMutex);
+            for (ProfileThreadBuffer* buffer : threads) {
+                unsigned int head = buffer->head.load(std::memory_order_acquire);
+                unsigned int oldest = ProfileThreadBuffer::oldest(head);
+                if (head - buffer->read > head - oldest) {
+                    buffer->read = oldest;
+                }
+                ProfileEvent e;
+                for (; buffer->read != head; buffer->read++) {
+                    if (buffer->copy(buffer->read, e)) stats[e.name].add((e.end - e.start) / 1000000.0f);
+                }
+            }
+        }
+        for (auto& kv : stats) {
+            kv.second.update();
+        }
+    }
+
+    ProfileStats getStats(const std::string& name) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        auto it = stats.find(name);
+        return it == stats.end() ? ProfileStats() : it->second;
+    }
+
+    std::map<std::string, ProfileStats> getAllStats() {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return stats;
+    }
+
+    void writeStats(std::ostream& out) {
+        std::map<std::string, ProfileStats> all = getAllStats();
+        char line[256];
+        snprintf(line, sizeof(line), "%-28s %10s %10s %10s %10s\n", "scope", "min ms", "avg ms", "p99 ms", "count");
+        out << line;
+        for (auto& kv : all) {
+            snprintf(line, sizeof(line), "%-28s %10.3f %10.3f %10.3f %10llu\n", kv.first.c_str(), kv.second.min, kv.second.avg, kv.second.p99, kv.second.count);
+            out << line;
+        }
+    }
+
+    // Writes every event still held in the ring buffers as Chrome trace-event JSON
+    bool writeChromeTrace(const std::string& filename) {
+        std::ofstream file(filename);
+        if (!file.is_open()) return false;
+
+        file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+        bool first = true;
+        std::lock_guard<std::mutex> threadLock(threadsMutex);
+        for (ProfileThreadBuffer* buffer : threads) {
+            unsigned int head = buffer->head.load(std::memory_order_acquire);
+            ProfileEvent e;
+            for (unsigned int i = ProfileThreadBuffer::oldest(head); i != head; i++) {
+                if (!buffer->copy(i, e)) continue;
+                if (!first) file << ",";
+                first = false;
+                file << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadId
+                    << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << (e.end - e.start) / 1000.0 << "}";
+            }
+        }
+        file << "]}";
+        return true;
+    }
+
+private:
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::vector<ProfileThreadBuffer*> threads;
+    std::mutex threadsMutex;
+    std::map<std::string, ProfileStats> stats;
+    std::mutex statsMutex;
+
+    // Buffers are never freed so events from threads that have finished can still be exported
+    ProfileThreadBuffer* registerThread() {
+        ProfileThreadBuffer* buffer = new ProfileThreadBuffer();
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        buffer->threadId = (int)threads.size();
+        threads.push_back(buffer);
+        return buffer;
+    }
+};
+
+class ProfileScope {
+public:
+    const char* name;
+    long long start;
+    ProfileThreadBuffer* buffer;
+
+    ProfileScope(const char* _name) {
+        name = _name;
+        buffer = Profiler::threadBuffer();
+        start = Profiler::now();
+    }
+
+    ~ProfileScope() {
+        long long end = Profiler::now();
+        unsigned int head = buffer->head.load(std::memory_order_relaxed);
+        buffer->events[head % ProfileThreadBuffer::capacity] = { name, start, end };
+        buffer->head.store(head + 1, std::memory_order_release);
+    }
+};
+
+#if PROFILER_ENABLED
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_END_FRAME() Profiler::get().endFrame()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_END_FRAME()
+#endif
@@ -0,0 +1,263 @@
+#pragma once
+#include "maths.h"
+#include "Collision.h"
+#include "MappedFile.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+
+// A property of the scene or of one of its instances, viewed in the mapped file: strings without their quotes and
+// with any escapes left as written, other values as their raw text
+struct SceneProperty
+{
+    int instance; // -1 for the scene's own
+    std::string_view name;
+    std::string_view value;
+};
+
+// Reads GEMScene files (see GEMLoader::GEMScene) in one pass over the mapped file, straight into the arrays that
+// drawing and collision use. No tree is built for the JSON: numbers are converted where they stand, names and
+// properties are viewed in place, and each mesh filename is stored once however many instances use it. The same
+// layout as GEMScene is accepted: a top level object whose arrays hold instances and whose other values are scene
+// properties, each instance an object with "filename", a 16 float row major "world" and any other properties.
+// An instance with "collision" set to false, 0 or none gets no collider, e.g. for the ground.
+class SceneLoader {
+public:
+    std::vector<std::string> meshFilenames; // Unique, in the order instances first use them
+    std::vector<int> instanceMeshes; // Per instance, into meshFilenames
+    std::vector<Matrix> worlds;
+    std::vector<char> instanceCollides;
+    std::vector<AABB> colliders; // From buildColliders
+    std::vector<SceneProperty> properties; // Valid while the file stays loaded
+
+    bool load(const std::string& filename) {
+        meshFilenames.clear();
+        instanceMeshes.clear();
+        worlds.clear();
+        instanceCollides.clear();
+        colliders.clear();
+        properties.clear();
+        if (!file.open(filename)) return false;
+        pos = (const char*)file.data();
+        end = pos + file.size();
+        meshIndex.clear();
+        lastMesh = -1;
+        bool ok = parseScene();
+        meshIndex.clear();
+        return ok;
+    }
+
+    // A scene property's value, empty when it has none
+    std::string_view findProperty(std::string_view name) const {
+        for (const SceneProperty& p : properties) {
+            if (p.instance == -1 && p.name == name) return p.value;
+        }
+        return std::string_view();
+    }
+
+    // One collider per instance that collides, its mesh's model space bounds moved to where it is placed. Instances
+    // of meshes that could not be loaded (bounds still reset) get none.
+    void buildColliders(const std::vector<AABB>& meshBounds) {
+        colliders.clear();
+        colliders.reserve(worlds.size());
+        for (size_t i = 0; i < worlds.size(); i++) {
+            const AABB& local = meshBounds[instanceMeshes[i]];
+            if (!instanceCollides[i] || local.min.x > local.max.x) continue;
+            colliders.push_back(transformBounds(local, worlds[i]));
+        }
+    }
+
+    // Smallest box around box once transformed by world
+    static AABB transformBounds(const AABB& box, const Matrix& world) {
+        Vec3 centre = world.mulPoint((box.min + box.max) * 0.5f);
+        Vec3 half = (box.max - box.min) * 0.5f;
+        Vec3 extent(
+            std::abs(world.m[0]) * half.x + std::abs(world.m[1]) * half.y + std::abs(world.m[2]) * half.z,
+            std::abs(world.m[4]) * half.x + std::abs(world.m[5]) * half.y + std::abs(world.m[6]) * half.z,
+            std::abs(world.m[8]) * half.x + std::abs(world.m[9]) * half.y + std::abs(world.m[10]) * half.z);
+        return AABB(centre - extent, centre + extent);
+    }
+
+private:
+    MappedFile file;
+    const char* pos = nullptr;
+    const char* end = nullptr;
+    std::unordered_map<std::string_view, int> meshIndex; // Keyed on the filename as written, only while parsing
+    std::string_view lastName; // Neighbouring instances mostly share a mesh, so the last one is checked first
+    int lastMesh = -1;
+
+    void skipWhitespace() {
+        while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) pos++;
+    }
+
+    bool expect(char c) {
+        skipWhitespace();
+        if (pos == end || *pos != c) return false;
+        pos++;
+        return true;
+    }
+
+    // Skips past c if it is next
+    bool next(char c) {
+        skipWhitespace();
+        if (pos < end && *pos == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseString(std::string_view& out) {
+        if (!expect('"')) return false;
+        const char* start = pos;
+        while (pos < end && *pos != '"') {
+            pos += *pos == '\\' ? 2 : 1;
+        }
+        if (pos >= end) return false;
+        out = std::string_view(start, pos - start);
+        pos++;
+        return true;
+    }
+
+    bool parseFloat(float& out) {
+        skipWhitespace();
+        std::from_chars_result result = std::from_chars(pos, end, out);
+        if (result.ec != std::errc()) return false;
+        pos = result.ptr;
+        return true;
+    }
+
+    // Any value, as a string's contents or the raw text of anything else
+    bool parseRaw(std::string_view& out) {
+        skipWhitespace();
+        if (pos == end) return false;
+        if (*pos == '"') return parseString(out);
+        const char* start = pos;
+        if (*pos == '[' || *pos == '{') {
+            int depth = 0;
+            do {
+                if (*pos == '"') {
+                    std::string_view unused;
+                    if (!parseString(unused)) return false;
+                    continue;
+                }
+                if (*pos == '[' || *pos == '{') depth++;
+                if (*pos == ']' || *pos == '}') depth--;
+                pos++;
+            } while (depth > 0 && pos < end);
+            if (depth > 0) return false;
+        }
+        else {
+            while (pos < end && *pos != ',' && *pos != '}' && *pos != ']' && *pos != ' ' && *pos != '\n' && *pos != '\r' && *pos != '\t') pos++;
+        }
+        out = std::string_view(start, pos - start);
+        return true;
+    }
+
+    bool parseScene() {
+        if (!expect('{')) return false;
+        if (next('}')) return true;
+        do {
+            std::string_view name;
+            if (!parseString(name) || !expect(':')) return false;
+            skipWhitespace();
+            if (pos < end && *pos == '[') {
+                pos++;
+                if (next(']')) continue;
+                do {
+                    if (!parseInstance()) return false;
+                } while (next(','));
+                if (!expect(']')) return false;
+            }
+            else {
+                std::string_view value;
+                if (!parseRaw(value)) return false;
+                properties.push_back({ -1, name, value });
+            }
+        } while (next(','));
+        return expect('}');
+    }
+
+    bool parseInstance() {
+        if (!expect('{')) return false;
+        int instance = (int)worlds.size();
+        worlds.emplace_back();
+        instanceMeshes.push_back(-1);
+        instanceCollides.push_back(1);
+        if (!next('}')) {
+            do {
+                std::string_view name;
+                if (!parseString(name) || !expect(':')) return false;
+                if (name == "filename") {
+                    std::string_view filename;
+                    if (!parseString(filename)) return false;
+                    instanceMeshes[instance] = meshFor(filename);
+                }
+                else if (name == "world") {
+                    if (!expect('[')) return false;
+                    for (int i = 0; i < 16; i++) {
+                        if ((i > 0 && !expect(',')) || !parseFloat(worlds[instance].m[i])) return false;
+                    }
+                    if (!expect(']')) return false;
+                }
+                else {
+                    std::string_view value;
+                    if (!parseRaw(value)) return false;
+                    if (name == "collision" && (value == "false" || value == "0" || value == "none")) instanceCollides[instance] = 0;
+                    properties.push_back({ instance, name, value });
+                }
+            } while (next(','));
+            if (!expect('}')) return false;
+        }
+        // Nothing to draw without a mesh, as GEMScene would be left with an empty filename
+        if (instanceMeshes[instance] == -1) {
+            worlds.pop_back();
+            instanceMeshes.pop_back();
+            instanceCollides.pop_back();
+            while (!properties.empty() && properties.back().instance == instance) properties.pop_back();
+        }
+        return true;
+    }
+
+    int meshFor(std::string_view filename) {
+        if (lastMesh != -1 && filename == lastName) return lastMesh;
+        auto found = meshIndex.find(filename);
+        if (found == meshIndex.end()) {
+            // Once per way a name is written, which may differ only in escapes
+            std::string name = unescape(filename);
+            int mesh = (int)(std::find(meshFilenames.begin(), meshFilenames.end(), name) - meshFilenames.begin());
+            if (mesh == (int)meshFilenames.size()) meshFilenames.push_back(std::move(name));
+            found = meshIndex.emplace(filename, mesh).first;
+        }
+        lastName = filename;
+        lastMesh = found->second;
+        return lastMesh;
+    }
+
+    // Only filenames are copied out of the file, so only they need their escapes resolved
+    static std::string unescape(std::string_view s) {
+        std::string out;
+        out.reserve(s.size());
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] != '\\' || i + 1 == s.size()) {
+                out.push_back(s[i]);
+                continue;
+            }
+            char c = s[++i];
+            if (c == 'n') out.push_back('\n');
+            else if (c == 't') out.push_back('\t');
+            else if (c == 'u' && i + 4 < s.size()) {
+                unsigned int code = 0;
+                std::from_chars(s.data() + i + 1, s.data() + i + 5, code, 16);
+                out.push_back(code < 128 ? (char)code : '?');
+                i += 4;
+            }
+            else out.push_back(c);
+        }
+        return out;
+    }
+};
@@ -103,11 +103,12 @@ public:
         return shaders[name] = compile(name, path, "VS", "vs_5_0");
     }
 
-    ID3DBlob* loadPS(const std::string& name, const std::string& path) {
+    // Shaders indexing an unbounded texture array need target ps_5_1
+    ID3DBlob* loadPS(const std::string& name, const std::string& path, const std::string& target = "ps_5_0") {
         if (shaders.count(name))
             return shaders[name];
 
-        return shaders[name] = compile(name, path, "PS", "ps_5_0");
+        return shaders[name] = compile(name, path, "PS", target);
     }
 
     void updateTexturePS(Core* core, std::string shaderName, std::string textureName, int textureHeapIndex) {
@@ -132,7 +133,7 @@ public:
         long long offsetIndex = (long long)textureHeapIndex - (long long)bindPoint;
 
         handle.ptr += offsetIndex * core->srvHeap.incrementSize;
-        core->getCommandList()->SetGraphicsRootDescriptorTable(2, handle);
+        core->drawStream.setDescriptorTable(handle.ptr);
     }
 
     int getBindPoint(const std::string& shaderName, const std::string& textureName) {
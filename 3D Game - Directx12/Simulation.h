@@ -0,0 +1,285 @@
+#pragma once
+#include "Player.h"
+#include "PlayerAnimManager.h"
+#include "EnemyManager.h"
+#include "BulletManager.h"
+#include "TransformBatch.h"
+#include "Input.h"
+#include "Profiler.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+
+// Everything the renderer needs from one simulation tick. Published as shared_ptr<const ...> and never modified afterwards.
+struct SimulationSnapshot
+{
+    unsigned long long tick = 0;
+    std::chrono::steady_clock::time_point time;
+
+    Vec3 playerPosition;
+    Vec3 playerRotation;
+    std::vector<Matrix> gunBones;
+
+    int bonesPerEnemy = 0;
+    std::vector<unsigned int> enemyIds; // EnemyId of each row, rows are not the same enemy from one snapshot to the next
+    std::vector<Vec3> enemyPositions;
+    std::vector<float> enemyRotationsY;
+    std::vector<Vec3> enemyScales;
+    std::vector<char> enemyAlive;
+    std::vector<Matrix> enemyBones;
+
+    std::vector<Vec3> bulletPositions;
+    std::vector<Vec3> bulletVelocities;
+
+    // FNV-1a over the gameplay state, the wall clock time is left out so replays of the same input hash the same
+    unsigned long long hash() const {
+        unsigned long long h = 14695981039346656037ull;
+        auto add = [&h](const void* data, size_t size) {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++) {
+                h = (h ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        add(&tick, sizeof(tick));
+        add(&playerPosition, sizeof(Vec3));
+        add(&playerRotation, sizeof(Vec3));
+        add(gunBones.data(), gunBones.size() * sizeof(Matrix));
+        add(enemyPositions.data(), enemyPositions.size() * sizeof(Vec3));
+        add(enemyRotationsY.data(), enemyRotationsY.size() * sizeof(float));
+        add(enemyAlive.data(), enemyAlive.size());
+        add(enemyBones.data(), enemyBones.size() * sizeof(Matrix));
+        add(bulletPositions.data(), bulletPositions.size() * sizeof(Vec3));
+        return h;
+    }
+};
+
+// Snapshot state blended between the last two ticks for the frame being drawn
+struct RenderState
+{
+    Vec3 playerPosition;
+    Vec3 playerRotation;
+    std::vector<Matrix> enemyWorlds;
+    std::vector<Vec3> bulletPositions;
+};
+
+class Simulation {
+public:
+    float step = 1.0f / 60.0f;
+    int maxStepsPerFrame = 8; // Caps catch-up after a long stall instead of spiralling
+    float accumulator = 0.0f;
+    unsigned long long tick = 0;
+
+    Player* player = nullptr;
+    PlayerAnimManager* playerAnim = nullptr;
+    AnimationInstance* gunAnim = nullptr;
+    EnemyManager* enemies = nullptr;
+    BulletManager* bullets = nullptr;
+    InputSource* input = nullptr;
+    const std::vector<AABB>* obstacles = nullptr;
+
+    void init(Player* _player, PlayerAnimManager* _playerAnim, AnimationInstance* _gunAnim, EnemyManager* _enemies,
+        BulletManager* _bullets, InputSource* _input, const std::vector<AABB>* _obstacles) {
+        player = _player;
+        playerAnim = _playerAnim;
+        gunAnim = _gunAnim;
+        enemies = _enemies;
+        bullets = _bullets;
+        input = _input;
+        obstacles = _obstacles;
+        publish();
+        publish();
+    }
+
+    ~Simulation() {
+        stop();
+    }
+
+    // Level streaming changes, taken at the start of the next tick so a threaded simulation never has the
+    // obstacles change under it. Spawns are added to what is already queued.
+    void queueWorldChange(std::shared_ptr<const std::vector<AABB>> newObstacles, const std::vector<Vec3>& spawnPositions, const std::vector<Vec3>& spawnScales) {
+        std::lock_guard<std::mutex> lock(worldMutex);
+        if (newObstacles) queuedObstacles = newObstacles;
+        queuedSpawnPositions.insert(queuedSpawnPositions.end(), spawnPositions.begin(), spawnPositions.end());
+        queuedSpawnScales.insert(queuedSpawnScales.end(), spawnScales.begin(), spawnScales.end());
+    }
+
+    // Runs one fixed step of gameplay, always with the same dt
+    void tickOnce() {
+        PROFILE_SCOPE("Simulation tick");
+        applyWorldChanges();
+        {
+            PROFILE_SCOPE("Player update");
+            player->update(step, input->sample(), *obstacles);
+        }
+        {
+            PROFILE_SCOPE("Player animation");
+            playerAnim->update(step, *player, *obstacles);
+
+            if (player->isReloading && playerAnim->isCurrentActionFinished()) {
+                player->completeReload();
+            }
+        }
+        {
+            PROFILE_SCOPE("Enemy update");
+            enemies->update(step, player->position);
+        }
+        {
+            PROFILE_SCOPE("Bullet update");
+            bullets->update(step, *enemies, *obstacles);
+        }
+
+        tick++;
+        PROFILE_SCOPE("Publish snapshot");
+        publish();
+    }
+
+    // Single threaded mode, runs as many fixed steps as the frame time covers
+    void advance(float frameDt) {
+        accumulator += frameDt;
+        if (accumulator > step * maxStepsPerFrame) {
+            accumulator = step * maxStepsPerFrame;
+        }
+        while (accumulator >= step) {
+            tickOnce();
+            accumulator -= step;
+        }
+    }
+
+    // Threaded mode, the simulation ticks on its own clock and the renderer only reads snapshots
+    void start() {
+        if (running) return;
+        running = true;
+        worker = std::thread([this]() {
+            auto stepDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(step));
+            auto next = std::chrono::steady_clock::now();
+            while (running) {
+                tickOnce();
+                next += stepDuration;
+                auto now = std::chrono::steady_clock::now();
+                if (now - next > stepDuration * maxStepsPerFrame) {
+                    next = now;
+                }
+                std::this_thread::sleep_until(next);
+            }
+        });
+    }
+
+    void stop() {
+        if (!running) return;
+        running = false;
+        worker.join();
+    }
+
+    bool isThreaded() {
+        return running;
+    }
+
+    // Returns the two newest snapshots and how far between them the frame being drawn is
+    float latest(std::shared_ptr<const SimulationSnapshot>& prev, std::shared_ptr<const SimulationSnapshot>& cur) {
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            prev = previous;
+            cur = current;
+        }
+        if (!running) {
+            return accumulator / step;
+        }
+        std::chrono::duration<float> since = std::chrono::steady_clock::now() - cur->time;
+        return std::min(since.count() / step, 1.0f);
+    }
+
+    static float lerpAngle(float a, float b, float t) {
+        float d = fmodf(b - a, 6.2831853f);
+        if (d > 3.14159265f) d -= 6.2831853f;
+        if (d < -3.14159265f) d += 6.2831853f;
+        return a + d * t;
+    }
+
+    void interpolate(const SimulationSnapshot& prev, const SimulationSnapshot& cur, float alpha, RenderState& out) const {
+        out.playerPosition = lerp(prev.playerPosition, cur.playerPosition, alpha);
+        out.playerRotation = Vec3(
+            lerpAngle(prev.playerRotation.x, cur.playerRotation.x, alpha),
+            lerpAngle(prev.playerRotation.y, cur.playerRotation.y, alpha),
+            lerpAngle(prev.playerRotation.z, cur.playerRotation.z, alpha));
+
+        // Enemies are blended with the row holding the same id in prev, found by index while rows have not moved.
+        // One spawned since prev has nothing to blend with and is drawn where it is.
+        int enemyCount = (int)cur.enemyPositions.size();
+        std::vector<Vec3> positions(enemyCount);
+        std::vector<float> rotations(enemyCount);
+        std::unordered_map<unsigned int, int> prevRows;
+        for (int i = 0; i < enemyCount; i++) {
+            int row = -1;
+            if (i < (int)prev.enemyIds.size() && prev.enemyIds[i] == cur.enemyIds[i]) {
+                row = i;
+            }
+            else {
+                if (prevRows.empty()) {
+                    for (int j = 0; j < (int)prev.enemyIds.size(); j++) prevRows[prev.enemyIds[j]] = j;
+                }
+                auto found = prevRows.find(cur.enemyIds[i]);
+                if (found != prevRows.end()) row = found->second;
+            }
+            positions[i] = row != -1 ? lerp(prev.enemyPositions[row], cur.enemyPositions[i], alpha) : cur.enemyPositions[i];
+            rotations[i] = row != -1 ? lerpAngle(prev.enemyRotationsY[row], cur.enemyRotationsY[i], alpha) : cur.enemyRotationsY[i];
+        }
+        out.enemyWorlds.resize(enemyCount);
+        TransformBatch::compose(positions.data(), nullptr, rotations.data(), cur.enemyScales.data(), out.enemyWorlds.data(), enemyCount);
+
+        // Bullets are swapped out of their arrays when they die, so step them back along their velocity instead of matching
+        // indices. The ticks between the snapshots are what they moved over, however late either was published.
+        float back = (1.0f - alpha) * (float)(cur.tick - prev.tick) * step;
+        out.bulletPositions.resize(cur.bulletPositions.size());
+        for (int i = 0; i < (int)cur.bulletPositions.size(); i++) {
+            out.bulletPositions[i] = cur.bulletPositions[i] - cur.bulletVelocities[i] * back;
+        }
+    }
+
+private:
+    std::shared_ptr<const SimulationSnapshot> previous;
+    std::shared_ptr<const SimulationSnapshot> current;
+    std::mutex snapshotMutex;
+    std::thread worker;
+    std::atomic<bool> running = false;
+
+    std::mutex worldMutex;
+    std::shared_ptr<const std::vector<AABB>> queuedObstacles;
+    std::shared_ptr<const std::vector<AABB>> streamedObstacles; // Keeps what obstacles points at alive once swapped in
+    std::vector<Vec3> queuedSpawnPositions;
+    std::vector<Vec3> queuedSpawnScales;
+
+    void applyWorldChanges() {
+        std::lock_guard<std::mutex> lock(worldMutex);
+        if (queuedObstacles) {
+            streamedObstacles = std::move(queuedObstacles);
+            obstacles = streamedObstacles.get();
+        }
+        for (int i = 0; i < (int)queuedSpawnPositions.size(); i++) {
+            enemies->spawnEnemy(queuedSpawnPositions[i], queuedSpawnScales[i]);
+        }
+        queuedSpawnPositions.clear();
+        queuedSpawnScales.clear();
+    }
+
+    void publish() {
+        std::shared_ptr<SimulationSnapshot> s = std::make_shared<SimulationSnapshot>();
+        s->tick = tick;
+        s->time = std::chrono::steady_clock::now();
+
+        s->playerPosition = player->position;
+        s->playerRotation = player->rotation;
+        s->gunBones.assign(gunAnim->matrices, gunAnim->matrices + gunAnim->animation->bonesSize());
+
+        enemies->writeSnapshot(s->enemyIds, s->enemyPositions, s->enemyRotationsY, s->enemyScales, s->enemyAlive, s->enemyBones, s->bonesPerEnemy);
+        bullets->writeSnapshot(s->bulletPositions, s->bulletVelocities);
+
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        previous = current ? current : s;
+        current = s;
+    }
+};
@@ -97,6 +97,7 @@ public:
 
     void draw(Core* core, Matrix world, Matrix vp) {
         psoMgr.bind(core, "SpherePSO");
+        core->drawStream.setObjectPosition(world.m[3], world.m[7], world.m[11]);
         SphereConstantBuffer cbData;
         cbData.W = world;
         cbData.VP = vp;
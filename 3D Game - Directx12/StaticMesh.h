@@ -7,6 +7,8 @@
 #include "Vertex.h"
 #include "ShaderManager.h"
 #include "PSOManager.h"
+#include "AssetLoader.h"
+#include "Collision.h"
 
 using namespace std;
 
@@ -24,35 +26,75 @@ public:
     const std::string vsPath = "vertexShader.hlsl";
     const std::string psPath = "pixelShader.hlsl";
 
-    void init(Core* core, std::string filename) {
-        ID3DBlob* vs = shaderMgr.loadVS("staticVS", vsPath);
-        ID3DBlob* ps = shaderMgr.loadPS("staticPS", psPath);
+    bool ready = false; // Set once uploaded, draw does nothing before
+    vector<vector<STATIC_VERTEX>> loadedVertices; // From loadFile, held until upload
+    vector<vector<unsigned int>> loadedIndices;
+    AABB bounds; // Of every vertex in model space, set by loadFile
 
-        D3D12_INPUT_LAYOUT_DESC layout = VertexLayoutCache::getStaticLayout();
-
-        psoMgr.createPSO(core, "StaticMeshPSO", vs, ps, layout);
+    void init(Core* core, std::string filename) {
+        loadFile(filename);
+        upload(core);
+    }
 
+    // Reads and parses the model and nothing else, so it can run on a loading thread
+    bool loadFile(const std::string& filename) {
         GEMLoader::GEMModelLoader loader;
         vector<GEMLoader::GEMMesh> gemmeshes;
         loader.load(filename, gemmeshes);
 
         for (int i = 0; i < gemmeshes.size(); i++) {
-            Mesh* mesh = new Mesh();
-            std::vector<STATIC_VERTEX> vertices;
-
+            std::vector<STATIC_VERTEX> vertices(gemmeshes[i].verticesStatic.size());
             for (int j = 0; j < gemmeshes[i].verticesStatic.size(); j++) {
-                STATIC_VERTEX v;
-                memcpy(&v, &gemmeshes[i].verticesStatic[j], sizeof(STATIC_VERTEX));
-                vertices.push_back(v);
+                memcpy(&vertices[j], &gemmeshes[i].verticesStatic[j], sizeof(STATIC_VERTEX));
+                bounds.extend(vertices[j].pos);
             }
+            loadedVertices.push_back(std::move(vertices));
+            loadedIndices.push_back(std::move(gemmeshes[i].indices));
+        }
+        return !loadedVertices.empty();
+    }
 
-            mesh->init(core, vertices, gemmeshes[i].indices);
+    // Creates the pipeline and the GPU buffers from what loadFile read
+    void upload(Core* core) {
+        ID3DBlob* vs = shaderMgr.loadVS("staticVS", vsPath);
+        ID3DBlob* ps = shaderMgr.loadPS("staticPS", psPath);
+
+        D3D12_INPUT_LAYOUT_DESC layout = VertexLayoutCache::getStaticLayout();
+
+        psoMgr.createPSO(core, "StaticMeshPSO", vs, ps, layout);
+
+        for (int i = 0; i < loadedVertices.size(); i++) {
+            Mesh* mesh = new Mesh();
+            mesh->init(core, loadedVertices[i], loadedIndices[i]);
             meshes.push_back(mesh);
         }
+        loadedVertices.clear();
+        loadedIndices.clear();
+        ready = true;
+    }
+
+    // Returns at once with the asset id, the file is read on one of assets' threads and uploaded when it is pumped
+    int loadAsync(Core* core, AssetLoader* assets, const std::string& filename, bool keepRecord = true) {
+        return assets->submit(filename, [this, filename]() { return loadFile(filename); }, [this, core]() { upload(core); }, keepRecord);
+    }
+
+    // Frees the GPU buffers once the frames in flight are done with them, after which it can be loaded again.
+    // Only once ready: a load still in flight would upload after this.
+    void release(Core* core) {
+        for (Mesh* mesh : meshes) {
+            mesh->releaseAfterFrame(core);
+            delete mesh;
+        }
+        meshes.clear();
+        bounds = AABB();
+        ready = false;
     }
 
     void draw(Core* core, Matrix world, Matrix vp) {
+        if (!ready)
+            return;
         psoMgr.bind(core, "StaticMeshPSO");
+        core->drawStream.setObjectPosition(world.m[3], world.m[7], world.m[11]);
 
         StaticMeshConstantBuffer cbData;
         cbData.W = world;
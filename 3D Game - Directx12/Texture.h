@@ -1,46 +1,145 @@
 #pragma once
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 #include <string> 
 #include <d3d12.h>
 #include "Core.h"
+#include "Image.h"
+#include "TextureCook.h"
 using namespace std;
 
 class Texture {
 public:
-	ID3D12Resource* tex;
-	int heapOffset;
+	ID3D12Resource* tex = nullptr;
+	int heapOffset = -1;
 	int width = 0;
 	int height = 0;
 	int channels = 0;
 
 	vector<unsigned char> pixels;
+
+	// Streaming: the GPU texture holds levels [residentMip, levels) of source, which keeps every level in system
+	// memory so the texture can grow back. streamId is the texture's id in TextureManager's residency, -1 if not streamed.
+	CookedTexture source;
+	int residentMip = 0;
+	int streamId = -1;
+
 	void load(Core* core, string filename) {
-		unsigned char* texels = stbi_load(filename.c_str(), &width, &height, &channels, 0);
-		if (channels == 3) {
-			channels = 4;
-			unsigned char* texelsWithAlpha = new unsigned char[width * height * channels];
-			for (int i = 0; i < (width * height); i++) {
-				texelsWithAlpha[i * 4] = texels[i * 3];
-				texelsWithAlpha[(i * 4) + 1] = texels[(i * 3) + 1];
-				texelsWithAlpha[(i * 4) + 2] = texels[(i * 3) + 2];
-				texelsWithAlpha[(i * 4) + 3] = 255;
+		CookedTexture cooked;
+		if (TextureCook::prepare(filename, cooked)) {
+			upload(core, cooked);
+		}
+	}
+
+	// texels is RGB8 or RGBA8 with packed rows, the full mip chain is built from it. Every level is written straight
+	// into the mapped staging buffer; RGBA8 input is not copied anywhere else on the way. False when the SRV heap
+	// is full, see createView.
+	bool upload(Core* core, const unsigned char* texels, int _width, int _height, int _channels) {
+		std::vector<ImageLevel> levels(ImageProcessing::mipCount(_width, _height));
+		const unsigned char* top = texels;
+		if (_channels == 3) {
+			// The mips need RGBA8 to filter from
+			levels[0].width = _width;
+			levels[0].height = _height;
+			levels[0].pixels.resize((size_t)_width * _height * 4);
+			ImageProcessing::expandRGB(texels, levels[0].pixels.data(), _width * _height);
+			top = levels[0].pixels.data();
+		}
+		if (levels.size() > 1) {
+			ImageProcessing::downsample(top, _width, _height, levels[1]);
+		}
+		for (int i = 2; i < (int)levels.size(); i++) {
+			ImageProcessing::downsample(levels[i - 1], levels[i]);
+		}
+
+		width = _width;
+		height = _height;
+		channels = 4;
+		residentMip = 0;
+		create(core, CookedRGBA8, _width, _height, (int)levels.size());
+		TextureStaging staging = core->beginTextureUpload(tex, (int)levels.size());
+		ImageProcessing::copyRows(top, (size_t)_width * 4, staging.level(0), staging.rowPitch(0), (size_t)_width * 4, _height);
+		for (int i = 1; i < (int)levels.size(); i++) {
+			size_t rowBytes = (size_t)levels[i].width * 4;
+			ImageProcessing::copyRows(levels[i].pixels.data(), rowBytes, staging.level(i), staging.rowPitch(i), rowBytes, levels[i].height);
+		}
+		core->endTextureUpload(staging, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		return createView(core, CookedRGBA8, (int)levels.size());
+	}
+
+	static DXGI_FORMAT dxgiFormat(CookedFormat format) {
+		switch (format) {
+		case CookedBC1: return DXGI_FORMAT_BC1_UNORM;
+		case CookedBC3: return DXGI_FORMAT_BC3_UNORM;
+		case CookedBC5: return DXGI_FORMAT_BC5_UNORM;
+		default: return DXGI_FORMAT_R8G8B8A8_UNORM;
+		}
+	}
+
+	// Uploads levels [firstMip, levels) of cooked, all of them by default. False when the SRV heap is full.
+	bool upload(Core* core, const CookedTexture& cooked, int firstMip = 0) {
+		width = cooked.width;
+		height = cooked.height;
+		channels = 4;
+		residentMip = firstMip;
+		int levelCount = (int)cooked.levels.size() - firstMip;
+		create(core, cooked.format, std::max(cooked.width >> firstMip, 1), std::max(cooked.height >> firstMip, 1), levelCount);
+
+		std::vector<const unsigned char*> levelData;
+		for (int i = firstMip; i < (int)cooked.levels.size(); i++)
+		{
+			levelData.push_back(cooked.levels[i].data());
+		}
+		core->uploadTexture(tex, levelData.data(), levelCount, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		return createView(core, cooked.format, levelCount);
+	}
+
+	// Swaps the GPU texture for one holding levels [mip, levels) of source. Levels both have are copied on the GPU,
+	// new ones are uploaded from source. Recorded into the current frame, so call it before the frame's draws
+	// pick up heapOffset: the view moves to a new descriptor and the old texture is released once the frames
+	// in flight are done with it. When the SRV heap is full the texture stays as it is.
+	void setResidentMip(Core* core, int mip) {
+		if (mip == residentMip || source.levels.empty()) return;
+		int view = core->srvHeap.allocate();
+		if (view == DescriptorAllocator::invalid) return;
+		int levelCount = (int)source.levels.size();
+		ID3D12Resource* old = tex;
+		int oldMip = residentMip;
+		ID3D12GraphicsCommandList4* list = core->getCommandList();
+
+		create(core, source.format, std::max(source.width >> mip, 1), std::max(source.height >> mip, 1), levelCount - mip);
+		Barrier::add(old, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE, list);
+		for (int level = std::max(mip, oldMip); level < levelCount; level++) {
+			D3D12_TEXTURE_COPY_LOCATION src = {};
+			src.pResource = old;
+			src.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			src.SubresourceIndex = level - oldMip;
+			D3D12_TEXTURE_COPY_LOCATION dst = {};
+			dst.pResource = tex;
+			dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			dst.SubresourceIndex = level - mip;
+			list->CopyTextureRegion(&dst, 0, 0, 0, &src, NULL);
+		}
+		if (mip < oldMip) {
+			TextureStaging staging = core->beginTextureUpload(tex, oldMip - mip);
+			for (int i = 0; i < oldMip - mip; i++) {
+				size_t rowBytes = (size_t)staging.rowSizes[i];
+				ImageProcessing::copyRows(source.levels[mip + i].data(), rowBytes, staging.level(i), staging.rowPitch(i), rowBytes, staging.numRows[i]);
 			}
-			upload(core, texelsWithAlpha, width, height, channels);
-			delete[] texelsWithAlpha;
+			core->endTextureUpload(staging, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 		}
 		else {
-			upload(core, texels, width, height, channels);
+			Barrier::add(tex, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, list);
 		}
-		stbi_image_free(texels);
-	}
-	void upload(Core* core, unsigned char* texels, int _width, int _height, int _channels) {
+		core->releaseAfterFrame(old);
 
-		this->width = _width;
-		this->height = _height;
-		this->channels = _channels;
+		core->srvHeap.free(heapOffset);
+		heapOffset = view;
+		writeView(core, source.format, levelCount - mip);
+		residentMip = mip;
+	}
 
-		DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	// The resource starts in COPY_DEST, ready for an upload
+	void create(Core* core, CookedFormat cookedFormat, int _width, int _height, int levelCount) {
+		DXGI_FORMAT format = dxgiFormat(cookedFormat);
 
 		D3D12_HEAP_PROPERTIES heapDesc = {};
 		heapDesc.Type = D3D12_HEAP_TYPE_DEFAULT;
@@ -50,7 +149,7 @@ public:
 		textureDesc.Width = _width;
 		textureDesc.Height = _height;
 		textureDesc.DepthOrArraySize = 1;
-		textureDesc.MipLevels = 1;
+		textureDesc.MipLevels = (UINT16)levelCount;
 		textureDesc.Format = format;
 		textureDesc.SampleDesc.Count = 1;
 		textureDesc.SampleDesc.Quality = 0;
@@ -59,26 +158,39 @@ public:
 
 		core->device->CreateCommittedResource(&heapDesc, D3D12_HEAP_FLAG_NONE, &textureDesc,
 			D3D12_RESOURCE_STATE_COPY_DEST, NULL, IID_PPV_ARGS(&tex));
+	}
 
-		D3D12_RESOURCE_DESC desc = tex->GetDesc();
-		UINT64 textureUploadBufferSize;
-		D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
-
-		core->device->GetCopyableFootprints(&desc, 0, 1, 0, &footprint, NULL, NULL, &textureUploadBufferSize);
-
-		core->uploadResource(tex, texels, _width * _height * 4,
-			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, &footprint);
+	// With the SRV heap full the texture is released and heapOffset left at -1, so TextureManager draws the
+	// placeholder in its place
+	bool createView(Core* core, CookedFormat cookedFormat, int levelCount) {
+		heapOffset = core->srvHeap.allocate();
+		if (heapOffset == DescriptorAllocator::invalid) {
+			core->releaseAfterFrame(tex);
+			tex = nullptr;
+			return false;
+		}
+		writeView(core, cookedFormat, levelCount);
+		return true;
+	}
 
-		D3D12_CPU_DESCRIPTOR_HANDLE srvHandle = core->srvHeap.getNextCPUHandle();
+	void writeView(Core* core, CookedFormat cookedFormat, int levelCount) {
+		D3D12_CPU_DESCRIPTOR_HANDLE srvHandle = core->srvHeap.getCPUHandle(heapOffset);
 		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-		srvDesc.Format = format;
+		srvDesc.Format = dxgiFormat(cookedFormat);
 		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-		srvDesc.Texture2D.MipLevels = 1;
+		srvDesc.Texture2D.MipLevels = (UINT)levelCount;
 
 		core->device->CreateShaderResourceView(tex, &srvDesc, srvHandle);
+	}
 
-		heapOffset = core->srvHeap.used - 1;
+	// The descriptor and the texture are recycled once the frames that may still sample them have finished
+	void free(Core* core) {
+		core->srvHeap.free(heapOffset);
+		heapOffset = -1;
+		if (tex) core->releaseAfterFrame(tex);
+		tex = nullptr;
+		source = CookedTexture();
 	}
 
 };
\ No newline at end of file
@@ -0,0 +1,467 @@
+#pragma once
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "Image.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <climits>
+#include <iterator>
+#include <algorithm>
+#include <cctype>
+
+// Block compression for textures and the cache the compressed mips are kept in between runs.
+// Albedo is stored as BC1 (BC3 when it has alpha), normal maps as BC5 and packed material maps (*_rmax) as BC3.
+// A cooked file sits next to its source as <source>.texc and is only used while the hash of the source bytes it
+// was cooked from still matches, so editing a PNG re-cooks it on the next load.
+
+enum CookedFormat { CookedRGBA8, CookedBC1, CookedBC3, CookedBC5 };
+
+struct CookedTextureHeader
+{
+	char magic[4] = { 'T', 'E', 'X', 'C' };
+	unsigned int version = 1;
+	unsigned long long sourceHash = 0;
+	unsigned int format = CookedRGBA8;
+	int width = 0;
+	int height = 0;
+	int levels = 0;
+};
+
+struct CookedTexture
+{
+	CookedFormat format = CookedRGBA8;
+	int width = 0;
+	int height = 0;
+	std::vector<std::vector<unsigned char>> levels; // Rows of 4x4 blocks, or RGBA8 rows, tightly packed
+};
+
+class BlockCompression
+{
+public:
+	static int blockBytes(CookedFormat format)
+	{
+		return format == CookedBC1 ? 8 : 16;
+	}
+
+	// Copies the 4x4 block at (bx, by) as RGBA, repeating the last row and column past the edge
+	static void fetchBlock(const ImageLevel& level, int bx, int by, unsigned char block[64])
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			int sy = std::min(by * 4 + y, level.height - 1);
+			for (int x = 0; x < 4; x++)
+			{
+				int sx = std::min(bx * 4 + x, level.width - 1);
+				memcpy(&block[(y * 4 + x) * 4], &level.pixels[((size_t)sy * level.width + sx) * 4], 4);
+			}
+		}
+	}
+
+	// Endpoints are the extremes of the block's colours along their principal axis, snapped to 565
+	static void encodeBC1(const unsigned char block[64], unsigned char out[8])
+	{
+		float mean[3] = {};
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 3; c++)
+				mean[c] += block[i * 4 + c] / 16.0f;
+
+		float cov[6] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+			cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+			cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+		}
+		float axis[3] = { 1.0f, 1.0f, 1.0f };
+		for (int iter = 0; iter < 8; iter++)
+		{
+			float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+			float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+			float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+			float len = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+			if (len < 1e-6f) break;
+			axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+		}
+
+		float minDot = 1e30f, maxDot = -1e30f;
+		int minIndex = 0, maxIndex = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			float d = block[i * 4] * axis[0] + block[i * 4 + 1] * axis[1] + block[i * 4 + 2] * axis[2];
+			if (d < minDot) { minDot = d; minIndex = i; }
+			if (d > maxDot) { maxDot = d; maxIndex = i; }
+		}
+
+		unsigned short c0 = to565(&block[maxIndex * 4]);
+		unsigned short c1 = to565(&block[minIndex * 4]);
+		if (c0 < c1) std::swap(c0, c1);
+
+		unsigned int indices = 0;
+		if (c0 != c1)
+		{
+			unsigned char palette[4][3];
+			bc1Palette(c0, c1, palette);
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestError = INT_MAX;
+				for (int p = 0; p < 4; p++)
+				{
+					int dr = block[i * 4] - palette[p][0], dg = block[i * 4 + 1] - palette[p][1], db = block[i * 4 + 2] - palette[p][2];
+					int error = dr * dr + dg * dg + db * db;
+					if (error < bestError) { bestError = error; best = p; }
+				}
+				indices |= (unsigned int)best << (i * 2);
+			}
+		}
+		memcpy(out, &c0, 2);
+		memcpy(out + 2, &c1, 2);
+		memcpy(out + 4, &indices, 4);
+	}
+
+	// One channel (stride 4 apart, starting at channel) into 8 interpolated values between its min and max
+	static void encodeBC4(const unsigned char block[64], int channel, unsigned char out[8])
+	{
+		unsigned char lo = 255, hi = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			lo = std::min(lo, block[i * 4 + channel]);
+			hi = std::max(hi, block[i * 4 + channel]);
+		}
+		out[0] = hi;
+		out[1] = lo;
+		unsigned long long indices = 0;
+		if (hi != lo)
+		{
+			unsigned char palette[8];
+			bc4Palette(hi, lo, palette);
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0, bestError = INT_MAX;
+				for (int p = 0; p < 8; p++)
+				{
+					int error = abs(block[i * 4 + channel] - palette[p]);
+					if (error < bestError) { bestError = error; best = p; }
+				}
+				indices |= (unsigned long long)best << (i * 3);
+			}
+		}
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (unsigned char)(indices >> (i * 8));
+	}
+
+	static void encodeBlock(CookedFormat format, const unsigned char block[64], unsigned char* out)
+	{
+		switch (format)
+		{
+		case CookedBC1:
+			encodeBC1(block, out);
+			break;
+		case CookedBC3:
+			encodeBC4(block, 3, out);
+			encodeBC1(block, out + 8);
+			break;
+		case CookedBC5:
+			encodeBC4(block, 0, out);
+			encodeBC4(block, 1, out + 8);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Back to RGBA, used to measure the error of an encode
+	static void decodeBlock(CookedFormat format, const unsigned char* in, unsigned char block[64])
+	{
+		switch (format)
+		{
+		case CookedBC1:
+			decodeBC1(in, block);
+			for (int i = 0; i < 16; i++) block[i * 4 + 3] = 255;
+			break;
+		case CookedBC3:
+			decodeBC1(in + 8, block);
+			decodeBC4(in, 3, block);
+			break;
+		case CookedBC5:
+			decodeBC4(in, 0, block);
+			decodeBC4(in + 8, 1, block);
+			for (int i = 0; i < 16; i++) { block[i * 4 + 2] = 0; block[i * 4 + 3] = 255; }
+			break;
+		default:
+			break;
+		}
+	}
+
+	static void decodeBC1(const unsigned char* in, unsigned char block[64])
+	{
+		unsigned short c0, c1;
+		unsigned int indices;
+		memcpy(&c0, in, 2);
+		memcpy(&c1, in + 2, 2);
+		memcpy(&indices, in + 4, 4);
+		unsigned char palette[4][3];
+		bc1Palette(c0, c1, palette);
+		for (int i = 0; i < 16; i++)
+			memcpy(&block[i * 4], palette[(indices >> (i * 2)) & 3], 3);
+	}
+
+	static void decodeBC4(const unsigned char* in, int channel, unsigned char block[64])
+	{
+		unsigned char palette[8];
+		bc4Palette(in[0], in[1], palette);
+		unsigned long long indices = 0;
+		for (int i = 0; i < 6; i++)
+			indices |= (unsigned long long)in[2 + i] << (i * 8);
+		for (int i = 0; i < 16; i++)
+			block[i * 4 + channel] = palette[(indices >> (i * 3)) & 7];
+	}
+
+private:
+	static unsigned short to565(const unsigned char* rgb)
+	{
+		return (unsigned short)((((rgb[0] * 31 + 127) / 255) << 11) | (((rgb[1] * 63 + 127) / 255) << 5) | ((rgb[2] * 31 + 127) / 255));
+	}
+
+	static void bc1Palette(unsigned short c0, unsigned short c1, unsigned char palette[4][3])
+	{
+		unsigned short c[2] = { c0, c1 };
+		for (int i = 0; i < 2; i++)
+		{
+			int r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+			palette[i][0] = (unsigned char)((r << 3) | (r >> 2));
+			palette[i][1] = (unsigned char)((g << 2) | (g >> 4));
+			palette[i][2] = (unsigned char)((b << 3) | (b >> 2));
+		}
+		for (int ch = 0; ch < 3; ch++)
+		{
+			if (c0 > c1)
+			{
+				palette[2][ch] = (unsigned char)((2 * palette[0][ch] + palette[1][ch] + 1) / 3);
+				palette[3][ch] = (unsigned char)((palette[0][ch] + 2 * palette[1][ch] + 1) / 3);
+			}
+			else
+			{
+				palette[2][ch] = (unsigned char)((palette[0][ch] + palette[1][ch]) / 2);
+				palette[3][ch] = 0;
+			}
+		}
+	}
+
+	static void bc4Palette(unsigned char a0, unsigned char a1, unsigned char palette[8])
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1)
+		{
+			for (int i = 1; i < 7; i++)
+				palette[i + 1] = (unsigned char)(((7 - i) * a0 + i * a1 + 3) / 7);
+		}
+		else
+		{
+			for (int i = 1; i < 5; i++)
+				palette[i + 1] = (unsigned char)(((5 - i) * a0 + i * a1 + 2) / 5);
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+};
+
+class TextureCook
+{
+public:
+	static unsigned long long hashBytes(const std::vector<unsigned char>& bytes)
+	{
+		unsigned long long h = 14695981039346656037ull;
+		for (unsigned char b : bytes)
+			h = (h ^ b) * 1099511628211ull;
+		return h;
+	}
+
+	static bool readFile(const std::string& filename, std::vector<unsigned char>& bytes)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file.is_open()) return false;
+		bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	// Decodes to RGBA8
+	static bool decode(const std::vector<unsigned char>& source, ImageLevel& level)
+	{
+		int w, h, sourceChannels;
+		if (!stbi_info_from_memory(source.data(), (int)source.size(), &w, &h, &sourceChannels)) return false;
+		unsigned char* texels = stbi_load_from_memory(source.data(), (int)source.size(), &w, &h, &sourceChannels, sourceChannels == 3 ? 0 : 4);
+		if (!texels) return false;
+		level.width = w;
+		level.height = h;
+		level.pixels.resize((size_t)w * h * 4);
+		if (sourceChannels == 3)
+		{
+			ImageProcessing::expandRGB(texels, level.pixels.data(), w * h);
+		}
+		else
+		{
+			memcpy(level.pixels.data(), texels, level.pixels.size());
+		}
+		stbi_image_free(texels);
+		return true;
+	}
+
+	// Everything a texture needs before it goes to the GPU. Uses the cooked copy next to the source when it is up to
+	// date, otherwise decodes, builds mips, cooks and caches it. Touches no shared state so it can run on any thread.
+	static bool prepare(const std::string& filename, CookedTexture& cooked, bool useCache = true)
+	{
+		std::vector<unsigned char> source;
+		if (!readFile(filename, source)) return false;
+		unsigned long long sourceHash = hashBytes(source);
+		if (useCache && load(cachePath(filename), sourceHash, cooked)) return true;
+
+		std::vector<ImageLevel> levels(1);
+		if (!decode(source, levels[0])) return false;
+		ImageProcessing::generateMips(levels);
+		cook(levels, chooseFormat(filename, levels[0]), cooked);
+		if (useCache) save(cachePath(filename), sourceHash, cooked);
+		return true;
+	}
+
+	static std::string cachePath(const std::string& source)
+	{
+		return source + ".texc";
+	}
+
+	// BC formats need the top level to be a multiple of 4 on both sides, anything else stays RGBA8
+	static CookedFormat chooseFormat(const std::string& filename, const ImageLevel& level)
+	{
+		if (level.width % 4 != 0 || level.height % 4 != 0) return CookedRGBA8;
+		std::string name = filename;
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)tolower(c); });
+		if (name.find("_nh") != std::string::npos || name.find("_normal") != std::string::npos) return CookedBC5;
+		if (name.find("_rmax") != std::string::npos) return CookedBC3;
+		for (size_t i = 3; i < level.pixels.size(); i += 4)
+		{
+			if (level.pixels[i] != 255) return CookedBC3;
+		}
+		return CookedBC1;
+	}
+
+	// Bytes of one level of a cooked texture, as cook lays it out and Core::uploadTexture reads it. Levels below 4x4
+	// still take a whole block.
+	static size_t levelBytes(CookedFormat format, int width, int height)
+	{
+		if (format == CookedRGBA8) return (size_t)width * height * 4;
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockCompression::blockBytes(format);
+	}
+
+	// RGBA8 levels are moved into out rather than copied, the other formats leave levels untouched
+	static void cook(std::vector<ImageLevel>& levels, CookedFormat format, CookedTexture& out)
+	{
+		out.format = format;
+		out.width = levels[0].width;
+		out.height = levels[0].height;
+		out.levels.resize(levels.size());
+		for (int i = 0; i < (int)levels.size(); i++)
+		{
+			const ImageLevel& level = levels[i];
+			if (format == CookedRGBA8)
+			{
+				out.levels[i].swap(levels[i].pixels);
+				continue;
+			}
+			int blocksWide = (level.width + 3) / 4;
+			int blocksHigh = (level.height + 3) / 4;
+			int bytes = BlockCompression::blockBytes(format);
+			out.levels[i].resize(levelBytes(format, level.width, level.height));
+			unsigned char block[64];
+			for (int by = 0; by < blocksHigh; by++)
+			{
+				for (int bx = 0; bx < blocksWide; bx++)
+				{
+					BlockCompression::fetchBlock(level, bx, by, block);
+					BlockCompression::encodeBlock(format, block, &out.levels[i][((size_t)by * blocksWide + bx) * bytes]);
+				}
+			}
+		}
+	}
+
+	// Peak signal to noise ratio in dB of a compressed level against its source, over the channels the format keeps
+	static double psnr(const ImageLevel& source, const std::vector<unsigned char>& blocks, CookedFormat format)
+	{
+		int blocksWide = (source.width + 3) / 4;
+		int bytes = BlockCompression::blockBytes(format);
+		int channels = format == CookedBC5 ? 2 : format == CookedBC1 ? 3 : 4;
+		double error = 0.0;
+		unsigned char decoded[64];
+		for (int y = 0; y < source.height; y++)
+		{
+			for (int x = 0; x < source.width; x++)
+			{
+				if (x % 4 == 0)
+					BlockCompression::decodeBlock(format, &blocks[((size_t)(y / 4) * blocksWide + x / 4) * bytes], decoded);
+				const unsigned char* a = &source.pixels[((size_t)y * source.width + x) * 4];
+				const unsigned char* b = &decoded[((y % 4) * 4 + x % 4) * 4];
+				for (int c = 0; c < channels; c++)
+					error += (double)(a[c] - b[c]) * (a[c] - b[c]);
+			}
+		}
+		double mse = error / ((double)source.width * source.height * channels);
+		return mse <= 0.0 ? 99.0 : 10.0 * log10(255.0 * 255.0 / mse);
+	}
+
+	static bool save(const std::string& filename, unsigned long long sourceHash, const CookedTexture& texture)
+	{
+		std::ofstream file(filename, std::ios::binary);
+		if (!file.is_open()) return false;
+		CookedTextureHeader header;
+		header.sourceHash = sourceHash;
+		header.format = texture.format;
+		header.width = texture.width;
+		header.height = texture.height;
+		header.levels = (int)texture.levels.size();
+		file.write((const char*)&header, sizeof(header));
+		for (const std::vector<unsigned char>& level : texture.levels)
+		{
+			unsigned int size = (unsigned int)level.size();
+			file.write((const char*)&size, sizeof(size));
+			file.write((const char*)level.data(), size);
+		}
+		return file.good();
+	}
+
+	// Fails if the file is missing, from another cook version or was cooked from different source bytes, and if its
+	// header or level sizes do not describe a texture cook could have made, so a damaged file is cooked again
+	// rather than uploaded short
+	static bool load(const std::string& filename, unsigned long long sourceHash, CookedTexture& texture)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file.is_open()) return false;
+		CookedTextureHeader header;
+		CookedTextureHeader expected;
+		file.read((char*)&header, sizeof(header));
+		if (!file || memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version || header.sourceHash != sourceHash)
+			return false;
+		const int maxSize = 16384; // D3D12_REQ_TEXTURE2D_U_OR_V_DIMENSION
+		bool blocks = header.format != CookedRGBA8;
+		if (header.format > CookedBC5 || header.width <= 0 || header.height <= 0 || header.width > maxSize || header.height > maxSize ||
+			(blocks && (header.width % 4 != 0 || header.height % 4 != 0)) ||
+			header.levels < 1 || header.levels > ImageProcessing::mipCount(header.width, header.height))
+			return false;
+		texture.format = (CookedFormat)header.format;
+		texture.width = header.width;
+		texture.height = header.height;
+		texture.levels.resize(header.levels);
+		for (int i = 0; i < header.levels; i++)
+		{
+			unsigned int size = 0;
+			file.read((char*)&size, sizeof(size));
+			if (!file || size != levelBytes(texture.format, std::max(header.width >> i, 1), std::max(header.height >> i, 1)))
+				return false;
+			texture.levels[i].resize(size);
+			file.read((char*)texture.levels[i].data(), size);
+		}
+		return (bool)file;
+	}
+};
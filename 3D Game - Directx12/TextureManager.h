@@ -1,37 +1,197 @@
 #pragma once
-#include <map>
+#include <unordered_map>
+#include <memory>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include "Texture.h"
+#include "TextureResidency.h"
+#include "HandlePool.h"
+#include "AssetLoader.h"
 #include "Core.h"
 
+using TextureHandle = ResourceHandle;
+
+// Textures are shared by filename and reached through ref counted handles. Resolve names to handles once at load
+// time; a handle lookup at draw time is an index and a generation check. A texture is unloaded when its last
+// handle is released.
 class TextureManager {
 public:
-    std::map<std::string, Texture*> textureCache;
+    HandlePool<Texture*> textures;
+    std::unordered_map<std::string, TextureHandle> handles; // By filename
+    Texture* placeholder = nullptr; // What find gives for a texture that is still loading
+
+    // With streaming on, textures loaded from then on start with only their levels of streamTailSize texels and
+    // below, and stream grows and shrinks them every frame towards what request asked for, within the budget
+    bool streaming = false;
+    int streamTailSize = 64;
+    TextureResidency residency;
+    std::vector<Texture*> streamed; // By residency id
+    unsigned int streamFrame = 0;
+    std::vector<TextureMipChange> streamLoads;
+    std::vector<TextureMipChange> streamEvictions;
 
     ~TextureManager() {
-        for (auto const& [key, val] : textureCache) {
-            delete val;
+        textures.forEach([](Texture* texture) { delete texture; });
+        delete placeholder;
+    }
+
+    // A 1x1 mid grey texture to draw with while the real ones load
+    void initPlaceholder(Core* core) {
+        unsigned char grey[4] = { 128, 128, 128, 255 };
+        placeholder = new Texture();
+        placeholder->upload(core, grey, 1, 1, 4);
+    }
+
+    // The handle holds a reference, give it back with release
+    TextureHandle load(Core* core, const std::string& filename) {
+        return load(core, std::vector<std::string>{ filename })[0];
+    }
+
+    void initStreaming(size_t budgetBytes, int maxLoadsPerFrame = 4) {
+        streaming = true;
+        residency.init(budgetBytes, maxLoadsPerFrame);
+    }
+
+    // Returns a handle for each of filenames, each holding its own reference. Textures that are not loaded yet
+    // are deduplicated, decoded (or read from the cooked copy) on core->jobs and uploaded to the GPU as one batch.
+    // A texture that fails to load still gets a handle, find gives the placeholder or -1 for it.
+    std::vector<TextureHandle> load(Core* core, const std::vector<std::string>& filenames) {
+        std::vector<std::string> pending;
+        std::vector<TextureHandle> result = reserve(filenames, pending);
+        if (pending.empty()) return result;
+
+        std::vector<CookedTexture> cooked(pending.size());
+        std::vector<char> prepared(pending.size(), 0);
+        core->jobs.parallelFor((int)pending.size(), [&](int i, int) {
+            prepared[i] = TextureCook::prepare(pending[i], cooked[i]);
+        });
+
+        core->beginUploads();
+        for (int i = 0; i < (int)pending.size(); i++) {
+            if (prepared[i]) {
+                upload(core, handles[pending[i]], cooked[i]);
+            }
         }
+        core->endUploads();
+        return result;
     }
 
-    void load(Core* core, std::string filename) {
-        if (textureCache.find(filename) != textureCache.end()) {
-            return;
+    // Same as load but returns before anything is read: each new texture is decoded on one of assets' loading
+    // threads and uploaded when assets is pumped. Until then find gives the placeholder.
+    std::vector<TextureHandle> loadAsync(Core* core, AssetLoader* assets, const std::vector<std::string>& filenames) {
+        std::vector<std::string> pending;
+        std::vector<TextureHandle> result = reserve(filenames, pending);
+        for (const std::string& filename : pending) {
+            TextureHandle handle = handles[filename];
+            std::shared_ptr<CookedTexture> cooked = std::make_shared<CookedTexture>();
+            assets->submit(filename,
+                [filename, cooked]() { return TextureCook::prepare(filename, *cooked); },
+                [this, core, handle, cooked]() { upload(core, handle, *cooked); });
         }
+        return result;
+    }
 
-        Texture* newTex = new Texture();
-        newTex->load(core, filename);
+    // A handle with a reference for each of filenames. Names with no texture yet get an empty one, listed in pending.
+    std::vector<TextureHandle> reserve(const std::vector<std::string>& filenames, std::vector<std::string>& pending) {
+        std::vector<TextureHandle> result;
+        for (const std::string& filename : filenames) {
+            auto it = handles.find(filename);
+            if (it != handles.end()) {
+                textures.addRef(it->second);
+                result.push_back(it->second);
+                continue;
+            }
+            TextureHandle handle = textures.add(new Texture());
+            handles[filename] = handle;
+            pending.push_back(filename);
+            result.push_back(handle);
+        }
+        return result;
+    }
 
-        textureCache[filename] = newTex;
+    // Puts cooked on the GPU as the texture of handle, with only its tail to begin with when streaming.
+    // cooked is moved from. Does nothing if the handle was released in the meantime.
+    void upload(Core* core, TextureHandle handle, CookedTexture& cooked) {
+        Texture** slot = textures.get(handle);
+        if (!slot) return;
+        Texture* texture = *slot;
+        if (streaming) {
+            int tail = TextureResidency::tailMipFor(cooked.width, cooked.height, (int)cooked.levels.size(), streamTailSize, cooked.format != CookedRGBA8);
+            if (!texture->upload(core, cooked, tail)) return;
+            std::vector<size_t> levelBytes;
+            for (const std::vector<unsigned char>& level : cooked.levels) {
+                levelBytes.push_back(level.size());
+            }
+            texture->streamId = residency.add(levelBytes, tail, cooked.width, cooked.height, cooked.format != CookedRGBA8);
+            texture->source = std::move(cooked);
+            streamed.push_back(texture);
+        }
+        else {
+            texture->upload(core, cooked);
+        }
     }
 
+    void addRef(TextureHandle handle) {
+        textures.addRef(handle);
+    }
 
-    int find(std::string filename) {
-        if (textureCache.find(filename) != textureCache.end()) {
-            return textureCache[filename]->heapOffset;
+    // Drops a reference, the last one unloads the texture once the frames in flight are done with it
+    void release(Core* core, TextureHandle handle) {
+        Texture* texture = nullptr;
+        if (!textures.release(handle, texture)) return;
+        for (auto it = handles.begin(); it != handles.end(); ++it) {
+            if (it->second == handle) {
+                handles.erase(it);
+                break;
+            }
         }
-        else {
-            return -1;
+        if (texture->streamId != -1) {
+            residency.remove(texture->streamId);
+            streamed[texture->streamId] = nullptr;
+        }
+        texture->free(core);
+        delete texture;
+    }
+
+    // Descriptor index of the texture for the shaders. The placeholder's while it is loading or if it failed to,
+    // -1 if there is no placeholder either.
+    int find(TextureHandle handle) const {
+        Texture* const* texture = textures.get(handle);
+        int heapOffset = texture ? (*texture)->heapOffset : -1;
+        if (heapOffset == -1 && placeholder) return placeholder->heapOffset;
+        return heapOffset;
+    }
+
+    int find(const std::string& filename) const {
+        auto it = handles.find(filename);
+        return it == handles.end() ? -1 : find(it->second);
+    }
+
+    int count() const {
+        return textures.count();
+    }
+
+    // The texture is drawn this frame covering about screenPixels (see TextureResidency::screenSize)
+    void request(TextureHandle handle, float screenPixels) {
+        if (!streaming) return;
+        Texture** slot = textures.get(handle);
+        if (!slot || (*slot)->streamId == -1) return;
+        Texture* texture = *slot;
+        residency.request(texture->streamId, TextureResidency::mipForScreenSize(texture->width, texture->height, screenPixels), streamFrame);
+    }
+
+    // Applies this frame's residency changes. Call after the frame's requests and before its draws look up textures.
+    void stream(Core* core) {
+        if (!streaming) return;
+        residency.update(streamFrame, streamLoads, streamEvictions);
+        // One rebuild per texture however many of its levels came or went
+        for (const std::vector<TextureMipChange>* changes : { &streamEvictions, &streamLoads }) {
+            for (const TextureMipChange& change : *changes) {
+                if (streamed[change.texture])
+                    streamed[change.texture]->setResidentMip(core, residency.residentMip(change.texture));
+            }
         }
+        streamFrame++;
     }
 };
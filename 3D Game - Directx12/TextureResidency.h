@@ -0,0 +1,306 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+struct TextureResidencyStats
+{
+    size_t budgetBytes = 0;
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+    size_t wantedBytes = 0; // What every texture at its requested mip would take
+    int textures = 0;
+    int loads = 0; // Mips made resident, over the whole run
+    int evictions = 0;
+    int starvedLoads = 0; // Loads that were wanted but did not fit the budget this update
+};
+
+// A mip of a texture to make resident or to drop
+struct TextureMipChange
+{
+    int texture;
+    int mip;
+};
+
+// Decides which mips of which textures should be in video memory, kept apart from D3D so it can run headless.
+// A texture's resident levels are always a contiguous run [residentMip, levels), the smallest levels down from
+// tailMip are loaded up front and never evicted. Each frame the renderer requests the mip it would sample from
+// (see mipForScreenSize), update then grows textures one level at a time towards that, most blurry first, and
+// when that would go over budget it drops least recently used levels to make room. Only a texture's largest
+// resident level can be dropped, so the LRU order is over those. A block compressed texture can only be created
+// with a largest level that is a multiple of 4 in both directions, so its levels that are not come and go together
+// with the next larger one that is.
+class TextureResidency {
+public:
+    void init(size_t _budgetBytes, int _maxLoadsPerUpdate = 4)
+    {
+        budgetBytes = _budgetBytes;
+        maxLoadsPerUpdate = _maxLoadsPerUpdate;
+        textures.clear();
+        residentBytes = 0;
+        peakResidentBytes = 0;
+        loads = 0;
+        evictions = 0;
+        starvedLoads = 0;
+    }
+
+    // Takes effect at the next update
+    void setBudget(size_t _budgetBytes)
+    {
+        budgetBytes = _budgetBytes;
+    }
+
+    // levelBytes[0] is the full size level, width x height texels when blockAligned. Returns the texture's id, its
+    // tail is counted as resident from now on.
+    int add(const std::vector<size_t>& levelBytes, int tailMip, int width = 0, int height = 0, bool blockAligned = false)
+    {
+        TextureState t;
+        t.levelBytes = levelBytes;
+        t.tailMip = std::clamp(tailMip, 0, (int)levelBytes.size() - 1);
+        t.canBeLargest.assign(levelBytes.size(), 1);
+        for (int mip = 0; blockAligned && mip < t.tailMip; mip++) {
+            t.canBeLargest[mip] = isBlockAligned(width, height, mip);
+        }
+        t.residentMip = t.tailMip;
+        t.wantedMip = t.tailMip;
+        t.levelLastUsed.assign(levelBytes.size(), 0);
+        for (int mip = t.residentMip; mip < (int)levelBytes.size(); mip++) {
+            residentBytes += levelBytes[mip];
+        }
+        peakResidentBytes = std::max(peakResidentBytes, residentBytes);
+        textures.push_back(t);
+        return (int)textures.size() - 1;
+    }
+
+    // Stops tracking a texture that has been unloaded. Its id is not reused, it just has no levels from now on.
+    void remove(int texture)
+    {
+        TextureState& t = textures[texture];
+        for (int mip = t.residentMip; mip < (int)t.levelBytes.size(); mip++) {
+            residentBytes -= t.levelBytes[mip];
+        }
+        t = TextureState();
+    }
+
+    // The texture is sampled this frame at roughly mip. Several requests in a frame keep the most detailed one.
+    void request(int texture, int mip, unsigned int frame)
+    {
+        TextureState& t = textures[texture];
+        mip = std::clamp(mip, 0, t.tailMip);
+        if (t.wantedFrame != frame) {
+            t.wantedFrame = frame;
+            t.wantedMip = mip;
+        }
+        else {
+            t.wantedMip = std::min(t.wantedMip, mip);
+        }
+        for (int level = mip; level < (int)t.levelBytes.size(); level++) {
+            t.levelLastUsed[level] = frame;
+        }
+    }
+
+    // Works out this frame's changes and applies them to the residency state. The caller carries them out:
+    // evictions are listed before the loads they make room for.
+    void update(unsigned int frame, std::vector<TextureMipChange>& loadsOut, std::vector<TextureMipChange>& evictionsOut)
+    {
+        loadsOut.clear();
+        evictionsOut.clear();
+        for (TextureState& t : textures) {
+            // Anything not asked for this frame only needs its tail
+            if (t.wantedFrame != frame) t.wantedMip = t.tailMip;
+        }
+
+        // Levels stay cached while there is room, they are only dropped when over budget, e.g. after setBudget
+        while (residentBytes > budgetBytes) {
+            int victim = leastRecentlyUsed(frame, -1);
+            if (victim == -1) break;
+            evict(victim, evictionsOut);
+        }
+
+        for (int n = 0; n < maxLoadsPerUpdate; n++) {
+            int best = -1;
+            int bestGap = 0;
+            for (int i = 0; i < (int)textures.size(); i++) {
+                const TextureState& t = textures[i];
+                int gap = t.residentMip - t.wantedMip;
+                if (gap > bestGap && !t.starved && loadTo(t) != -1) {
+                    best = i;
+                    bestGap = gap;
+                }
+            }
+            if (best == -1) break;
+
+            TextureState& t = textures[best];
+            int mip = loadTo(t);
+            size_t bytes = 0;
+            for (int level = mip; level < t.residentMip; level++) {
+                bytes += t.levelBytes[level];
+            }
+            while (residentBytes + bytes > budgetBytes) {
+                int victim = leastRecentlyUsed(frame, best);
+                if (victim == -1) break;
+                evict(victim, evictionsOut);
+            }
+            if (residentBytes + bytes > budgetBytes) {
+                // Try the others this update, one of them may have a smaller level to load
+                t.starved = true;
+                starvedLoads++;
+                n--;
+                continue;
+            }
+            while (t.residentMip > mip) {
+                t.residentMip--;
+                loads++;
+                loadsOut.push_back({ best, t.residentMip });
+            }
+            residentBytes += bytes;
+            peakResidentBytes = std::max(peakResidentBytes, residentBytes);
+        }
+        for (TextureState& t : textures) {
+            t.starved = false;
+        }
+    }
+
+    int residentMip(int texture) const
+    {
+        return textures[texture].residentMip;
+    }
+
+    int wantedMip(int texture) const
+    {
+        return textures[texture].wantedMip;
+    }
+
+    int tailMip(int texture) const
+    {
+        return textures[texture].tailMip;
+    }
+
+    int count() const
+    {
+        return (int)textures.size();
+    }
+
+    TextureResidencyStats stats() const
+    {
+        TextureResidencyStats s;
+        s.budgetBytes = budgetBytes;
+        s.residentBytes = residentBytes;
+        s.peakResidentBytes = peakResidentBytes;
+        for (const TextureState& t : textures) {
+            for (int mip = t.wantedMip; mip < (int)t.levelBytes.size(); mip++) {
+                s.wantedBytes += t.levelBytes[mip];
+            }
+        }
+        s.textures = (int)textures.size();
+        s.loads = loads;
+        s.evictions = evictions;
+        s.starvedLoads = starvedLoads;
+        return s;
+    }
+
+    // Height in pixels of a sphere of radius at distance from the eye. projectionScaleY is the projection matrix's
+    // y scale, 1 / tan(fov / 2), i.e. p.m[5] of the matrix Game.cpp builds vp from.
+    static float screenSize(float radius, float distance, float projectionScaleY, float viewportHeight)
+    {
+        distance = std::max(distance, radius);
+        return (radius / distance) * projectionScaleY * viewportHeight;
+    }
+
+    // The mip whose size is closest to covering screenPixels with one texel per pixel
+    static int mipForScreenSize(int width, int height, float screenPixels)
+    {
+        float texels = (float)std::max(width, height);
+        if (screenPixels >= texels) return 0;
+        return (int)std::floor(std::log2(texels / std::max(screenPixels, 1.0f)));
+    }
+
+    static bool isBlockAligned(int width, int height, int mip)
+    {
+        return ((width >> mip) % 4) == 0 && ((height >> mip) % 4) == 0;
+    }
+
+    // Smallest levels that are kept resident: everything at or below maxTailSize texels. blockAligned keeps the
+    // largest level a multiple of 4 in both directions, which a block compressed texture must be created with.
+    static int tailMipFor(int width, int height, int levels, int maxTailSize, bool blockAligned)
+    {
+        int tail = 0;
+        while (tail + 1 < levels && std::max(width >> tail, height >> tail) > maxTailSize) {
+            tail++;
+        }
+        while (blockAligned && tail > 0 && !isBlockAligned(width, height, tail)) {
+            tail--;
+        }
+        return tail;
+    }
+
+private:
+    struct TextureState
+    {
+        std::vector<size_t> levelBytes;
+        std::vector<unsigned int> levelLastUsed; // Frame each level was last needed by a request
+        std::vector<char> canBeLargest; // Levels the GPU texture can start at
+        int tailMip = 0;
+        int residentMip = 0;
+        int wantedMip = 0;
+        unsigned int wantedFrame = ~0u;
+        bool starved = false;
+    };
+
+    std::vector<TextureState> textures;
+    size_t budgetBytes = 0;
+    int maxLoadsPerUpdate = 4;
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+    int loads = 0;
+    int evictions = 0;
+    int starvedLoads = 0;
+
+    // Next larger level the texture can grow to, -1 when there is none
+    static int loadTo(const TextureState& t)
+    {
+        for (int mip = t.residentMip - 1; mip >= 0; mip--) {
+            if (t.canBeLargest[mip]) return mip;
+        }
+        return -1;
+    }
+
+    // Level the texture shrinks to when its largest level goes, the tail at most
+    static int evictTo(const TextureState& t)
+    {
+        int mip = t.residentMip + 1;
+        while (mip < t.tailMip && !t.canBeLargest[mip]) mip++;
+        return mip;
+    }
+
+    void evict(int texture, std::vector<TextureMipChange>& evictionsOut)
+    {
+        TextureState& t = textures[texture];
+        int mip = evictTo(t);
+        while (t.residentMip < mip) {
+            residentBytes -= t.levelBytes[t.residentMip];
+            evictionsOut.push_back({ texture, t.residentMip });
+            t.residentMip++;
+            evictions++;
+        }
+    }
+
+    // Texture whose largest resident level was used longest ago, skipping levels needed this frame and the
+    // texture being loaded for. -1 when nothing can go.
+    int leastRecentlyUsed(unsigned int frame, int loading) const
+    {
+        int victim = -1;
+        unsigned int oldest = 0;
+        for (int i = 0; i < (int)textures.size(); i++) {
+            const TextureState& t = textures[i];
+            if (i == loading || t.residentMip >= t.tailMip) continue;
+            if (t.wantedFrame == frame && evictTo(t) > t.wantedMip) continue;
+            unsigned int used = t.levelLastUsed[t.residentMip];
+            if (victim == -1 || used < oldest) {
+                victim = i;
+                oldest = used;
+            }
+        }
+        return victim;
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+#include "maths.h"
+#include <vector>
+#include <cstring>
+
+// Builds world = T * RY * RX * S (the same result as S * RX * RY * T with Matrix::operator*) in closed form,
+// without creating or multiplying the intermediate matrices
+class TransformBatch
+{
+public:
+	std::vector<Vec3> positions;
+	std::vector<float> rotationsY;
+	std::vector<Vec3> scales;
+	std::vector<Matrix> worlds;
+	std::vector<int> changed; // Indices recomputed by the last update
+
+	std::vector<Vec3> lastPositions;
+	std::vector<float> lastRotationsY;
+	std::vector<Vec3> lastScales;
+
+	// rotationsX and rotationsY can be nullptr for no rotation around that axis
+	static void compose(const Vec3* _positions, const float* _rotationsX, const float* _rotationsY, const Vec3* _scales, Matrix* out, int count)
+	{
+		int i = 0;
+#if MATHS_SIMD_LEVEL > 0
+		__m128 zero = _mm_setzero_ps();
+		__m128 lastRow = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			float sp[4], cp[4], sy[4], cy[4];
+			for (int j = 0; j < 4; j++)
+			{
+				float pitch = _rotationsX ? _rotationsX[i + j] : 0.0f;
+				float yaw = _rotationsY ? _rotationsY[i + j] : 0.0f;
+				sp[j] = sinf(pitch);
+				cp[j] = cosf(pitch);
+				sy[j] = sinf(yaw);
+				cy[j] = cosf(yaw);
+			}
+			__m128 vsp = _mm_loadu_ps(sp), vcp = _mm_loadu_ps(cp), vsy = _mm_loadu_ps(sy), vcy = _mm_loadu_ps(cy);
+			__m128 px, py, pz, kx, ky, kz;
+			simdLoadVec3x4(&_positions[i], px, py, pz);
+			simdLoadVec3x4(&_scales[i], kx, ky, kz);
+
+			__m128 e0 = _mm_mul_ps(vcy, kx);
+			__m128 e1 = _mm_mul_ps(_mm_mul_ps(vsy, vsp), ky);
+			__m128 e2 = _mm_mul_ps(_mm_mul_ps(vsy, vcp), kz);
+			__m128 e4 = zero;
+			__m128 e5 = _mm_mul_ps(vcp, ky);
+			__m128 e6 = _mm_sub_ps(zero, _mm_mul_ps(vsp, kz));
+			__m128 e8 = _mm_sub_ps(zero, _mm_mul_ps(vsy, kx));
+			__m128 e9 = _mm_mul_ps(_mm_mul_ps(vcy, vsp), ky);
+			__m128 e10 = _mm_mul_ps(_mm_mul_ps(vcy, vcp), kz);
+
+			// Each set of 4 lanes holds one element for 4 objects, transpose back to one row per object
+			_MM_TRANSPOSE4_PS(e0, e1, e2, px);
+			_MM_TRANSPOSE4_PS(e4, e5, e6, py);
+			_MM_TRANSPOSE4_PS(e8, e9, e10, pz);
+			__m128 row0[4] = { e0, e1, e2, px };
+			__m128 row1[4] = { e4, e5, e6, py };
+			__m128 row2[4] = { e8, e9, e10, pz };
+			for (int j = 0; j < 4; j++)
+			{
+				_mm_storeu_ps(&out[i + j].m[0], row0[j]);
+				_mm_storeu_ps(&out[i + j].m[4], row1[j]);
+				_mm_storeu_ps(&out[i + j].m[8], row2[j]);
+				_mm_storeu_ps(&out[i + j].m[12], lastRow);
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			float pitch = _rotationsX ? _rotationsX[i] : 0.0f;
+			float yaw = _rotationsY ? _rotationsY[i] : 0.0f;
+			float sp = sinf(pitch), cp = cosf(pitch);
+			float sy = sinf(yaw), cy = cosf(yaw);
+			const Vec3& p = _positions[i];
+			const Vec3& k = _scales[i];
+			out[i] = Matrix(
+				cy * k.x, sy * sp * k.y, sy * cp * k.z, p.x,
+				0.0f, cp * k.y, -sp * k.z, p.y,
+				-sy * k.x, cy * sp * k.y, cy * cp * k.z, p.z,
+				0.0f, 0.0f, 0.0f, 1.0f);
+		}
+	}
+
+	static Matrix compose(const Vec3& position, float rotationX, float rotationY, const Vec3& scale)
+	{
+		Matrix world;
+		compose(&position, &rotationX, &rotationY, &scale, &world, 1);
+		return world;
+	}
+
+	int add(const Vec3& position, float rotationY, const Vec3& scale)
+	{
+		positions.push_back(position);
+		rotationsY.push_back(rotationY);
+		scales.push_back(scale);
+		return (int)positions.size() - 1;
+	}
+
+	void clear()
+	{
+		positions.clear();
+		rotationsY.clear();
+		scales.clear();
+		worlds.clear();
+		lastPositions.clear();
+		lastRotationsY.clear();
+		lastScales.clear();
+	}
+
+	// Recomputes only the objects whose inputs changed since the last call, returns how many were rebuilt
+	int update()
+	{
+		int count = (int)positions.size();
+		int previousCount = (int)lastPositions.size();
+		if (previousCount > count)
+		{
+			previousCount = count;
+		}
+		worlds.resize(count);
+		lastPositions.resize(count);
+		lastRotationsY.resize(count);
+		lastScales.resize(count);
+
+		changed.clear();
+		for (int i = 0; i < count; i++)
+		{
+			if (i >= previousCount ||
+				memcmp(&positions[i], &lastPositions[i], sizeof(Vec3)) != 0 ||
+				rotationsY[i] != lastRotationsY[i] ||
+				memcmp(&scales[i], &lastScales[i], sizeof(Vec3)) != 0)
+			{
+				lastPositions[i] = positions[i];
+				lastRotationsY[i] = rotationsY[i];
+				lastScales[i] = scales[i];
+				changed.push_back(i);
+			}
+		}
+
+		// Gather the changed objects in groups of 4 so the SIMD path still gets full vectors
+		Vec3 p[4];
+		float r[4];
+		Vec3 s[4];
+		Matrix w[4];
+		for (int i = 0; i < (int)changed.size(); i += 4)
+		{
+			int n = std::min(4, (int)changed.size() - i);
+			for (int j = 0; j < n; j++)
+			{
+				p[j] = positions[changed[i + j]];
+				r[j] = rotationsY[changed[i + j]];
+				s[j] = scales[changed[i + j]];
+			}
+			compose(p, nullptr, r, s, w, n);
+			for (int j = 0; j < n; j++)
+			{
+				worlds[changed[i + j]] = w[j];
+			}
+		}
+		return (int)changed.size();
+	}
+};
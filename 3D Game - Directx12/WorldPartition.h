@@ -0,0 +1,188 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+struct WorldPartitionStats
+{
+    size_t budgetBytes = 0;
+    size_t residentBytes = 0; // Of cells loaded or being loaded
+    size_t peakResidentBytes = 0;
+    int cells = 0;
+    int residentCells = 0;
+    int loads = 0; // Over the whole run
+    int unloads = 0;
+    int starvedLoads = 0; // Cells in range that did not fit the budget when they were wanted
+};
+
+// Decides which cells of a level grid should be in memory for a viewer, kept apart from the level data so it can
+// run headless, in the same way TextureResidency does for mips. Cells whose nearest point is within loadRadius are
+// loaded nearest first, a few per update, and unloaded once they are further than unloadRadius. The band between the
+// two keeps a viewer walking along a cell edge from loading and unloading the same cells over and over. When a cell
+// in range does not fit the budget, cells in the band go first, furthest first; cells in range are never dropped
+// for another one.
+class WorldPartition {
+public:
+    void init(int _cellsX, int _cellsZ, float _originX, float _originZ, float _cellSize, const std::vector<size_t>& _cellBytes,
+        float _loadRadius, float _unloadRadius, size_t _budgetBytes, int _maxLoadsPerUpdate = 4)
+    {
+        cellsX = _cellsX;
+        cellsZ = _cellsZ;
+        originX = _originX;
+        originZ = _originZ;
+        cellSize = _cellSize;
+        cellBytes = _cellBytes;
+        loadRadius = _loadRadius;
+        unloadRadius = std::max(_unloadRadius, _loadRadius);
+        budgetBytes = _budgetBytes;
+        maxLoadsPerUpdate = _maxLoadsPerUpdate;
+        resident.assign((size_t)cellsX * cellsZ, 0);
+        residentList.clear();
+        residentBytes = 0;
+        peakResidentBytes = 0;
+        loads = 0;
+        unloads = 0;
+        starvedLoads = 0;
+    }
+
+    // Takes effect at the next update
+    void setBudget(size_t _budgetBytes)
+    {
+        budgetBytes = _budgetBytes;
+    }
+
+    // Cells to start loading and to drop for a viewer at (x, z), unloads listed first. A cell counts against the
+    // budget from the update that asks for it to be loaded.
+    void update(float x, float z, std::vector<int>& loadsOut, std::vector<int>& unloadsOut)
+    {
+        loadsOut.clear();
+        unloadsOut.clear();
+
+        for (int i = 0; i < (int)residentList.size(); i++) {
+            int cell = residentList[i];
+            if (distance(cell, x, z) > unloadRadius) {
+                unload(cell, unloadsOut);
+                i--;
+            }
+        }
+
+        // Only the cells under the load radius can be wanted, empty ones never are
+        wanted.clear();
+        int x0 = std::max(0, (int)std::floor((x - loadRadius - originX) / cellSize));
+        int z0 = std::max(0, (int)std::floor((z - loadRadius - originZ) / cellSize));
+        int x1 = std::min(cellsX - 1, (int)std::floor((x + loadRadius - originX) / cellSize));
+        int z1 = std::min(cellsZ - 1, (int)std::floor((z + loadRadius - originZ) / cellSize));
+        for (int cz = z0; cz <= z1; cz++) {
+            for (int cx = x0; cx <= x1; cx++) {
+                int cell = cz * cellsX + cx;
+                float d = distance(cell, x, z);
+                if (!resident[cell] && cellBytes[cell] > 0 && d <= loadRadius) {
+                    wanted.push_back({ cell, d });
+                }
+            }
+        }
+        std::sort(wanted.begin(), wanted.end(), [](const WantedCell& a, const WantedCell& b) { return a.distance < b.distance; });
+
+        int issued = 0;
+        for (const WantedCell& w : wanted) {
+            if (issued == maxLoadsPerUpdate) break;
+            size_t bytes = cellBytes[w.cell];
+            while (residentBytes + bytes > budgetBytes) {
+                int victim = furthestOutOfRange(x, z);
+                if (victim == -1) break;
+                unload(victim, unloadsOut);
+            }
+            if (residentBytes + bytes > budgetBytes) {
+                // A smaller cell further out may still fit
+                starvedLoads++;
+                continue;
+            }
+            resident[w.cell] = 1;
+            residentList.push_back(w.cell);
+            residentBytes += bytes;
+            peakResidentBytes = std::max(peakResidentBytes, residentBytes);
+            loads++;
+            issued++;
+            loadsOut.push_back(w.cell);
+        }
+    }
+
+    bool isResident(int cell) const
+    {
+        return resident[cell] != 0;
+    }
+
+    // From (x, z) to the nearest point of the cell, 0 inside it
+    float distance(int cell, float x, float z) const
+    {
+        float minX = originX + (cell % cellsX) * cellSize;
+        float minZ = originZ + (cell / cellsX) * cellSize;
+        float dx = std::max(std::max(minX - x, x - (minX + cellSize)), 0.0f);
+        float dz = std::max(std::max(minZ - z, z - (minZ + cellSize)), 0.0f);
+        return std::sqrt(dx * dx + dz * dz);
+    }
+
+    WorldPartitionStats stats() const
+    {
+        WorldPartitionStats s;
+        s.budgetBytes = budgetBytes;
+        s.residentBytes = residentBytes;
+        s.peakResidentBytes = peakResidentBytes;
+        s.cells = (int)resident.size();
+        s.residentCells = (int)residentList.size();
+        s.loads = loads;
+        s.unloads = unloads;
+        s.starvedLoads = starvedLoads;
+        return s;
+    }
+
+private:
+    struct WantedCell
+    {
+        int cell;
+        float distance;
+    };
+
+    int cellsX = 0;
+    int cellsZ = 0;
+    float originX = 0.0f;
+    float originZ = 0.0f;
+    float cellSize = 1.0f;
+    std::vector<size_t> cellBytes;
+    float loadRadius = 0.0f;
+    float unloadRadius = 0.0f;
+    size_t budgetBytes = 0;
+    int maxLoadsPerUpdate = 4;
+    std::vector<char> resident;
+    std::vector<int> residentList;
+    std::vector<WantedCell> wanted;
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+    int loads = 0;
+    int unloads = 0;
+    int starvedLoads = 0;
+
+    void unload(int cell, std::vector<int>& unloadsOut)
+    {
+        resident[cell] = 0;
+        residentList.erase(std::find(residentList.begin(), residentList.end(), cell));
+        residentBytes -= cellBytes[cell];
+        unloads++;
+        unloadsOut.push_back(cell);
+    }
+
+    // Resident cell outside the load radius that is furthest away, -1 when there is none
+    int furthestOutOfRange(float x, float z) const
+    {
+        int victim = -1;
+        float furthest = loadRadius;
+        for (int cell : residentList) {
+            float d = distance(cell, x, z);
+            if (d > furthest) {
+                victim = cell;
+                furthest = d;
+            }
+        }
+        return victim;
+    }
+};
@@ -0,0 +1,21 @@
+Texture2D textures[] : register(t0, space1);
+SamplerState samplerLinear : register(s0);
+
+cbuffer materialConstants : register(b2)
+{
+    uint textureIndex;
+};
+
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float3 Normal : NORMAL;
+    float3 Tangent : TANGENT;
+    float2 TexCoords : TEXCOORD;
+};
+
+float4 PS(PS_INPUT input) : SV_Target0
+{
+    float4 colour = textures[textureIndex].Sample(samplerLinear, input.TexCoords);
+    return float4(colour.rgb, 1.0);
+}
\ No newline at end of file
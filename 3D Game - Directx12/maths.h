@@ -4,9 +4,29 @@
 #include <cmath>
 #include <algorithm>
 #include <iostream>
+#ifndef GAME_HEADLESS
 #include "GamesEngineeringBase.h"
+#endif
 using namespace std;
 
+// SIMD kernel selection, 0 = portable scalar, 1 = SSE, 2 = AVX
+// Define MATHS_NO_SIMD (or MATHS_SIMD_LEVEL directly) to override what the compiler flags allow
+#ifndef MATHS_SIMD_LEVEL
+#if defined(MATHS_NO_SIMD)
+#define MATHS_SIMD_LEVEL 0
+#elif defined(__AVX__)
+#define MATHS_SIMD_LEVEL 2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATHS_SIMD_LEVEL 1
+#else
+#define MATHS_SIMD_LEVEL 0
+#endif
+#endif
+
+#if MATHS_SIMD_LEVEL > 0
+#include <immintrin.h>
+#endif
+
 // Macro - square - useful for squaring functions
 #define SQ(x) ((x) * (x))
 
@@ -237,9 +257,9 @@ float Dot(const Vec3& pVec1, const Vec3& pVec2)   // dot product between two inp
 }
 
 // Outside Vector class
-float Cross(const Vec3& pVec1, const Vec3& pVec2)    // cross product between two input vectors
+Vec3 Cross(const Vec3& pVec1, const Vec3& pVec2)    // cross product between two input vectors
 {
-	return (pVec1.v[1] * pVec2.v[2] - pVec1.v[2] * pVec2.v[1],
+	return Vec3(pVec1.v[1] * pVec2.v[2] - pVec1.v[2] * pVec2.v[1],
 		pVec1.v[2] * pVec2.v[0] - pVec1.v[0] * pVec2.v[2],
 		pVec1.v[0] * pVec2.v[1] - pVec1.v[1] * pVec2.v[0]);
 }
@@ -447,7 +467,36 @@ public:
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-class Matrix    // row major, not column major
+#if MATHS_SIMD_LEVEL > 0
+static inline __m128 simdCross3(__m128 a, __m128 b)   // cross product of the xyz lanes, w lane is 0
+{
+	__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static inline void simdLoadVec3x4(const Vec3* p, __m128& x, __m128& y, __m128& z)   // 4 packed Vec3 to xxxx, yyyy, zzzz
+{
+	const float* f = p[0].v;
+	__m128 a = _mm_loadu_ps(f);        // x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(f + 4);    // y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(f + 8);    // z2 x3 y3 z3
+	x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+	y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+static inline void simdStoreVec3x4(Vec3* p, __m128 x, __m128 y, __m128 z)   // xxxx, yyyy, zzzz back to 4 packed Vec3
+{
+	float* f = p[0].v;
+	_mm_storeu_ps(f, _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+#endif
+
+class alignas(16) Matrix    // row major, not column major
 {
 public:
 	union
@@ -478,7 +527,7 @@ public:
 	}
 
 
-	Vec4 mul(const Vec4& pVec)   // multiply matrix by input vec4
+	Vec4 mul(const Vec4& pVec) const   // multiply matrix by input vec4
 	{
 		return Vec4(
 			pVec.x * m[0] + pVec.y * m[1] + pVec.z * m[2] + pVec.w * m[3],
@@ -489,7 +538,7 @@ public:
 	}
 
 
-	Vec3 mulPoint(const Vec3& pVec)  // multiply matrix by vec3 to store posiiton
+	Vec3 mulPoint(const Vec3& pVec) const  // multiply matrix by vec3 to store posiiton
 	{
 		return Vec3(
 			(pVec.x * m[0] + pVec.y * m[1] + pVec.z * m[2]) + m[3],
@@ -499,7 +548,7 @@ public:
 	}
 
 
-	Vec3 mulVec(const Vec3& pVec)   // multiply matrix by vec3 to store directions
+	Vec3 mulVec(const Vec3& pVec) const   // multiply matrix by vec3 to store directions
 	{
 		return Vec3(
 			(pVec.x * m[0] + pVec.y * m[1] + pVec.z * m[2]),
@@ -581,7 +630,53 @@ public:
 	}
 
 
-	Matrix multiply(const Matrix& matrix) const
+	Matrix multiply(const Matrix& matrix) const   // note this returns matrix * this, which is what operator* relies on
+	{
+		// The scalar version at every SIMD level, as -mathbench measures multiplySIMD slower than what the compiler makes of it
+		return multiplyScalar(matrix);
+	}
+
+#if MATHS_SIMD_LEVEL > 0
+	Matrix multiplySIMD(const Matrix& matrix) const   // same result as multiply with SSE or AVX rows, kept for -mathbench
+	{
+#if MATHS_SIMD_LEVEL == 2
+		Matrix ret;
+		__m256 r0 = _mm256_broadcast_ps((const __m128*)&m[0]);
+		__m256 r1 = _mm256_broadcast_ps((const __m128*)&m[4]);
+		__m256 r2 = _mm256_broadcast_ps((const __m128*)&m[8]);
+		__m256 r3 = _mm256_broadcast_ps((const __m128*)&m[12]);
+		for (int i = 0; i < 16; i += 8)   // two output rows per iteration
+		{
+			const float* o = &matrix.m[i];
+			__m256 acc = _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(o[0]), _mm_set1_ps(o[4])), r0);
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(o[1]), _mm_set1_ps(o[5])), r1));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(o[2]), _mm_set1_ps(o[6])), r2));
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_setr_m128(_mm_set1_ps(o[3]), _mm_set1_ps(o[7])), r3));
+			_mm256_storeu_ps(&ret.m[i], acc);
+		}
+		return ret;
+#elif MATHS_SIMD_LEVEL == 1
+		Matrix ret;
+		__m128 r0 = _mm_loadu_ps(&m[0]);
+		__m128 r1 = _mm_loadu_ps(&m[4]);
+		__m128 r2 = _mm_loadu_ps(&m[8]);
+		__m128 r3 = _mm_loadu_ps(&m[12]);
+		for (int i = 0; i < 16; i += 4)   // each output row is the input rows weighted by a row of the other matrix
+		{
+			const float* o = &matrix.m[i];
+			__m128 acc = _mm_mul_ps(_mm_set1_ps(o[0]), r0);
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(o[1]), r1));
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(o[2]), r2));
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(o[3]), r3));
+			_mm_storeu_ps(&ret.m[i], acc);
+		}
+		return ret;
+#endif
+	}
+#endif
+
+
+	Matrix multiplyScalar(const Matrix& matrix) const   // portable version, also used as the reference for the SIMD paths
 	{
 		Matrix ret;
 
@@ -649,6 +744,88 @@ public:
 	}
 
 
+	Matrix invertAffine() const   // inverse of a matrix whose last row is (0, 0, 0, 1), much cheaper than invert()
+	{
+		Matrix inv;
+#if MATHS_SIMD_LEVEL > 0
+		__m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+		__m128 r0 = _mm_loadu_ps(&m[0]);
+		__m128 r1 = _mm_loadu_ps(&m[4]);
+		__m128 r2 = _mm_loadu_ps(&m[8]);
+		__m128 t = _mm_setr_ps(m[3], m[7], m[11], 0.0f);
+		r0 = _mm_and_ps(r0, mask);
+		r1 = _mm_and_ps(r1, mask);
+		r2 = _mm_and_ps(r2, mask);
+
+		// The columns of the 3x3 inverse are the cross products of the rows over the determinant
+		__m128 c0 = simdCross3(r1, r2);
+		__m128 c1 = simdCross3(r2, r0);
+		__m128 c2 = simdCross3(r0, r1);
+		__m128 dp = _mm_mul_ps(r0, c0);
+		__m128 det = _mm_add_ss(_mm_add_ss(dp, _mm_shuffle_ps(dp, dp, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(dp, dp, _MM_SHUFFLE(2, 2, 2, 2)));
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), _mm_shuffle_ps(det, det, _MM_SHUFFLE(0, 0, 0, 0)));
+		c0 = _mm_mul_ps(c0, invDet);
+		c1 = _mm_mul_ps(c1, invDet);
+		c2 = _mm_mul_ps(c2, invDet);
+
+		__m128 nt = _mm_mul_ps(c0, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0)));
+		nt = _mm_add_ps(nt, _mm_mul_ps(c1, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1))));
+		nt = _mm_add_ps(nt, _mm_mul_ps(c2, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 2, 2))));
+		nt = _mm_sub_ps(_mm_setzero_ps(), nt);
+
+		// Transposing the columns with -inverse * t as the 4th column gives the rows of the result
+		__m128 r3 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+		_MM_TRANSPOSE4_PS(c0, c1, c2, nt);
+		_mm_storeu_ps(&inv.m[0], c0);
+		_mm_storeu_ps(&inv.m[4], c1);
+		_mm_storeu_ps(&inv.m[8], c2);
+		_mm_storeu_ps(&inv.m[12], r3);
+#else
+		float c00 = m[5] * m[10] - m[6] * m[9];
+		float c01 = m[6] * m[8] - m[4] * m[10];
+		float c02 = m[4] * m[9] - m[5] * m[8];
+		float invDet = 1.0f / (m[0] * c00 + m[1] * c01 + m[2] * c02);
+		inv.m[0] = c00 * invDet;
+		inv.m[1] = (m[2] * m[9] - m[1] * m[10]) * invDet;
+		inv.m[2] = (m[1] * m[6] - m[2] * m[5]) * invDet;
+		inv.m[4] = c01 * invDet;
+		inv.m[5] = (m[0] * m[10] - m[2] * m[8]) * invDet;
+		inv.m[6] = (m[2] * m[4] - m[0] * m[6]) * invDet;
+		inv.m[8] = c02 * invDet;
+		inv.m[9] = (m[1] * m[8] - m[0] * m[9]) * invDet;
+		inv.m[10] = (m[0] * m[5] - m[1] * m[4]) * invDet;
+		inv.m[3] = -(inv.m[0] * m[3] + inv.m[1] * m[7] + inv.m[2] * m[11]);
+		inv.m[7] = -(inv.m[4] * m[3] + inv.m[5] * m[7] + inv.m[6] * m[11]);
+		inv.m[11] = -(inv.m[8] * m[3] + inv.m[9] * m[7] + inv.m[10] * m[11]);
+#endif
+		return inv;
+	}
+
+
+	static void transformPoints(const Matrix& mat, const Vec3* points, Vec3* out, int count)   // mulPoint over a packed array
+	{
+		int i = 0;
+#if MATHS_SIMD_LEVEL > 0
+		__m128 m0 = _mm_set1_ps(mat.m[0]), m1 = _mm_set1_ps(mat.m[1]), m2 = _mm_set1_ps(mat.m[2]), m3 = _mm_set1_ps(mat.m[3]);
+		__m128 m4 = _mm_set1_ps(mat.m[4]), m5 = _mm_set1_ps(mat.m[5]), m6 = _mm_set1_ps(mat.m[6]), m7 = _mm_set1_ps(mat.m[7]);
+		__m128 m8 = _mm_set1_ps(mat.m[8]), m9 = _mm_set1_ps(mat.m[9]), m10 = _mm_set1_ps(mat.m[10]), m11 = _mm_set1_ps(mat.m[11]);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 x, y, z;
+			simdLoadVec3x4(&points[i], x, y, z);
+			__m128 ox = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m0), _mm_mul_ps(y, m1)), _mm_mul_ps(z, m2)), m3);
+			__m128 oy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m4), _mm_mul_ps(y, m5)), _mm_mul_ps(z, m6)), m7);
+			__m128 oz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m8), _mm_mul_ps(y, m9)), _mm_mul_ps(z, m10)), m11);
+			simdStoreVec3x4(&out[i], ox, oy, oz);
+		}
+#endif
+		for (; i < count; i++)
+		{
+			out[i] = mat.mulPoint(points[i]);
+		}
+	}
+
+
 	Matrix transpose(const Matrix& matrix) const   // transpose a 4x4 matrix
 	{
 		Matrix m;
@@ -840,6 +1017,58 @@ public:
 		matrix[15] = 1;
 		return matrix;
 	}
+	static void toMatrices(const Quaternion* quats, Matrix* out, int count)   // toMatrix over an array, 4 at a time with SIMD
+	{
+		int i = 0;
+#if MATHS_SIMD_LEVEL > 0
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 two = _mm_set1_ps(2.0f);
+		__m128 zero = _mm_setzero_ps();
+		__m128 lastRow = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 a = _mm_loadu_ps(quats[i].q);
+			__m128 b = _mm_loadu_ps(quats[i + 1].q);
+			__m128 c = _mm_loadu_ps(quats[i + 2].q);
+			__m128 d = _mm_loadu_ps(quats[i + 3].q);
+			_MM_TRANSPOSE4_PS(a, b, c, d);   // now a holds the a components of all 4 quaternions and so on
+
+			__m128 aa = _mm_mul_ps(a, a), ab = _mm_mul_ps(a, b), ac = _mm_mul_ps(a, c);
+			__m128 bb = _mm_mul_ps(b, b), cc = _mm_mul_ps(c, c), bc = _mm_mul_ps(b, c);
+			__m128 da = _mm_mul_ps(d, a), db = _mm_mul_ps(d, b), dc = _mm_mul_ps(d, c);
+
+			__m128 e0 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(bb, cc)));
+			__m128 e1 = _mm_mul_ps(two, _mm_sub_ps(ab, dc));
+			__m128 e2 = _mm_mul_ps(two, _mm_add_ps(ac, db));
+			__m128 e4 = _mm_mul_ps(two, _mm_add_ps(ab, dc));
+			__m128 e5 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(aa, cc)));
+			__m128 e6 = _mm_mul_ps(two, _mm_sub_ps(bc, da));
+			__m128 e8 = _mm_mul_ps(two, _mm_sub_ps(ac, db));
+			__m128 e9 = _mm_mul_ps(two, _mm_add_ps(bc, da));
+			__m128 e10 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(aa, bb)));
+
+			__m128 z0 = zero, z1 = zero, z2 = zero;
+			_MM_TRANSPOSE4_PS(e0, e1, e2, z0);
+			_MM_TRANSPOSE4_PS(e4, e5, e6, z1);
+			_MM_TRANSPOSE4_PS(e8, e9, e10, z2);
+			__m128 row0[4] = { e0, e1, e2, z0 };
+			__m128 row1[4] = { e4, e5, e6, z1 };
+			__m128 row2[4] = { e8, e9, e10, z2 };
+			for (int j = 0; j < 4; j++)
+			{
+				_mm_storeu_ps(&out[i + j].m[0], row0[j]);
+				_mm_storeu_ps(&out[i + j].m[4], row1[j]);
+				_mm_storeu_ps(&out[i + j].m[8], row2[j]);
+				_mm_storeu_ps(&out[i + j].m[12], lastRow);
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			Quaternion quat = quats[i];
+			out[i] = quat.toMatrix();
+		}
+	}
 	void rotateAboutAxis(Vec3 pt, float angle, Vec3 axis)
 	{
 		Quaternion q1, p, qinv;
@@ -1036,6 +1265,7 @@ public:
 		return (((p.x - v0.x) * (v1.y - v0.y)) - ((v1.x - v0.x) * (p.y - v0.y)));
 	}
 
+#ifndef GAME_HEADLESS
 	// Find bounds of box surrounding triangle 
 	void findBounds(Vec4& tr, Vec4& bl, GamesEngineeringBase::Window& canvas)
 	{
@@ -1054,6 +1284,7 @@ public:
 		tr.x = maxX;
 		tr.y = maxY;
 	}
+#endif
 
 
 	// Barycentric co-ordinates for inside the triangle